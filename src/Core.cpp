@@ -0,0 +1,1287 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+#include <tuple>
+#include <chrono>
+
+#undef major
+#undef minor
+
+#include "Core.h"
+
+#include "openssl/sha.h"
+#include "openssl/hmac.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+/* static */
+enum Core::Source Core::ParseSource (const string & s)
+{
+  if (s == "")     return Source::AUTO;
+  if (s == "iptv") return Source::IPTV;
+  if (s == "dvb")  return Source::DVB;
+  return Source::DEFAULT;
+}
+
+/* static */
+enum Core::Quality Core::ParseQuality (const string & q)
+{
+  if (q == "auto") return Quality::AUTO;
+  if (q == "hd")   return Quality::HD;
+  if (q == "sd")   return Quality::SD;
+  if (q == "ld")   return Quality::LD;
+  if (q == "3d")   return Quality::STEREO;
+  return Quality::DEFAULT;
+}
+
+/* static */
+enum Core::Protocol Core::ParseProtocol (const string & p)
+{
+  if (p == "rtsp") return Protocol::RTSP;
+  if (p == "hls")  return Protocol::HLS;
+  return Protocol::DEFAULT;
+}
+
+/* static */
+string Core::StrSource (enum Source s)
+{
+  switch (s)
+  {
+    case Source::AUTO : return "";
+    case Source::IPTV : return "iptv";
+    case Source::DVB  : return "dvb";
+    default           : return "";
+  }
+}
+
+/* static */
+string Core::StrQuality (enum Quality q)
+{
+  switch (q)
+  {
+    case Quality::AUTO   : return "auto";
+    case Quality::HD     : return "hd";
+    case Quality::SD     : return "sd";
+    case Quality::LD     : return "ld";
+    case Quality::STEREO : return "3d";
+    default              : return "";
+  }
+}
+
+/* static */
+string Core::StrProtocol (enum Protocol p)
+{
+  switch (p)
+  {
+    case Protocol::RTSP : return "rtsp";
+    case Protocol::HLS  : return "hls";
+    default             : return "";
+  }
+}
+
+/* static */
+string Core::Password (const string & token, const string & challenge)
+{
+  unsigned char password [EVP_MAX_MD_SIZE];
+  unsigned int length;
+
+  HMAC (EVP_sha1 (),
+        token.c_str (), token.length (),
+        (const unsigned char *) challenge.c_str (), challenge.length (),
+        password, &length);
+
+  ostringstream oss;
+  oss << hex << setfill ('0');
+  for (unsigned int i = 0; i < length; ++i)
+    oss << setw (2) << (int) password [i];
+
+  return oss.str ();
+}
+
+Core::Conflict::Conflict (const string & id,
+                          int n1, int n2,
+                          int p) :
+  uuid (id),
+  major (n1), minor (n2),
+  position (p)
+{
+}
+
+Core::Stream::Stream (enum Source  source,
+                         enum Quality quality,
+                         const string & rtsp,
+                         const string & hls) :
+  source (source),
+  quality (quality),
+  rtsp (rtsp),
+  hls (hls)
+{
+}
+
+Core::Stream::Stream (const json & s) :
+  source  (ParseSource  (s.value ("type", ""))),
+  quality (ParseQuality (s.value ("quality", ""))),
+  rtsp    (s.value ("rtsp", "")),
+  hls     (s.value ("hls", ""))
+{
+}
+
+/* static */
+Core::Stream Core::Stream::Cached (const json & s)
+{
+  return Stream ((enum Source)  s.value ("source",  (int) Source::DEFAULT),
+                 (enum Quality) s.value ("quality", (int) Quality::DEFAULT),
+                 s.value ("rtsp", ""),
+                 s.value ("hls", ""));
+}
+
+// Enum values rather than API strings, which don't round-trip (DEFAULT).
+json Core::Stream::Json () const
+{
+  return json {{"source",  (int) source},
+               {"quality", (int) quality},
+               {"rtsp",    rtsp},
+               {"hls",     hls}};
+}
+
+bool Core::Stream::operator== (const Stream & s) const
+{
+  return tie (source, quality, rtsp, hls) == tie (s.source, s.quality, s.rtsp, s.hls);
+}
+
+int Core::Stream::score (enum Source s) const
+{
+  switch (s)
+  {
+    case Source::AUTO:
+      switch (source)
+      {
+        case Source::AUTO: return 100;
+        case Source::IPTV: return 10;
+        case Source::DVB:  return 1;
+        default:           return 0;
+      }
+
+    case Source::IPTV:
+      switch (source)
+      {
+        case Source::AUTO: return 10;
+        case Source::IPTV: return 100;
+        case Source::DVB:  return 1;
+        default:           return 0;
+      }
+
+    case Source::DVB:
+      switch (source)
+      {
+        case Source::AUTO: return 10;
+        case Source::IPTV: return 1;
+        case Source::DVB:  return 100;
+        default:           return 0;
+      }
+
+    default:
+      return 0;
+  }
+}
+
+int Core::Stream::score (enum Quality q) const
+{
+  switch (q)
+  {
+    case Quality::AUTO:
+      switch (quality)
+      {
+        case Quality::AUTO: return 1000;
+        case Quality::HD:   return 100;
+        case Quality::SD:   return 10;
+        case Quality::LD:   return 1;
+        default:            return 0;
+      }
+
+    case Quality::HD:
+      switch (quality)
+      {
+        case Quality::AUTO: return 100;
+        case Quality::HD:   return 1000;
+        case Quality::SD:   return 10;
+        case Quality::LD:   return 1;
+        default:            return 0;
+      }
+
+    case Quality::SD:
+      switch (quality)
+      {
+        case Quality::AUTO: return 100;
+        case Quality::HD:   return 1;
+        case Quality::SD:   return 1000;
+        case Quality::LD:   return 10;
+        default:            return 0;
+      }
+
+    case Quality::LD:
+      switch (quality)
+      {
+        case Quality::AUTO: return 100;
+        case Quality::HD:   return 1;
+        case Quality::SD:   return 10;
+        case Quality::LD:   return 1000;
+        default:            return 0;
+      }
+
+    case Quality::STEREO:
+      return (quality == Quality::STEREO) ? 1000 : 0;
+
+    default:
+      return 0;
+  }
+}
+
+int Core::Stream::score (enum Source s, enum Quality q) const
+{
+  return 10000 * score (s) + score (q);
+}
+
+const string * Core::Stream::GetURL (enum Protocol protocol) const
+{
+  switch (protocol)
+  {
+    case Protocol::RTSP : return &rtsp;
+    case Protocol::HLS  : return &hls;
+    default             : return nullptr;
+  }
+}
+
+Core::Latency::Latency (const json & l) :
+  first_byte  (l.value ("first_byte", 0.0)),
+  first_frame (l.value ("first_frame", 0.0)),
+  samples     (l.value ("samples", 0)),
+  failures    (l.value ("failures", 0)),
+  date        (l.value ("date", (time_t) 0))
+{
+}
+
+json Core::Latency::Json () const
+{
+  return json {{"first_byte",  first_byte},
+               {"first_frame", first_frame},
+               {"samples",     samples},
+               {"failures",    failures},
+               {"date",        date}};
+}
+
+void Core::Latency::Add (double b, double f, time_t d)
+{
+  // Recent probes weigh more.
+  static const double ALPHA = 0.3;
+
+  date = d;
+  if (b < 0 || f < 0)
+  {
+    ++failures;
+    return;
+  }
+
+  first_byte  = samples > 0 ? (1 - ALPHA) * first_byte  + ALPHA * b : b;
+  first_frame = samples > 0 ? (1 - ALPHA) * first_frame + ALPHA * f : f;
+  failures    = 0;
+  ++samples;
+}
+
+bool Core::Latency::IsHealthy () const
+{
+  return samples > 0 && failures < 3;
+}
+
+Core::Channel::Channel (const string & uuid,
+                           const string & name,
+                           const string & logo,
+                           int major, int minor,
+                           const vector<Stream> & streams) :
+  radio (false),
+  uuid (uuid),
+  name (name),
+  logo (logo),
+  major (major), minor (minor),
+  streams (streams)
+{
+  Index ();
+}
+
+Core::Channel::Channel (const json & c) :
+  radio (false),
+  uuid  (c.value ("uuid", "")),
+  name  (c.value ("name", "")),
+  logo  (c.value ("logo", "")),
+  major (c.value ("major", 0)),
+  minor (c.value ("minor", 0)),
+  streams ()
+{
+  auto f = c.find ("streams");
+  if (f != c.end () && f->is_array ())
+    for (auto & s : *f)
+      streams.push_back (Stream::Cached (s));
+
+  Index ();
+}
+
+json Core::Channel::Json () const
+{
+  json s = json::array ();
+  for (auto & i : streams)
+    s.push_back (i.Json ());
+
+  return json {{"uuid",    uuid},
+               {"name",    name},
+               {"logo",    logo},
+               {"major",   major},
+               {"minor",   minor},
+               {"streams", s}};
+}
+
+bool Core::Channel::operator== (const Channel & c) const
+{
+  return tie (  radio,   uuid,   name,   logo,   major,   minor,   streams)
+      == tie (c.radio, c.uuid, c.name, c.logo, c.major, c.minor, c.streams);
+}
+
+bool Core::Channel::IsHidden () const
+{
+  return streams.empty ();
+}
+
+void Core::Channel::Index ()
+{
+  for (int s = -1; s <= (int) Source::DVB; ++s)
+    for (int q = -1; q <= (int) Quality::STEREO; ++q)
+    {
+      int index = -1;
+      int score = -1;
+
+      for (size_t i = 0; i < streams.size (); ++i)
+      {
+        int x = streams[i].score ((enum Source) s, (enum Quality) q);
+        if (x > score)
+        {
+          index = i;
+          score = x;
+        }
+      }
+
+      m_best [(s + 1) * 6 + (q + 1)] = index;
+    }
+}
+
+int Core::Channel::GetStream (enum Source source, enum Quality quality) const
+{
+  int s = (int) source  + 1;
+  int q = (int) quality + 1;
+  if (s < 0 || s >= 4 || q < 0 || q >= 6) return -1;
+  return m_best [s * 6 + q];
+}
+
+Core::ChannelDiff::ChannelDiff (const Channels & before, const Channels & after)
+{
+  // Both lists are sorted by id: a single merge.
+  auto i = before.begin ();
+  auto j = after.begin ();
+  while (i != before.end () || j != after.end ())
+  {
+    if (j == after.end () || (i != before.end () && i->first < j->first))
+      removed.push_back ((i++)->first);
+    else if (i == before.end () || j->first < i->first)
+      added.push_back ((j++)->first);
+    else
+    {
+      if (i->second != j->second) updated.push_back (j->first);
+      ++i, ++j;
+    }
+  }
+}
+
+bool Core::ChannelDiff::Empty () const
+{
+  return added.empty () && removed.empty () && updated.empty ();
+}
+
+Core::Queries::Windows::Windows (time_t t) :
+  now   (t),
+  begin (t - (t % 3600) - 3600),
+  soon  (t + 3 * 3600),
+  later (t + 24 * 3600)
+{
+}
+
+enum Core::Queries::Priority Core::Queries::Windows::operator() (time_t date) const
+{
+  if (date <  begin) return PAST;
+  if (date <  soon)  return CURRENT;
+  if (date <  later) return SOON;
+  return LATER;
+}
+
+Core::Queries::Queries () :
+  m_urgent (),
+  m_queries (),
+  m_types (),
+  m_queued ()
+{
+}
+
+bool Core::Queries::Push (const Query & q, bool urgent)
+{
+  if (! m_queued.insert (q.query).second)
+  {
+    if (! urgent) return false;
+
+    // Queued by air time: now urgent.
+    for (Map::iterator i = m_queries.begin (); i != m_queries.end (); ++i)
+      if (i->second.query == q.query)
+      {
+        m_urgent.push (i->second);
+        m_queries.erase (i);
+        break;
+      }
+
+    return false;
+  }
+
+  if (urgent)
+    m_urgent.push (q);
+  else
+    m_queries.emplace (q.date, q);
+
+  ++m_types [q.type];
+  return true;
+}
+
+bool Core::Queries::Pop (Query * q, time_t now)
+{
+  if (! m_urgent.empty ())
+  {
+    *q = m_urgent.front ();
+    m_urgent.pop ();
+    m_queued.erase (q->query);
+    --m_types [q->type];
+    return true;
+  }
+
+  if (m_queries.empty ()) return false;
+
+  const Windows w (now);
+  Map::iterator i = m_queries.end ();
+
+  // Current: closest to now.
+  Map::iterator after = m_queries.lower_bound (now);
+  if (after != m_queries.end () && after->first < w.soon)
+    i = after;
+  if (after != m_queries.begin ())
+  {
+    Map::iterator before = prev (after);
+    if (before->first >= w.begin)
+      if (i == m_queries.end () || now - before->first <= i->first - now)
+        i = before;
+  }
+
+  // Soon: earliest first.
+  if (i == m_queries.end ())
+  {
+    Map::iterator f = m_queries.lower_bound (w.soon);
+    if (f != m_queries.end () && f->first < w.later)
+      i = f;
+  }
+
+  // Past: latest first.
+  if (i == m_queries.end ())
+  {
+    Map::iterator f = m_queries.lower_bound (w.begin);
+    if (f != m_queries.begin ())
+      i = prev (f);
+  }
+
+  // Later: earliest first.
+  if (i == m_queries.end ())
+    i = m_queries.lower_bound (w.later);
+
+  if (i == m_queries.end ()) return false;
+
+  // Same air time: first in, first out.
+  i = m_queries.lower_bound (i->first);
+
+  *q = i->second;
+  m_queries.erase (i);
+  m_queued.erase (q->query);
+  --m_types [q->type];
+  return true;
+}
+
+bool Core::Queries::Empty () const
+{
+  return m_urgent.empty () && m_queries.empty ();
+}
+
+size_t Core::Queries::Size () const
+{
+  return m_urgent.size () + m_queries.size ();
+}
+
+size_t Core::Queries::Size (QueryType t) const
+{
+  auto f = m_types.find (t);
+  return f != m_types.end () ? f->second : 0;
+}
+
+size_t Core::Queries::Size (enum Priority p, time_t now) const
+{
+  if (p == URGENT) return m_urgent.size ();
+
+  const Windows w (now);
+  size_t size = 0;
+  for (auto & i : m_queries)
+    if (w (i.first) == p)
+      ++size;
+  return size;
+}
+
+Core::BroadcastMap::BroadcastMap () :
+  m_slots (1024, Slot {0, 0, 0}),
+  m_size (0)
+{
+}
+
+size_t Core::BroadcastMap::Home (unsigned int id) const
+{
+  return (size_t) (((uint64_t) (id + 1) * 0x9E3779B97F4A7C15ull) >> 32) & (m_slots.size () - 1);
+}
+
+// Linear probing, ID stored + 1 (0 marks an empty slot).
+size_t Core::BroadcastMap::Find (unsigned int id) const
+{
+  size_t mask = m_slots.size () - 1;
+  size_t i = Home (id);
+  while (m_slots [i].id != 0 && m_slots [i].id != id + 1)
+    i = (i + 1) & mask;
+  return i;
+}
+
+void Core::BroadcastMap::Rehash (size_t capacity, time_t now)
+{
+  vector<Slot> slots (capacity, Slot {0, 0, 0});
+  swap (slots, m_slots);
+  m_size = 0;
+
+  for (auto & s : slots)
+    if (s.id != 0 && s.expiry >= now)
+    {
+      m_slots [Find (s.id - 1)] = s;
+      ++m_size;
+    }
+}
+
+enum Core::BroadcastMap::Status Core::BroadcastMap::Update (unsigned int id, size_t fingerprint, time_t expiry)
+{
+  // Load factor <= 1/2.
+  if (2 * (m_size + 1) > m_slots.size ())
+    Rehash (2 * m_slots.size (), 0);
+
+  Slot & s = m_slots [Find (id)];
+  if (s.id == 0)
+  {
+    s = Slot {id + 1, fingerprint, expiry};
+    ++m_size;
+    return CREATED;
+  }
+
+  s.expiry = expiry;
+  if (s.fingerprint == fingerprint) return SAME;
+
+  s.fingerprint = fingerprint;
+  return UPDATED;
+}
+
+bool Core::BroadcastMap::Contains (unsigned int id) const
+{
+  return m_slots [Find (id)].id != 0;
+}
+
+// Backward shift (no tombstones).
+bool Core::BroadcastMap::Erase (unsigned int id)
+{
+  size_t mask = m_slots.size () - 1;
+  size_t i = Find (id);
+  if (m_slots [i].id == 0) return false;
+
+  for (size_t j = (i + 1) & mask; m_slots [j].id != 0; j = (j + 1) & mask)
+  {
+    size_t k = Home (m_slots [j].id - 1);
+    // Stays if its home slot is in (i, j].
+    if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+    m_slots [i] = m_slots [j];
+    i = j;
+  }
+
+  m_slots [i] = Slot {0, 0, 0};
+  --m_size;
+  return true;
+}
+
+void Core::BroadcastMap::Evict (time_t now)
+{
+  size_t capacity = 1024;
+  size_t alive = 0;
+  for (auto & s : m_slots)
+    if (s.id != 0 && s.expiry >= now)
+      ++alive;
+
+  if (alive == m_size) return;
+
+  while (capacity < 2 * alive) capacity *= 2;
+  Rehash (capacity, now);
+}
+
+void Core::BroadcastMap::Clear ()
+{
+  m_slots.assign (1024, Slot {0, 0, 0});
+  m_size = 0;
+}
+
+Core::Coverage::Coverage () :
+  m_hours ()
+{
+}
+
+void Core::Coverage::Request (time_t hour, time_t date)
+{
+  m_hours [hour].requested = date;
+}
+
+void Core::Coverage::Release (time_t hour)
+{
+  auto f = m_hours.find (hour);
+  if (f != m_hours.end ()) f->second.requested = 0;
+}
+
+bool Core::Coverage::IsRequested (time_t hour) const
+{
+  auto f = m_hours.find (hour);
+  return f != m_hours.end () && f->second.requested != 0;
+}
+
+void Core::Coverage::Fetch (time_t hour, unsigned int channel, time_t date)
+{
+  m_hours [hour].fetched [channel] = date;
+}
+
+time_t Core::Coverage::Fetched (time_t hour) const
+{
+  auto f = m_hours.find (hour);
+  if (f == m_hours.end () || f->second.fetched.empty ()) return 0;
+
+  time_t date = f->second.fetched.begin ()->second;
+  for (auto & c : f->second.fetched)
+    date = min (date, c.second);
+  return date;
+}
+
+time_t Core::Coverage::Fetched (time_t hour, unsigned int channel) const
+{
+  auto f = m_hours.find (hour);
+  if (f == m_hours.end ()) return 0;
+
+  auto g = f->second.fetched.find (channel);
+  return g != f->second.fetched.end () ? g->second : 0;
+}
+
+map<time_t, time_t> Core::Coverage::Hours () const
+{
+  map<time_t, time_t> hours;
+  for (auto & h : m_hours)
+  {
+    time_t date = Fetched (h.first);
+    if (date != 0) hours.emplace (h.first, date);
+  }
+  return hours;
+}
+
+vector<time_t> Core::Coverage::Missing (time_t begin, time_t end, time_t now, time_t ttl) const
+{
+  vector<time_t> hours;
+  for (time_t t = begin - (begin % 3600); t < end; t += 3600)
+    if (! IsRequested (t) && now - Fetched (t) >= ttl)
+      hours.push_back (t);
+  return hours;
+}
+
+void Core::Coverage::Invalidate (unsigned int channel)
+{
+  for (auto & h : m_hours)
+    h.second.fetched [channel] = 0;
+}
+
+void Core::Coverage::Erase (unsigned int channel)
+{
+  for (auto & h : m_hours)
+    h.second.fetched.erase (channel);
+}
+
+void Core::Coverage::Drop (time_t before)
+{
+  m_hours.erase (m_hours.begin (), m_hours.lower_bound (before));
+}
+
+Core::Digests::Digests () :
+  m_mutex (),
+  m_digests (),
+  m_hits (0),
+  m_misses (0),
+  m_saved (0)
+{
+}
+
+/* static */
+size_t Core::Digests::Hash (const string & body)
+{
+  static const hash<string> HASH;
+  return HASH (body);
+}
+
+bool Core::Digests::IsSame (const string & query, size_t hash)
+{
+  lock_guard<mutex> lock (m_mutex);
+  auto f = m_digests.find (query);
+  if (f != m_digests.end () && f->second.hash == hash)
+  {
+    ++m_hits;
+    m_saved += f->second.ms;
+    return true;
+  }
+
+  ++m_misses;
+  return false;
+}
+
+void Core::Digests::Record (const string & query, size_t hash, double ms)
+{
+  lock_guard<mutex> lock (m_mutex);
+  m_digests [query] = Digest {hash, ms};
+}
+
+void Core::Digests::Forget (const string & prefix)
+{
+  lock_guard<mutex> lock (m_mutex);
+  auto i = m_digests.lower_bound (prefix);
+  while (i != m_digests.end () && i->first.compare (0, prefix.length (), prefix) == 0)
+    i = m_digests.erase (i);
+}
+
+string Core::Digests::str () const
+{
+  lock_guard<mutex> lock (m_mutex);
+  size_t total = m_hits + m_misses;
+  ostringstream oss;
+  oss << fixed << setprecision (1)
+      << m_hits << '/' << total << " unchanged ("
+      << (total != 0 ? 100.0 * m_hits / total : 0.0) << "%), "
+      << m_saved << " ms saved";
+  return oss.str ();
+}
+
+Core::SharedMutex::SharedMutex () :
+  m_mutex (),
+  m_stats_mutex (),
+  m_stats ()
+{
+}
+
+Core::SharedMutex::Clock::time_point Core::SharedMutex::Record (Clock::time_point start)
+{
+  Clock::time_point now = Clock::now ();
+  double ms = chrono::duration<double, milli> (now - start).count ();
+
+  lock_guard<mutex> lock (m_stats_mutex);
+  m_stats.count   += 1;
+  m_stats.wait    += ms;
+  m_stats.wait_max = max (m_stats.wait_max, ms);
+  return now;
+}
+
+void Core::SharedMutex::Record (Clock::time_point acquired, Clock::time_point released)
+{
+  double ms = chrono::duration<double, milli> (released - acquired).count ();
+
+  lock_guard<mutex> lock (m_stats_mutex);
+  m_stats.hold    += ms;
+  m_stats.hold_max = max (m_stats.hold_max, ms);
+}
+
+Core::SharedMutex::Stats Core::SharedMutex::GetStats () const
+{
+  lock_guard<mutex> lock (m_stats_mutex);
+  return m_stats;
+}
+
+Core::SharedMutex::Unique::Unique (SharedMutex & m) :
+  m_mutex (m),
+  m_start (Clock::now ())
+{
+  m_mutex.m_mutex.lock ();
+  m_start = m_mutex.Record (m_start);
+}
+
+Core::SharedMutex::Unique::~Unique ()
+{
+  Clock::time_point end = Clock::now ();
+  m_mutex.m_mutex.unlock ();
+  m_mutex.Record (m_start, end);
+}
+
+Core::SharedMutex::Shared::Shared (SharedMutex & m) :
+  m_mutex (m),
+  m_start (Clock::now ())
+{
+  m_mutex.m_mutex.lock_shared ();
+  m_start = m_mutex.Record (m_start);
+}
+
+Core::SharedMutex::Shared::~Shared ()
+{
+  Clock::time_point end = Clock::now ();
+  m_mutex.m_mutex.unlock_shared ();
+  m_mutex.Record (m_start, end);
+}
+
+string Core::SharedMutex::Stats::str () const
+{
+  ostringstream oss;
+  oss << fixed << setprecision (2)
+      << count << " locks, wait "
+      << (count != 0 ? wait / count : 0.0) << '/' << wait_max << " ms, hold "
+      << (count != 0 ? hold / count : 0.0) << '/' << hold_max << " ms (avg/max)";
+  return oss.str ();
+}
+
+string Core::Event::Native (int c)
+{
+  switch (c)
+  {
+    case  1: return "Film";
+    case  2: return "Téléfilm";
+    case  3: return "Série/Feuilleton";
+    case  4: return "Feuilleton";
+    case  5: return "Documentaire";
+    case  6: return "Théâtre";
+    case  7: return "Opéra";
+    case  8: return "Ballet";
+    case  9: return "Variétés";
+    case 10: return "Magazine";
+    case 11: return "Jeunesse";
+    case 12: return "Jeu";
+    case 13: return "Musique";
+    case 14: return "Divertissement";
+    case 16: return "Dessin animé";
+    case 19: return "Sport";
+    case 20: return "Journal";
+    case 22: return "Débat";
+    case 24: return "Spectacle";
+    case 31: return "Emission religieuse";
+    default: return "";
+  };
+}
+
+int Core::Event::Colors (int c)
+{
+  switch (c)
+  {
+    case  1: return 0x10; // Film
+    case  2: return 0x10; // Téléfilm
+    case  3: return 0x10; // Série/Feuilleton
+    case  4: return 0x15; // Feuilleton
+    case  5: return 0x23; // Documentaire
+    case  6: return 0x70; // Théâtre
+    case  7: return 0x65; // Opéra
+    case  8: return 0x66; // Ballet
+    case  9: return 0x32; // Variétés
+    case 10: return 0x81; // Magazine
+    case 11: return 0x50; // Jeunesse
+    case 12: return 0x31; // Jeu
+    case 13: return 0x60; // Musique
+    case 14: return 0x32; // Divertissement
+    case 16: return 0x55; // Dessin animé
+    case 19: return 0x40; // Sport
+    case 20: return 0x21; // Journal
+    case 22: return 0x24; // Débat
+    case 24: return 0x70; // Spectacle
+    case 31: return 0x73; // Emission religieuse
+    default: return 0x00;
+  };
+}
+
+template <class T>
+inline void freebox_set (const json & value, T * t)
+{
+  if (value.is_number ()) *t = value.get<T> ();
+}
+
+inline void freebox_set (const json & value, string * t)
+{
+  if (value.is_string ()) *t = value.get<string> ();
+}
+
+Core::Event::CastMember::CastMember () :
+  job        (),
+  first_name (),
+  last_name  (),
+  role       ()
+{
+}
+
+Core::Event::CastMember::CastMember (const json & c) :
+  job        (c.value ("job", "")),
+  first_name (c.value ("first_name", "")),
+  last_name  (c.value ("last_name", "")),
+  role       (c.value ("role", ""))
+{
+}
+
+void Core::Event::CastMember::Set (const string & key, const json & value)
+{
+  /**/ if (key == "job")        freebox_set (value, &job);
+  else if (key == "first_name") freebox_set (value, &first_name);
+  else if (key == "last_name")  freebox_set (value, &last_name);
+  else if (key == "role")       freebox_set (value, &role);
+}
+
+json Core::Event::CastMember::Json () const
+{
+  return json {{"job",        job},
+               {"first_name", first_name},
+               {"last_name",  last_name},
+               {"role",       role}};
+}
+
+Core::Event::Event (unsigned int channel, time_t date) :
+  channel  (channel),
+  uuid     (),
+  date     (date),
+  duration (0),
+  title    (),
+  subtitle (),
+  season   (0),
+  episode  (0),
+  category (0),
+  picture  (),
+  plot     (),
+  outline  (),
+  year     (0),
+  cast     ()
+{
+}
+
+Core::Event::Event (const json & e, unsigned int channel, time_t date) :
+  channel  (channel),
+  uuid     (e.value ("id", "")),
+  date     (e.value ("date", date)),
+  duration (e.value ("duration", 0)),
+  title    (e.value ("title", "")),
+  subtitle (e.value ("sub_title", "")),
+  season   (e.value ("season_number", 0)),
+  episode  (e.value ("episode_number", 0)),
+  category (e.value ("category", 0)),
+  picture  (e.value ("picture_big", e.value ("picture", ""))),
+  plot     (e.value ("desc", "")),
+  outline  (e.value ("short_desc", "")),
+  year     (e.value ("year", 0)),
+  cast     ()
+{
+  if (category != 0 && Colors (category) == 0)
+  {
+    string name = e.value ("category_name", "");
+    cout << category << " : " << name << endl;
+  }
+
+  auto f = e.find ("cast");
+  if (f != e.end ())
+    if (f->is_array ())
+      for (auto & c : *f)
+        cast.emplace_back (c);
+}
+
+// "picture_big" takes precedence over "picture" (see EpgParser).
+void Core::Event::Set (const string & key, const json & value)
+{
+  /**/ if (key == "id")             freebox_set (value, &uuid);
+  else if (key == "date")           freebox_set (value, &date);
+  else if (key == "duration")       freebox_set (value, &duration);
+  else if (key == "title")          freebox_set (value, &title);
+  else if (key == "sub_title")      freebox_set (value, &subtitle);
+  else if (key == "season_number")  freebox_set (value, &season);
+  else if (key == "episode_number") freebox_set (value, &episode);
+  else if (key == "category")       freebox_set (value, &category);
+  else if (key == "picture")        freebox_set (value, &picture);
+  else if (key == "picture_big")    freebox_set (value, &picture);
+  else if (key == "desc")           freebox_set (value, &plot);
+  else if (key == "short_desc")     freebox_set (value, &outline);
+  else if (key == "year")           freebox_set (value, &year);
+}
+
+json Core::Event::Json () const
+{
+  json e {{"id",             uuid},
+          {"date",           date},
+          {"duration",       duration},
+          {"title",          title},
+          {"sub_title",      subtitle},
+          {"season_number",  season},
+          {"episode_number", episode},
+          {"category",       category},
+          {"picture",        picture},
+          {"desc",           plot},
+          {"short_desc",     outline},
+          {"year",           year}};
+
+  if (! cast.empty ())
+  {
+    json & c = e ["cast"] = json::array ();
+    for (auto & m : cast)
+      c.push_back (m.Json ());
+  }
+
+  return e;
+}
+
+size_t Core::Event::Fingerprint () const
+{
+  static const hash<string> HASH;
+
+  size_t h = HASH (uuid);
+  auto combine = [&h] (size_t v) {h ^= v + 0x9E3779B9 + (h << 6) + (h >> 2);};
+
+  combine (HASH (title));
+  combine (HASH (subtitle));
+  combine (HASH (picture));
+  combine ((size_t) date);
+  combine ((size_t) duration);
+  combine ((size_t) season);
+  combine ((size_t) episode);
+  combine ((size_t) category);
+  combine ((size_t) year);
+
+  return h;
+}
+
+string Core::Event::GetCast (const string & job) const
+{
+  string text;
+  for (auto & m : cast)
+  {
+    if (m.job != job) continue;
+    if (! text.empty ()) text += PVR_FREEBOX_TOKEN_SEPARATOR;
+    text += m.first_name;
+    text += ' ';
+    text += m.last_name;
+  }
+  return text;
+}
+
+string Core::Event::GetCastDirector () const
+{
+  static const string JOB = "Réalisateur";
+  return GetCast (JOB);
+}
+
+string Core::Event::GetCastActors () const
+{
+  static const string JOB = "Acteur";
+  return GetCast (JOB);
+}
+
+/* static */
+void Core::EventsBetween (const map<time_t, Event> & m, time_t start, time_t end, vector<Event> * events)
+{
+  // First event ending after start.
+  auto i = m.lower_bound (start);
+  if (i != m.begin ())
+  {
+    auto p = prev (i);
+    if (p->second.date + p->second.duration > start) i = p;
+  }
+
+  for (; i != m.end () && i->first < end; ++i)
+    events->push_back (i->second);
+}
+
+/* static */
+map<int, Core::Conflict> Core::ResolveConflicts (const json & bouquet)
+{
+  // Bouquet entry (interned UUID).
+  struct Entry
+  {
+    int major, minor;
+    int position;
+    int uuid;
+  };
+
+  vector<string>                uuids;
+  unordered_map<string, int>    index;
+  vector<Entry>                 entries;
+
+  entries.reserve (bouquet.size ());
+  for (size_t i = 0; i < bouquet.size (); ++i)
+  {
+    const json & b = bouquet [i];
+
+    // Not a channel.
+    if (! b.is_object () || ! b.contains ("uuid") || ! b.contains ("number")) continue;
+
+    string uuid  = b.value ("uuid", "");
+    int    major = b.value ("number", 0);
+    int    minor = b.value ("sub_number", 0);
+
+    auto r = index.emplace (uuid, (int) uuids.size ());
+    if (r.second) uuids.push_back (uuid);
+
+    entries.push_back ({major, minor, (int) i, r.first->second});
+  }
+
+  sort (entries.begin (), entries.end (),
+    [] (const Entry & e1, const Entry & e2)
+    {
+      return tie (e1.major, e1.minor, e1.position) < tie (e2.major, e2.minor, e2.position);
+    });
+
+  // Each major goes to its lowest minor, each UUID keeps the lowest major it got.
+  vector<bool> assigned (uuids.size (), false);
+
+  map<int, Conflict> result;
+  for (size_t i = 0; i < entries.size (); ++i)
+  {
+    const Entry & e = entries [i];
+
+    if (i > 0 && entries [i - 1].major == e.major) continue;
+    if (assigned [e.uuid]) continue;
+
+    assigned [e.uuid] = true;
+    result.emplace_hint (result.end (), e.major, Conflict (uuids [e.uuid], e.major, e.minor, e.position));
+  }
+
+  return result;
+}
+
+Core::Recording::Recording (const json & r) :
+  id              (r.value ("id", -1)),
+  start           (r.value ("start", 0)),
+  end             (r.value ("end", 0)),
+  name            (r.value ("name", "")),
+  subname         (r.value ("subname", "")),
+  channel_uuid    (r.value ("channel_uuid", "")),
+  channel_name    (r.value ("channel_name", "")),
+//channel_quality (r.value ("channel_quality", "")),
+//channel_type    (r.value ("channel_type", "")),
+//broadcast_type  (r.value ("broadcast_type", "")),
+  media           (r.value ("media", "")),
+  path            (r.value ("path", "")),
+  filename        (r.value ("filename", "")),
+  byte_size       (r.value ("byte_size", 0)),
+  secure          (r.value ("secure", false))
+{
+}
+
+bool Core::Recording::operator== (const Recording & r) const
+{
+  return tie (  id,   start,   end,   name,   subname,   channel_uuid,   channel_name,   media,   path,   filename,   byte_size,   secure)
+      == tie (r.id, r.start, r.end, r.name, r.subname, r.channel_uuid, r.channel_name, r.media, r.path, r.filename, r.byte_size, r.secure);
+}
+
+Core::Generator::Generator (const json & g) :
+  id               (g.value ("id", -1)),
+//type             (g.value ("type", "")),
+  media            (g.value ("media", "")),
+  path             (g.value ("path", "")),
+  name             (g.value ("name", "")),
+//subname          (g.value ("name", "")),
+  channel_uuid     (g.value ("/params/channel_uuid"_json_pointer, "")),
+//channel_type     (g.value ("/params/channel_type"_json_pointer, "")),
+//channel_quality  (g.value ("/params/channel_quality"_json_pointer, "")),
+//channel_strict   (g.value ("/params/channel_strict"_json_pointer, ""))
+//broadcast_type   (g.value ("/params/broadcast_type"_json_pointer, ""))
+  start_hour       (g.value ("/params/start_hour"_json_pointer, 0)),
+  start_min        (g.value ("/params/start_min"_json_pointer, 0)),
+  duration         (g.value ("/params/duration"_json_pointer, 0)),
+  margin_before    (g.value ("/params/margin_before"_json_pointer, 0)),
+  margin_after     (g.value ("/params/margin_after"_json_pointer, 0)),
+  repeat_monday    (g.value ("/params/repeat_days/monday"_json_pointer, false)),
+  repeat_tuesday   (g.value ("/params/repeat_days/tuesday"_json_pointer, false)),
+  repeat_wednesday (g.value ("/params/repeat_days/wednesday"_json_pointer, false)),
+  repeat_thursday  (g.value ("/params/repeat_days/thursday"_json_pointer, false)),
+  repeat_friday    (g.value ("/params/repeat_days/friday"_json_pointer, false)),
+  repeat_saturday  (g.value ("/params/repeat_days/saturday"_json_pointer, false)),
+  repeat_sunday    (g.value ("/params/repeat_days/sunday"_json_pointer,  false))
+{
+}
+
+bool Core::Generator::operator== (const Generator & g) const
+{
+  return tie (  id,   media,   path,   name,   channel_uuid,   start_hour,   start_min,   duration,   margin_before,   margin_after)
+      == tie (g.id, g.media, g.path, g.name, g.channel_uuid, g.start_hour, g.start_min, g.duration, g.margin_before, g.margin_after)
+      && tie (  repeat_monday,   repeat_tuesday,   repeat_wednesday,   repeat_thursday,   repeat_friday,   repeat_saturday,   repeat_sunday)
+      == tie (g.repeat_monday, g.repeat_tuesday, g.repeat_wednesday, g.repeat_thursday, g.repeat_friday, g.repeat_saturday, g.repeat_sunday);
+}
+
+Core::Timer::Timer (const json & t) :
+  id             (t.value ("id", -1)),
+  start          (t.value ("start", 0)),
+  end            (t.value ("end", 0)),
+  margin_before  (t.value ("margin_before", 0)),
+  margin_after   (t.value ("margin_after", 0)),
+  name           (t.value ("name", "")),
+  subname        (t.value ("subname", "")),
+  channel_uuid   (t.value ("channel_uuid", "")),
+  channel_name   (t.value ("channel_name", "")),
+//channel_type   (t.value ("channel_type", "")),
+//broadcast_type (t.value ("broadcast_type", "")),
+  media          (t.value ("media", "")),
+  path           (t.value ("path", "")),
+  has_record_gen (t.value ("has_record_gen", false)),
+  record_gen_id  (t.value ("record_gen_id", 0)),
+  enabled        (t.value ("enabled", false)),
+  conflict       (t.value ("conflict", false)),
+  state          (t.value ("state", "disabled")),
+  error          (t.value ("error", "none"))
+{
+}
+
+bool Core::Timer::operator== (const Timer & t) const
+{
+  return tie (  id,   start,   end,   margin_before,   margin_after,   name,   subname,   channel_uuid,   channel_name,
+                media,   path,   has_record_gen,   record_gen_id,   enabled,   conflict,   state,   error)
+      == tie (t.id, t.start, t.end, t.margin_before, t.margin_after, t.name, t.subname, t.channel_uuid, t.channel_name,
+              t.media, t.path, t.has_record_gen, t.record_gen_id, t.enabled, t.conflict, t.state, t.error);
+}
+
@@ -0,0 +1,770 @@
+#pragma once
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <map>
+#include <array>
+#include <queue>
+#include <set>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <shared_mutex>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <nlohmann/json.hpp>
+
+// Same as Kodi's EPG_STRING_TOKEN_SEPARATOR.
+#define PVR_FREEBOX_TOKEN_SEPARATOR ","
+
+// Stable integer IDs (thread-safe).
+template <class K>
+class Index
+{
+  private:
+    std::mutex       m_mutex;
+    int              m_id;
+    std::map<K, int> m_map;
+
+  public:
+    inline
+    Index (int first = 0) :
+      m_mutex (),
+      m_id (first),
+      m_map ()
+    {
+    }
+
+    inline
+    int operator() (const K & key)
+    {
+      std::lock_guard<std::mutex> lock (m_mutex);
+#if __cplusplus >= 201703L
+      auto [i, success] = m_map.emplace (key, m_id);
+      return success ? m_id++ : i->second;
+#else
+      auto r = m_map.emplace (key, m_id);
+      return r.second ? m_id++ : r.first->second;
+#endif
+    }
+};
+
+// Kodi-independent part of the add-on (freebox_core): data model, parsers,
+// bouquet conflict resolution, and stream selection.
+class Core
+{
+  public:
+    inline static unsigned int ChannelId (const std::string & uuid)
+    {
+      return std::stoi (uuid.substr (11)); // uuid-webtv-*
+    }
+
+    inline static unsigned int BroadcastId (const std::string & uuid)
+    {
+      return std::stoi (uuid.substr (6)); // pluri_*
+    }
+
+    // Channel source.
+    enum class Source {DEFAULT = -1, AUTO = 0, IPTV = 1, DVB = 2};
+
+    // Channel quality.
+    enum class Quality {DEFAULT = -1, AUTO = 0, HD = 1, SD = 2, LD = 3, STEREO = 4};
+
+    // Streaming protocol.
+    enum class Protocol {DEFAULT = -1, RTSP = 1, HLS = 2};
+
+    class Stream
+    {
+      public:
+        enum Source  source;
+        enum Quality quality;
+        std::string  rtsp;
+        std::string  hls;
+
+      protected:
+        int score (enum Source)  const;
+        int score (enum Quality) const;
+
+      public:
+        Stream (enum Source,
+                enum Quality,
+                const std::string & rtsp,
+                const std::string & hls);
+        // API layout ("type", "quality", "rtsp", "hls").
+        Stream (const nlohmann::json &);
+        // Cache layout (enum values, as is: see Json).
+        static Stream Cached (const nlohmann::json &);
+        nlohmann::json Json () const;
+        bool operator== (const Stream &) const;
+        int score (enum Source, enum Quality) const;
+        // URL for a protocol (nullptr if none).
+        const std::string * GetURL (enum Protocol) const;
+    };
+
+    // Stream start latency, from probes (rolling averages, ms).
+    class Latency
+    {
+      public:
+        double first_byte  = 0;
+        double first_frame = 0;
+        int    samples     = 0;
+        int    failures    = 0; // in a row
+        time_t date        = 0; // last probe
+
+      public:
+        Latency () {}
+        Latency (const nlohmann::json &);
+        nlohmann::json Json () const;
+        // Probe outcome (negative if the stream did not start).
+        void Add (double first_byte, double first_frame, time_t date);
+        // Measured, and not failing lately.
+        bool IsHealthy () const;
+    };
+
+    class Channel
+    {
+      public:
+        typedef std::map<enum Quality, std::string> Streams;
+
+      public:
+        bool                radio;
+        std::string         uuid;
+        std::string         name;
+        std::string         logo;
+        int                 major;
+        int                 minor;
+        std::vector<Stream> streams;
+
+      protected:
+        // Best stream, by source and quality (DEFAULT included).
+        std::array<int, 4 * 6> m_best;
+        void Index ();
+
+      public:
+        Channel (const std::string & uuid,
+                 const std::string & name,
+                 const std::string & logo,
+                 int major, int minor,
+                 const std::vector<Stream> &);
+        // Cache layout (see Json).
+        Channel (const nlohmann::json &);
+        nlohmann::json Json () const;
+        bool operator== (const Channel &) const;
+        bool operator!= (const Channel & x) const {return ! (*this == x);}
+
+        bool IsHidden () const;
+        // Best stream for a source/quality (-1 if none).
+        int GetStream (enum Source, enum Quality) const;
+    };
+
+    // Channel list, by channel ID.
+    typedef std::map<unsigned int, Channel> Channels;
+
+    // Channels added, removed or changed from one list to the next.
+    class ChannelDiff
+    {
+      public:
+        std::vector<unsigned int> added;
+        std::vector<unsigned int> removed;
+        std::vector<unsigned int> updated;
+
+      public:
+        ChannelDiff (const Channels & before, const Channels & after);
+        bool Empty () const;
+    };
+
+    // Query types.
+    enum QueryType {NONE = 0, FULL = 1, CHANNEL = 2, EVENT = 3};
+
+    class Query
+    {
+      public:
+        QueryType    type;
+        std::string  query;
+        unsigned int channel;
+        time_t       date;
+
+      public:
+        Query () : type (NONE) {}
+
+        Query (QueryType t,
+               const std::string & q,
+               unsigned int c = 0,
+               time_t d = 0) :
+          type (t),
+          query (q),
+          channel (c),
+          date (d)
+        {
+        }
+    };
+
+    // Queries ordered by air time, the useful part of the guide first:
+    // current (previous, current and next hours), soon (24 hours), past,
+    // then later. Urgent queries (on demand) come before all of them.
+    // A query is queued once (same path), until popped.
+    class Queries
+    {
+      public:
+        enum Priority {URGENT = -1, CURRENT = 0, SOON = 1, PAST = 2, LATER = 3};
+
+      protected:
+        typedef std::multimap<time_t, Query> Map;
+
+        // Priority windows.
+        class Windows
+        {
+          public:
+            time_t now;
+            time_t begin; // CURRENT
+            time_t soon;  // SOON
+            time_t later; // LATER
+
+          public:
+            Windows (time_t now);
+            enum Priority operator() (time_t date) const;
+        };
+
+      private:
+        std::queue<Query>            m_urgent;
+        Map                          m_queries;
+        std::map<QueryType, size_t>  m_types;
+        std::set<std::string>        m_queued; // paths
+
+      public:
+        Queries ();
+        // False if already queued (an urgent push moves it to the urgent ones).
+        bool   Push  (const Query &, bool urgent = false);
+        bool   Pop   (Query *, time_t now);
+        bool   Empty () const;
+        size_t Size  () const;
+        size_t Size  (QueryType) const;
+        size_t Size  (enum Priority, time_t now) const;
+    };
+
+    // EPG events.
+    class Event
+    {
+      public:
+        static std::string Native (int);
+        static int         Colors (int);
+
+      public:
+        class CastMember
+        {
+          public:
+            std::string job;
+            std::string first_name;
+            std::string last_name;
+            std::string role;
+
+          public:
+            CastMember ();
+            CastMember (const nlohmann::json &);
+            void Set (const std::string & key, const nlohmann::json & value);
+            nlohmann::json Json () const;
+        };
+
+        typedef std::vector<CastMember> Cast;
+
+      protected:
+        // Names of the cast members with a given job, in a single buffer.
+        std::string GetCast (const std::string & job) const;
+
+      public:
+        unsigned int channel;
+        std::string  uuid;
+        time_t       date;
+        int          duration;
+        std::string  title;
+        std::string  subtitle;
+        int          season;
+        int          episode;
+        int          category;
+        std::string  picture;
+        std::string  plot;
+        std::string  outline;
+        int          year;
+        Cast         cast;
+
+      public:
+        Event (unsigned int channel = 0, time_t date = 0);
+        Event (const nlohmann::json &, unsigned int channel, time_t date);
+        void Set (const std::string & key, const nlohmann::json & value);
+        // Same layout as the API (see Event (const nlohmann::json &, ...)).
+        nlohmann::json Json () const;
+        // Hash of the fields found in EPG pages (not the extended ones).
+        size_t Fingerprint () const;
+        std::string GetCastDirector () const;
+        std::string GetCastActors   () const;
+    };
+
+    // Open-addressing map of broadcast IDs to event fingerprints,
+    // each one with an expiry date.
+    class BroadcastMap
+    {
+      public:
+        enum Status {SAME = 0, CREATED = 1, UPDATED = 2};
+
+      protected:
+        class Slot
+        {
+          public:
+            unsigned int id;          // 0 = empty
+            size_t       fingerprint;
+            time_t       expiry;
+        };
+
+      private:
+        std::vector<Slot> m_slots; // power of two
+        size_t            m_size;
+
+      protected:
+        size_t Home (unsigned int id) const;
+        size_t Find (unsigned int id) const;
+        void   Rehash (size_t capacity, time_t now);
+
+      public:
+        BroadcastMap ();
+        // Store a fingerprint, and tell how it compares to the previous one.
+        Status Update   (unsigned int id, size_t fingerprint, time_t expiry);
+        bool   Contains (unsigned int id) const;
+        bool   Erase    (unsigned int id);
+        // Drop IDs expired before now.
+        void   Evict    (time_t now);
+        void   Clear    ();
+        size_t Size     () const {return m_size;}
+    };
+
+    // EPG coverage: fetch dates by hour and channel.
+    class Coverage
+    {
+      protected:
+        class Hour
+        {
+          public:
+            time_t                         requested; // 0 if not queued
+            std::map<unsigned int, time_t> fetched;
+        };
+
+      private:
+        std::map<time_t, Hour> m_hours;
+
+      public:
+        Coverage ();
+        // Hour page queued / done (whatever the outcome).
+        void Request (time_t hour, time_t date);
+        void Release (time_t hour);
+        bool IsRequested (time_t hour) const;
+        // Channel fetched.
+        void Fetch (time_t hour, unsigned int channel, time_t date);
+        // Oldest fetch date (0 if missing).
+        time_t Fetched (time_t hour) const;
+        time_t Fetched (time_t hour, unsigned int channel) const;
+        // Oldest fetch date of each hour.
+        std::map<time_t, time_t> Hours () const;
+        // Hours to fetch from begin (rounded down to the hour) to end: missing,
+        // failed, partly fetched or older than the TTL, and not queued.
+        std::vector<time_t> Missing (time_t begin, time_t end, time_t now, time_t ttl) const;
+        // Channel to fetch again (new, or visible again) / gone.
+        void Invalidate (unsigned int channel);
+        void Erase      (unsigned int channel);
+        // Drop the hours before a date.
+        void Drop (time_t before);
+    };
+
+    // Hashes of the last response bodies, by query (thread-safe).
+    class Digests
+    {
+      protected:
+        class Digest
+        {
+          public:
+            size_t hash;
+            double ms;   // processing time
+        };
+
+      private:
+        mutable std::mutex            m_mutex;
+        std::map<std::string, Digest> m_digests;
+        size_t                        m_hits;
+        size_t                        m_misses;
+        double                        m_saved; // ms
+
+      public:
+        Digests ();
+        static size_t Hash (const std::string & body);
+        // Same body as the last one recorded?
+        bool IsSame (const std::string & query, size_t hash);
+        // Body processed successfully (in ms).
+        void Record (const std::string & query, size_t hash, double ms);
+        // Forget the queries starting with a prefix.
+        void Forget (const std::string & prefix);
+        std::string str () const;
+    };
+
+    // Reader/writer lock, with wait and hold times.
+    class SharedMutex
+    {
+      public:
+        typedef std::chrono::steady_clock Clock;
+
+        class Stats
+        {
+          public:
+            size_t count    = 0; // acquisitions
+            double wait     = 0; // total (ms)
+            double wait_max = 0; // ms
+            double hold     = 0; // total (ms)
+            double hold_max = 0; // ms
+
+          public:
+            std::string str () const;
+        };
+
+        // Exclusive (scoped).
+        class Unique
+        {
+          private:
+            SharedMutex &     m_mutex;
+            Clock::time_point m_start;
+
+          public:
+            Unique (SharedMutex &);
+            ~Unique ();
+        };
+
+        // Shared (scoped).
+        class Shared
+        {
+          private:
+            SharedMutex &     m_mutex;
+            Clock::time_point m_start;
+
+          public:
+            Shared (SharedMutex &);
+            ~Shared ();
+        };
+
+      private:
+        std::shared_timed_mutex m_mutex;
+        mutable std::mutex      m_stats_mutex;
+        Stats                   m_stats;
+
+      protected:
+        // Returns the acquisition time.
+        Clock::time_point Record (Clock::time_point start);
+        void Record (Clock::time_point acquired, Clock::time_point released);
+
+      public:
+        SharedMutex ();
+        Stats GetStats () const;
+    };
+
+    // Streaming parser for EPG pages ({"success": ..., "result": {"uuid-webtv-*": [...]}}).
+    class EpgParser;
+
+    // Generator.
+    class Generator
+    {
+      public:
+        int          id;
+      //std::string  type;
+        std::string  media;
+        std::string  path;
+        std::string  name;
+      //std::string  subname;
+        std::string  channel_uuid;
+      //std::string  channel_type;
+      //std::string  channel_quality;
+      //bool         channel_strict;
+      //std::string  broadcast_type;
+        unsigned int start_hour;
+        unsigned int start_min;
+      //unsigned int start_sec;
+        unsigned int duration;
+        unsigned int margin_before;
+        unsigned int margin_after;
+        bool         repeat_monday;
+        bool         repeat_tuesday;
+        bool         repeat_wednesday;
+        bool         repeat_thursday;
+        bool         repeat_friday;
+        bool         repeat_saturday;
+        bool         repeat_sunday;
+
+      public:
+        Generator (const nlohmann::json &);
+        bool operator== (const Generator &) const;
+        bool operator!= (const Generator & x) const {return ! (*this == x);}
+    };
+
+    // Timer.
+    class Timer
+    {
+      public:
+        int          id;
+        time_t       start;
+        time_t       end;
+        unsigned int margin_before;
+        unsigned int margin_after;
+        std::string  name;
+        std::string  subname;
+        std::string  channel_uuid;
+        std::string  channel_name;
+      //std::string  channel_type;
+      //std::string  channel_quality;
+      //std::string  broadcast_type;
+        std::string  media;
+        std::string  path;
+        bool         has_record_gen;
+        int          record_gen_id;
+        bool         enabled;
+        bool         conflict;
+        std::string  state;
+        std::string  error;
+
+      public:
+        Timer (const nlohmann::json &);
+        bool operator== (const Timer &) const;
+        bool operator!= (const Timer & x) const {return ! (*this == x);}
+    };
+
+    // Recording.
+    class Recording
+    {
+      public:
+        int          id;
+        time_t       start;
+        time_t       end;
+        std::string  name;
+        std::string  subname;
+        std::string  channel_uuid;
+        std::string  channel_name;
+      //std::string  channel_type;
+      //std::string  channel_quality;
+      //std::string  broadcast_type;
+        std::string  media;
+        std::string  path;
+        std::string  filename;
+        int          byte_size;
+        bool         secure;
+
+      public:
+        Recording (const nlohmann::json &);
+        bool operator== (const Recording &) const;
+        bool operator!= (const Recording & x) const {return ! (*this == x);}
+    };
+
+    // Bouquet entry.
+    class Conflict
+    {
+      public:
+        std::string uuid;
+        int major, minor; // numéro de chaîne
+        int position;     // position dans le bouquet
+
+      public:
+        Conflict (const std::string & id, int n1, int n2, int p);
+    };
+
+    // One entry per channel number, one channel number per UUID.
+    static std::map<int, Conflict> ResolveConflicts (const nlohmann::json & bouquet);
+
+    // Events of a channel (by start time) overlapping [start, end).
+    static void EventsBetween (const std::map<time_t, Event> &, time_t start, time_t end, std::vector<Event> *);
+
+  public:
+    static enum Source   ParseSource   (const std::string &);
+    static enum Quality  ParseQuality  (const std::string &);
+    static enum Protocol ParseProtocol (const std::string &);
+
+    static std::string StrSource   (enum Source);
+    static std::string StrQuality  (enum Quality);
+    static std::string StrProtocol (enum Protocol);
+
+    static std::string Password (const std::string & token, const std::string & challenge);
+};
+
+class Core::EpgParser : public nlohmann::json_sax<nlohmann::json>
+{
+  public:
+    typedef std::function<void (const Event &)> Callback;
+
+  private:
+    Callback                 m_callback;
+    // Keys of the enclosing containers ("" for the root, "[]" in arrays).
+    std::vector<std::string> m_path;
+    std::vector<bool>        m_arrays;
+    std::string              m_key;
+    nlohmann::json           m_header;
+    bool                     m_success;
+    bool                     m_result;
+    // Current channel, event and cast member.
+    unsigned int             m_channel;
+    bool                     m_skip;
+    Event                    m_event;
+    bool                     m_big;
+    Event::CastMember        m_member;
+    // Statistics.
+    size_t                   m_events;
+
+  protected:
+    size_t Depth () const {return m_path.size ();}
+    bool InResult () const {return Depth () >= 2 && m_path [1] == "result";}
+    bool InEvent  () const {return Depth () == 4 && InResult () && m_arrays [2];}
+    bool InMember () const {return Depth () == 6 && InResult () && m_arrays [2] && m_path [4] == "cast" && m_arrays [4];}
+
+    void Enter (bool array)
+    {
+      m_path.push_back (m_arrays.empty () ? "" : (m_arrays.back () ? "[]" : m_key));
+      m_arrays.push_back (array);
+    }
+
+    void Leave ()
+    {
+      m_path.pop_back ();
+      m_arrays.pop_back ();
+    }
+
+    bool Value (const nlohmann::json & value)
+    {
+      if (Depth () == 1)
+      {
+        if (m_key == "success")
+          m_success = value.is_boolean () && value.get<bool> ();
+        m_header [m_key] = value;
+      }
+
+      else if (Depth () == 2 && ! m_arrays [1] && m_path [1] != "result")
+        m_header [m_path [1]][m_key] = value;
+
+      else if (InEvent () && ! m_skip)
+      {
+        if (m_key == "picture_big") m_big = true;
+        if (m_key != "picture" || ! m_big) m_event.Set (m_key, value);
+      }
+
+      else if (InMember () && ! m_skip)
+        m_member.Set (m_key, value);
+
+      return true;
+    }
+
+  public:
+    EpgParser (const Callback & callback) :
+      m_callback (callback),
+      m_path (),
+      m_arrays (),
+      m_key (),
+      m_header (nlohmann::json::object ()),
+      m_success (false),
+      m_result (false),
+      m_channel (0),
+      m_skip (true),
+      m_event (),
+      m_big (false),
+      m_member (),
+      m_events (0)
+    {
+    }
+
+    bool IsSuccess () const {return m_success && m_result;}
+    size_t Events () const {return m_events;}
+    // Top-level values besides "result" (and members of top-level objects).
+    const nlohmann::json & Header () const {return m_header;}
+
+    bool null () override {return Value (nlohmann::json ());}
+    bool boolean (bool b) override {return Value (b);}
+    bool number_integer (number_integer_t n) override {return Value (n);}
+    bool number_unsigned (number_unsigned_t n) override {return Value (n);}
+    bool number_float (number_float_t n, const string_t &) override {return Value (n);}
+    bool string (string_t & s) override {return Value (s);}
+    bool binary (binary_t &) override {return true;}
+
+    bool key (string_t & k) override
+    {
+      m_key = k;
+      return true;
+    }
+
+    bool start_object (size_t) override
+    {
+      Enter (false);
+
+      if (Depth () == 2 && m_path [1] == "result")
+        m_result = true;
+
+      else if (InEvent ())
+      {
+        m_event = Event (m_channel, 0);
+        m_big   = false;
+      }
+
+      else if (InMember ())
+        m_member = Event::CastMember ();
+
+      return true;
+    }
+
+    bool end_object () override
+    {
+      if (InEvent () && ! m_skip)
+      {
+        ++m_events;
+        m_callback (m_event);
+      }
+
+      else if (InMember () && ! m_skip)
+        m_event.cast.push_back (m_member);
+
+      Leave ();
+      return true;
+    }
+
+    bool start_array (size_t) override
+    {
+      Enter (true);
+
+      // Channel.
+      if (Depth () == 3 && InResult () && ! m_arrays [1])
+      {
+        static const std::string PREFIX = "uuid-webtv-";
+        m_skip    = m_path [2].compare (0, PREFIX.length (), PREFIX) != 0;
+        m_channel = m_skip ? 0 : ChannelId (m_path [2]);
+      }
+
+      return true;
+    }
+
+    bool end_array () override
+    {
+      Leave ();
+      return true;
+    }
+
+    bool parse_error (size_t, const std::string &, const nlohmann::detail::exception &) override
+    {
+      m_success = false;
+      return false;
+    }
+};
@@ -23,9 +23,10 @@
 #include <iomanip>
 #include <string>
 #include <sstream>
+#include <set>
 #include <fstream>
 #include <algorithm>
-#include <numeric> // accumulate
+#include <thread>
 
 #undef major
 #undef minor
@@ -37,9 +38,9 @@
 #include "kodi/tools/StringUtils.h"
 
 #include "Freebox.h"
+#include "Zlib.h"
 
-#include "openssl/sha.h"
-#include "openssl/hmac.h"
+#include "openssl/evp.h" // BIO_f_base64
 #include "openssl/bio.h"
 #include "openssl/buffer.h"
 
@@ -56,6 +57,45 @@ using json = nlohmann::json;
 #define PVR_FREEBOX_GENERATOR_MANUAL 4
 #define PVR_FREEBOX_GENERATOR_EPG    5
 
+// EPG hours older than this are fetched again.
+#define PVR_FREEBOX_EPG_TTL (12 * 3600)
+// Urgent channel queries pending at once, from guide updates (not tuning).
+#define PVR_FREEBOX_EPG_URGENT 4
+
+// Refresh intervals (timers are refreshed on every loop).
+#define PVR_FREEBOX_GENERATORS_INTERVAL 300
+#define PVR_FREEBOX_RECORDINGS_INTERVAL  60
+#define PVR_FREEBOX_CHANNELS_INTERVAL  3600
+// Polling interval once notifications are seen to work (safety net).
+#define PVR_FREEBOX_NOTIFIED_INTERVAL   300
+
+// Freebox OS notifications (websocket).
+#define PVR_FREEBOX_NOTIFICATIONS_PATH "/api/v8/ws/event"
+#define PVR_FREEBOX_NOTIFICATIONS_WAIT 5000 // registration (ms)
+#define PVR_FREEBOX_RECONNECT_MAX      60   // backoff (s)
+
+// Stream probes (start latency).
+#define PVR_FREEBOX_PROBE_TIMEOUT 10000        // ms
+#define PVR_FREEBOX_PROBE_DELAY   10           // between probes (s)
+#define PVR_FREEBOX_PROBE_TTL     (24 * 3600)  // measures older than this are refreshed
+#define PVR_FREEBOX_PROBE_SAVE    10           // probes between writes
+
+enum
+{
+  FREEBOX_REFRESH_GENERATORS = 1,
+  FREEBOX_REFRESH_TIMERS     = 2,
+  FREEBOX_REFRESH_RECORDINGS = 4
+};
+
+// Notifications ("<source>_<event>") and what they refresh
+// (until one of them is received, polling goes on as usual).
+static const map<string, int> FREEBOX_NOTIFICATIONS =
+{
+  {"pvr_generator_changed",  FREEBOX_REFRESH_GENERATORS | FREEBOX_REFRESH_TIMERS},
+  {"pvr_programmed_changed", FREEBOX_REFRESH_TIMERS     | FREEBOX_REFRESH_RECORDINGS},
+  {"pvr_finished_changed",   FREEBOX_REFRESH_RECORDINGS}
+};
+
 inline
 string freebox_base64 (const char * buffer, unsigned int length)
 {
@@ -110,68 +150,42 @@ int freebox_http (const string & custom, const string & url, const string & requ
 }
 
 /* static */
-enum Freebox::Source Freebox::ParseSource (const string & s)
+long Freebox::HttpStream (const string & custom,
+                          const string & path,
+                          const json & request,
+                          const HttpPool::Reader & reader) const
 {
-  if (s == "")     return Source::AUTO;
-  if (s == "iptv") return Source::IPTV;
-  if (s == "dvb")  return Source::DVB;
-  return Source::DEFAULT;
-}
+  string url = URL (path);
+  string session;
+  {
+    SharedMutex::Shared lock (m_session);
+    session = m_session_token;
+  }
 
-/* static */
-enum Freebox::Quality Freebox::ParseQuality (const string & q)
-{
-  if (q == "auto") return Quality::AUTO;
-  if (q == "hd")   return Quality::HD;
-  if (q == "sd")   return Quality::SD;
-  if (q == "ld")   return Quality::LD;
-  if (q == "3d")   return Quality::STEREO;
-  return Quality::DEFAULT;
-}
+  HttpPool::Headers headers;
+  if (! session.empty ())
+    headers.emplace_back ("X-Fbx-App-Auth", session);
 
-/* static */
-enum Freebox::Protocol Freebox::ParseProtocol (const string & p)
-{
-  if (p == "rtsp") return Protocol::RTSP;
-  if (p == "hls")  return Protocol::HLS;
-  return Protocol::DEFAULT;
-}
+  // Latency measured once a connection is acquired: local queueing in the
+  // pool is not a sign of a slow server.
+  HttpPool::Clock::duration latency {};
+  long http = m_http.Request (custom, url, headers, request.is_null () ? "" : request.dump (), reader, &latency);
 
-/* static */
-string Freebox::StrSource (enum Source s)
-{
-  switch (s)
+  switch (m_throttle.Feedback (http, latency))
   {
-    case Source::AUTO : return "";
-    case Source::IPTV : return "iptv";
-    case Source::DVB  : return "dvb";
-    default           : return "";
-  }
-}
+    case HttpThrottle::INCREASE:
+      kodi::Log (ADDON_LOG_DEBUG, "Rate: %.2f req/s (HTTP %d, %.0f ms)", m_throttle.GetRate (), (int) http, m_throttle.GetLatency ());
+      break;
 
-/* static */
-string Freebox::StrQuality (enum Quality q)
-{
-  switch (q)
-  {
-    case Quality::AUTO   : return "auto";
-    case Quality::HD     : return "hd";
-    case Quality::SD     : return "sd";
-    case Quality::LD     : return "ld";
-    case Quality::STEREO : return "3d";
-    default              : return "";
-  }
-}
+    case HttpThrottle::DECREASE:
+      kodi::Log (ADDON_LOG_INFO, "Rate: backing off to %.2f req/s (HTTP %d, %.0f ms)", m_throttle.GetRate (), (int) http, m_throttle.GetLatency ());
+      break;
 
-/* static */
-string Freebox::StrProtocol (enum Protocol p)
-{
-  switch (p)
-  {
-    case Protocol::RTSP : return "rtsp";
-    case Protocol::HLS  : return "hls";
-    default             : return "";
+    default:
+      break;
   }
+
+  return http;
 }
 
 /* static */
@@ -179,16 +193,37 @@ bool Freebox::Http (const string & custom,
                     const string & path,
                     const json & request,
                     json * result,
-                    json::value_t type) const
+                    json::value_t type,
+                    bool * same) const
 {
-  m_mutex.lock ();
-  string url = URL (path);
-  string session = m_session_token;
-  m_mutex.unlock ();
-
   string response;
-  long http = freebox_http (custom, url, request.dump (), &response, session);
-  kodi::Log (ADDON_LOG_DEBUG, "%s %s %s", custom.c_str (), url.c_str (), response.c_str ());
+  long http = HttpStream (custom, path, request, [&response] (istream & is)
+  {
+    response.assign (istreambuf_iterator<char> (is), istreambuf_iterator<char> ());
+  });
+
+  // A PVR edit (even a failed one) outdates the lists: the next refresh
+  // must compare them, not skip them (a generator also changes timers).
+  static const string PVR = "/api/v6/pvr/";
+  if (custom != "GET" && path.compare (0, PVR.length (), PVR) == 0)
+    m_digests.Forget (PVR);
+
+  // Same body as last time: nothing to parse.
+  size_t digest = 0;
+  if (same != nullptr)
+  {
+    digest = Digests::Hash (response);
+    *same = http == 200 && m_digests.IsSame (path, digest);
+    if (*same)
+    {
+      kodi::Log (ADDON_LOG_DEBUG, "%s %s (unchanged)", custom.c_str (), path.c_str ());
+      return true;
+    }
+  }
+
+  HttpPool::Clock::time_point start = HttpPool::Clock::now ();
+
+  kodi::Log (ADDON_LOG_DEBUG, "%s %s %s", custom.c_str (), path.c_str (), response.c_str ());
 
   json j = json::parse (response, nullptr, false);
 
@@ -203,7 +238,7 @@ bool Freebox::Http (const string & custom,
 
     if (r->type () != type) return false;
 
-    *result = *r;
+    *result = move (*r);
   }
 
   if (http != 200)
@@ -213,15 +248,19 @@ bool Freebox::Http (const string & custom,
     return false;
   }
 
+  if (same != nullptr)
+    m_digests.Record (path, digest, chrono::duration<double, milli> (HttpPool::Clock::now () - start).count ());
+
   return true;
 }
 
 /* static */
 bool Freebox::HttpGet (const string & path,
                        json * result,
-                       json::value_t type) const
+                       json::value_t type,
+                       bool * same) const
 {
-  return Http ("GET", path, json (), result, type);
+  return Http ("GET", path, json (), result, type, same);
 }
 
 /* static */
@@ -248,30 +287,20 @@ bool Freebox::HttpDelete (const string & path) const
   return Http ("DELETE", path, json (), nullptr, json::value_t::null);
 }
 
-/* static */
-string Freebox::Password (const string & token, const string & challenge)
-{
-  unsigned char password [EVP_MAX_MD_SIZE];
-  unsigned int length;
-
-  HMAC (EVP_sha1 (),
-        token.c_str (), token.length (),
-        (const unsigned char *) challenge.c_str (), challenge.length (),
-        password, &length);
-
-  ostringstream oss;
-  oss << hex << setfill ('0');
-  for (unsigned int i = 0; i < length; ++i)
-    oss << setw (2) << (int) password [i];
-
-  return oss.str ();
-}
-
 bool Freebox::StartSession ()
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  // One login at a time: held across requests (like the PVR refreshes), only logins wait for it.
+  lock_guard<mutex> lock (m_login);
 
-  if (m_app_token.empty ())
+  string app_token;
+  int    track_id;
+  {
+    SharedMutex::Shared session (m_session);
+    app_token = m_app_token;
+    track_id  = m_track_id;
+  }
+
+  if (app_token.empty ())
   {
     string file = m_path + "app_token.txt";
     if (! kodi::vfs::FileExists (file, false))
@@ -289,20 +318,25 @@ bool Freebox::StartSession ()
 
       json result;
       if (! HttpPost ("/api/v6/login/authorize", request, &result)) return false;
-      m_app_token = result.value ("app_token", "");
-      m_track_id  = result.value ("track_id", 0);
+      app_token = result.value ("app_token", "");
+      track_id  = result.value ("track_id", 0);
 
-      ofstream ofs (file);
-      ofs << m_app_token << ' ' << m_track_id;
+      freebox_gz_write (file, app_token + ' ' + to_string (track_id));
     }
     else
     {
-      ifstream ifs (file);
-      ifs >> m_app_token >> m_track_id;
+      string text;
+      freebox_gz_read (file, &text);
+      istringstream iss (text);
+      iss >> app_token >> track_id;
     }
 
-    //cout << "app_token: " << m_app_token << endl;
-    //cout << "track_id: " << m_track_id << endl;
+    //cout << "app_token: " << app_token << endl;
+    //cout << "track_id: " << track_id << endl;
+
+    SharedMutex::Unique session (m_session);
+    m_app_token = app_token;
+    m_track_id  = track_id;
   }
 
   json login;
@@ -312,7 +346,7 @@ bool Freebox::StartSession ()
   if (! login.value ("logged_in", false))
   {
     json d;
-    string track = to_string (m_track_id);
+    string track = to_string (track_id);
     string url   = "/api/v6/login/authorize/" + track;
     if (! HttpGet (url, &d)) return false;
     string status    = d.value ("status", "");
@@ -322,7 +356,7 @@ bool Freebox::StartSession ()
 
     if (status == "granted")
     {
-      string password = Password (m_app_token, challenge);
+      string password = Password (app_token, challenge);
       //cout << "password: " << password << " [" << password.length () << ']' << endl;
 
       json request =
@@ -333,9 +367,14 @@ bool Freebox::StartSession ()
 
       json result;
       if (! HttpPost ("/api/v6/login/session", request, &result)) return false;
-      m_session_token = result.value ("session_token", "");
+      string session = result.value ("session_token", "");
 
-      cout << "StartSession: session_token: " << m_session_token << endl;
+      {
+        SharedMutex::Unique update (m_session);
+        m_session_token = session;
+      }
+
+      cout << "StartSession: session_token: " << session << endl;
       return true;
     }
     else
@@ -351,368 +390,60 @@ bool Freebox::StartSession ()
 
 bool Freebox::CloseSession ()
 {
-  if (! m_session_token.empty ())
-    return HttpPost ("/api/v6/login/logout/", json (), nullptr);
-
-  return true;
-}
-
-class Conflict
-{
-  public:
-    string uuid;
-    int major, minor; // numéro de chaîne
-    int position;     // position dans le bouquet
-
-  public:
-    inline Conflict (const string & id,
-                     int n1, int n2,
-                     int p) :
-      uuid (id),
-      major (n1), minor (n2),
-      position (p)
-    {
-    }
-};
-
-class ConflictComparator
-{
-  public:
-    inline bool operator() (const Conflict & c1, const Conflict & c2) const
-    {
-      return tie (c1.major, c1.minor) < tie (c2.major, c2.minor);
-    }
-};
-
-inline string StrUUIDs (const vector<Conflict> & v)
-{
-  string text;
-  if (! v.empty ())
+  bool open;
   {
-    text += v[0].uuid;
-    for (size_t i = 1; i < v.size (); ++i)
-      text += ", " + v[i].uuid;
+    SharedMutex::Shared lock (m_session);
+    open = ! m_session_token.empty ();
   }
-  return '[' + text + ']';
-}
-
-inline string StrNumber (const Conflict & c, bool minor)
-{
-  return to_string (c.major) + (minor ? '.' + to_string (c.minor) : "");
-}
-
-inline string StrNumbers (const vector<Conflict> & v)
-{
-  string text;
-  switch (v.size ())
-  {
-    case 0:
-      break;
 
-    case 1:
-      text = StrNumber (v[0], false);
-      break;
-
-    default:
-      text = StrNumber (v[0], true);
-      for (size_t i = 1; i < v.size (); ++i)
-        text += ", " + StrNumber (v[i], true);
-      break;
-  }
-  return '[' + text + ']';
-}
+  if (open)
+    return HttpPost ("/api/v6/login/logout/", json (), nullptr);
 
-Freebox::Stream::Stream (enum Source  source,
-                         enum Quality quality,
-                         const string & rtsp,
-                         const string & hls) :
-  source (source),
-  quality (quality),
-  rtsp (rtsp),
-  hls (hls)
-{
+  return true;
 }
 
-int Freebox::Stream::score (enum Source s) const
+bool Freebox::HttpGet (const string & path, EpgParser * parser, bool * same) const
 {
-  switch (s)
-  {
-    case Source::AUTO:
-      switch (source)
-      {
-        case Source::AUTO: return 100;
-        case Source::IPTV: return 10;
-        case Source::DVB:  return 1;
-        default:           return 0;
-      }
-
-    case Source::IPTV:
-      switch (source)
-      {
-        case Source::AUTO: return 10;
-        case Source::IPTV: return 100;
-        case Source::DVB:  return 1;
-        default:           return 0;
-      }
+  HttpPool::Clock::time_point start = HttpPool::Clock::now ();
 
-    case Source::DVB:
-      switch (source)
-      {
-        case Source::AUTO: return 10;
-        case Source::IPTV: return 1;
-        case Source::DVB:  return 100;
-        default:           return 0;
-      }
-
-    default:
-      return 0;
-  }
-}
-
-int Freebox::Stream::score (enum Quality q) const
-{
-  switch (q)
+  string response;
+  long http = HttpStream ("GET", path, json (), [&response] (istream & is)
   {
-    case Quality::AUTO:
-      switch (quality)
-      {
-        case Quality::AUTO: return 1000;
-        case Quality::HD:   return 100;
-        case Quality::SD:   return 10;
-        case Quality::LD:   return 1;
-        default:            return 0;
-      }
-
-    case Quality::HD:
-      switch (quality)
-      {
-        case Quality::AUTO: return 100;
-        case Quality::HD:   return 1000;
-        case Quality::SD:   return 10;
-        case Quality::LD:   return 1;
-        default:            return 0;
-      }
-
-    case Quality::SD:
-      switch (quality)
-      {
-        case Quality::AUTO: return 100;
-        case Quality::HD:   return 1;
-        case Quality::SD:   return 1000;
-        case Quality::LD:   return 10;
-        default:            return 0;
-      }
-
-    case Quality::LD:
-      switch (quality)
-      {
-        case Quality::AUTO: return 100;
-        case Quality::HD:   return 1;
-        case Quality::SD:   return 10;
-        case Quality::LD:   return 1000;
-        default:            return 0;
-      }
-
-    case Quality::STEREO:
-      return (quality == Quality::STEREO) ? 1000 : 0;
-
-    default:
-      return 0;
-  }
-}
-
-int Freebox::Stream::score (enum Source s, enum Quality q) const
-{
-  return 10000 * score (s) + score (q);
-}
-
-Freebox::Channel::Channel (const string & uuid,
-                           const string & name,
-                           const string & logo,
-                           int major, int minor,
-                           const vector<Stream> & streams) :
-  radio (false),
-  uuid (uuid),
-  name (name),
-  logo (logo),
-  major (major), minor (minor),
-  streams (streams)
-{
-}
-
-bool Freebox::Channel::IsHidden () const
-{
-  return streams.empty ();
-}
-
-void Freebox::Channel::GetChannel (kodi::addon::PVRChannelsResultSet & results, bool radio) const
-{
-  kodi::addon::PVRChannel channel;
-
-  channel.SetUniqueId         (ChannelId (uuid));
-  channel.SetIsRadio          (radio);
-  channel.SetChannelNumber    (major);
-  channel.SetSubChannelNumber (minor);
-  channel.SetChannelName      (name);
-  channel.SetIconPath         (logo);
-  channel.SetIsHidden         (IsHidden ());
+    response.assign (istreambuf_iterator<char> (is), istreambuf_iterator<char> ());
+  });
 
-  results.Add (channel);
-}
+  if (http != 200) return false;
 
-void freebox_debug_stream_properties (const string & url, int index, int score)
-{
-  kodi::Log (ADDON_LOG_DEBUG, "GetStreamProperties: '%s' (index = %d, score = %d)", url.c_str (), index, score);
-}
-
-PVR_ERROR Freebox::Channel::GetStreamProperties (enum Source source,
-                                                 enum Quality quality,
-                                                 enum Protocol protocol,
-                                                 std::vector<kodi::addon::PVRStreamProperty> & properties) const
-{
-  if (! streams.empty ())
+  // Same page as last time: nothing to parse.
+  size_t digest = Digests::Hash (response);
+  *same = m_digests.IsSame (path, digest);
+  if (*same)
   {
-    int index = 0;
-    int score = streams[0].score (source, quality);
-    freebox_debug_stream_properties (streams[0].rtsp, index, score);
-
-    for (size_t i = 1; i < streams.size (); ++i)
-    {
-      int s = streams[i].score (source, quality);
-      freebox_debug_stream_properties (streams[i].rtsp, i, s);
-      if (s > score)
-      {
-        index = i;
-        score = s;
-      }
-    }
-
-    switch (protocol)
-    {
-      case Protocol::RTSP : properties.emplace_back (PVR_STREAM_PROPERTY_STREAMURL, streams[index].rtsp); break;
-      case Protocol::HLS  : properties.emplace_back (PVR_STREAM_PROPERTY_STREAMURL, streams[index].hls);  break;
-    }
-
-    properties.emplace_back (PVR_STREAM_PROPERTY_ISREALTIMESTREAM, "true");
+    kodi::Log (ADDON_LOG_DEBUG, "GET %s (unchanged)", path.c_str ());
+    return true;
   }
 
-  return PVR_ERROR_NO_ERROR;
-}
+  HttpPool::Clock::time_point parsing = HttpPool::Clock::now ();
 
-string Freebox::Event::Native (int c)
-{
-  switch (c)
-  {
-    case  1: return "Film";
-    case  2: return "Téléfilm";
-    case  3: return "Série/Feuilleton";
-    case  4: return "Feuilleton";
-    case  5: return "Documentaire";
-    case  6: return "Théâtre";
-    case  7: return "Opéra";
-    case  8: return "Ballet";
-    case  9: return "Variétés";
-    case 10: return "Magazine";
-    case 11: return "Jeunesse";
-    case 12: return "Jeu";
-    case 13: return "Musique";
-    case 14: return "Divertissement";
-    case 16: return "Dessin animé";
-    case 19: return "Sport";
-    case 20: return "Journal";
-    case 22: return "Débat";
-    case 24: return "Spectacle";
-    case 31: return "Emission religieuse";
-    default: return "";
-  };
-}
+  json::sax_parse (response, parser);
+  if (! parser->IsSuccess ()) return false;
 
-int Freebox::Event::Colors (int c)
-{
-  switch (c)
-  {
-    case  1: return 0x10; // Film
-    case  2: return 0x10; // Téléfilm
-    case  3: return 0x10; // Série/Feuilleton
-    case  4: return 0x15; // Feuilleton
-    case  5: return 0x23; // Documentaire
-    case  6: return 0x70; // Théâtre
-    case  7: return 0x65; // Opéra
-    case  8: return 0x66; // Ballet
-    case  9: return 0x32; // Variétés
-    case 10: return 0x81; // Magazine
-    case 11: return 0x50; // Jeunesse
-    case 12: return 0x31; // Jeu
-    case 13: return 0x60; // Musique
-    case 14: return 0x32; // Divertissement
-    case 16: return 0x55; // Dessin animé
-    case 19: return 0x40; // Sport
-    case 20: return 0x21; // Journal
-    case 22: return 0x24; // Débat
-    case 24: return 0x70; // Spectacle
-    case 31: return 0x73; // Emission religieuse
-    default: return 0x00;
-  };
-}
+  HttpPool::Clock::time_point end = HttpPool::Clock::now ();
+  m_digests.Record (path, digest, chrono::duration<double, milli> (end - parsing).count ());
 
-Freebox::Event::CastMember::CastMember (const json & c) :
-  job        (c.value ("job", "")),
-  first_name (c.value ("first_name", "")),
-  last_name  (c.value ("last_name", "")),
-  role       (c.value ("role", ""))
-{
-}
-
-Freebox::Event::Event (const json & e, unsigned int channel, time_t date) :
-  channel  (channel),
-  uuid     (e.value ("id", "")),
-  date     (e.value ("date", date)),
-  duration (e.value ("duration", 0)),
-  title    (e.value ("title", "")),
-  subtitle (e.value ("sub_title", "")),
-  season   (e.value ("season_number", 0)),
-  episode  (e.value ("episode_number", 0)),
-  category (e.value ("category", 0)),
-  picture  (e.value ("picture_big", e.value ("picture", ""))),
-  plot     (e.value ("desc", "")),
-  outline  (e.value ("short_desc", "")),
-  year     (e.value ("year", 0)),
-  cast     ()
-{
-  if (category != 0 && Colors (category) == 0)
-  {
-    string name = e.value ("category_name", "");
-    cout << category << " : " << name << endl;
-  }
-
-  auto f = e.find ("cast");
-  if (f != e.end ())
-    if (f->is_array ())
-      for (auto & c : *f)
-        cast.emplace_back (c);
-}
-
-Freebox::Event::ConcatIfJob::ConcatIfJob (const string & job) :
-  m_job (job)
-{
-}
-
-string Freebox::Event::ConcatIfJob::operator() (const string & input, const Freebox::Event::CastMember & m) const
-{
-  if (m.job != m_job) return input;
-  return (input.empty () ? "" : input + EPG_STRING_TOKEN_SEPARATOR) + (m.first_name + ' ' + m.last_name);
-}
+  double ms = chrono::duration<double, milli> (end - start).count ();
+  kodi::Log (ADDON_LOG_DEBUG, "GET %s: %d events in %.0f ms",
+             path.c_str (), (int) parser->Events (), ms);
 
-string Freebox::Event::GetCastDirector () const
-{
-  static const ConcatIfJob CONCAT ("Réalisateur");
-  return accumulate (cast.begin (), cast.end (), string (), CONCAT);
+  return true;
 }
 
-string Freebox::Event::GetCastActors () const
+// "host:port" > "host" (RTSP has its own port).
+inline string freebox_strip_port (const string & server)
 {
-  static const ConcatIfJob CONCAT ("Acteur");
-  return accumulate (cast.begin (), cast.end (), string (), CONCAT);
+  size_t colon = server.rfind (':');
+  if (colon == string::npos || server.find (']', colon) != string::npos) return server;
+  return server.substr (0, colon);
 }
 
 inline string freebox_replace_server (string url, const string & server)
@@ -734,182 +465,246 @@ void freebox_channel_logo_fix (const std::string & url, const std::string & path
 
 bool Freebox::ProcessChannels ()
 {
-  m_tv_channels.clear ();
+  // Built aside, then published at once: readers keep the previous list until then.
+  auto snapshot = make_shared<Channels> ();
+
+  string hostname = GetHostName ();
 
   json channels;
   if (! HttpGet ("/api/v6/tv/channels", &channels)) return false;
 
-  string notification = kodi::addon::GetLocalizedString (PVR_FREEBOX_STRING_CHANNELS_LOADED);
-  kodi::QueueFormattedNotification (QUEUE_INFO, notification.c_str (), channels.size ());
-
   //json bouquets;
   //HttpGet ("/api/v6/tv/bouquets", &m_tv_bouquets);
 
   json bouquet;
   if (! HttpGet ("/api/v6/tv/bouquets/freeboxtv/channels", &bouquet, json::value_t::array)) return false;
 
-  // Conflict list.
-  typedef vector<Conflict> Conflicts;
-  // Conflicts by UUID.
-  map<string, Conflicts> conflicts_by_uuid;
-  // Conflicts by major.
-  map<int, Conflicts> conflicts_by_major;
+  for (auto & i : ResolveConflicts (bouquet))
+  {
+    const Conflict & ch      = i.second;
+    const json     & channel = channels[ch.uuid];
+    const string   & name    = channel["name"];
+    const string   & logo    = URL (channel["logo_url"]);
+    const json     & item    = bouquet[ch.position];
+
+    vector<Stream> data;
+    if (item.value ("available", false))
+    {
+      auto f = item.find ("streams");
+      if (f != item.end () && f->is_array ())
+        for (auto & s : *f)
+          data.emplace_back (ParseSource (s["type"]),
+                             ParseQuality (s["quality"]),
+                             freebox_replace_server (s["rtsp"], freebox_strip_port (hostname)),
+                             freebox_replace_server (s.value ("hls", ""), hostname));
+    }
+#if 0
+    if (! kodi::vfs::DirectoryExists (m_path + "logos"))
+      kodi::vfs::CreateDirectory (m_path + "logos");
+
+    std::string path = m_path + "logos/" + ch.uuid;
+    freebox_channel_logo_fix (logo, path);
+    snapshot->emplace (ChannelId (ch.uuid), Channel (ch.uuid, name, path, ch.major, ch.minor, data));
+#else
+    snapshot->emplace (ChannelId (ch.uuid), Channel (ch.uuid, name, logo + "|customrequest=GET", ch.major, ch.minor, data));
+#endif
+  }
+
+  // Same list as the cached one: nothing to tell Kodi.
+  if (! PublishChannels (snapshot, "server"))
+    return true;
+
+  WriteChannelCache (*snapshot);
 
-  for (int i = 0; i < bouquet.size (); ++i)
+  string notification = kodi::addon::GetLocalizedString (PVR_FREEBOX_STRING_CHANNELS_LOADED);
+  kodi::QueueFormattedNotification (QUEUE_INFO, notification.c_str (), snapshot->size ());
+  TriggerChannelUpdate ();
+
+  return true;
+}
+
+bool Freebox::PublishChannels (shared_ptr<const Channels> channels, const char * origin)
+{
+  auto previous = TvChannels ();
+
+  auto t0 = HttpPool::Clock::now ();
+  ChannelDiff diff (*previous, *channels);
+  double ms = chrono::duration<double, milli> (HttpPool::Clock::now () - t0).count ();
+
+  if (diff.Empty ())
   {
-    string uuid  = bouquet[i]["uuid"];
-    int    major = bouquet[i]["number"];
-    int    minor = bouquet[i]["sub_number"];
+    kodi::Log (ADDON_LOG_DEBUG, "Channels: unchanged (%s, %.2f ms)", origin, ms);
+    return false;
+  }
 
-    Conflict c (uuid, major, minor, i);
+  atomic_store (&m_tv_channels, channels);
 
-    conflicts_by_uuid [uuid] .push_back (c);
-    conflicts_by_major[major].push_back (c);
+  // Time to first channel.
+  if (! m_tv_ready.exchange (true))
+  {
+    double elapsed = chrono::duration<double, milli> (HttpPool::Clock::now () - m_created).count ();
+    kodi::Log (ADDON_LOG_INFO, "Channels: %d channels (%s) %.0f ms after start", (int) channels->size (), origin, elapsed);
+    return true;
   }
 
-  static const ConflictComparator comparator;
+  kodi::Log (ADDON_LOG_INFO, "Channels: %d added, %d removed, %d updated (%s, %.2f ms)",
+             (int) diff.added.size (), (int) diff.removed.size (), (int) diff.updated.size (), origin, ms);
 
-#if __cplusplus >= 201703L
-  for (auto & [major, v1] : conflicts_by_major)
-#else
-  for (auto & it : conflicts_by_major)
-#endif
+  // Guide of the other channels kept as is.
+  vector<unsigned int> visible;
+  for (unsigned int id : diff.added)
+    if (! channels->at (id).IsHidden ())
+      visible.push_back (id);
+  for (unsigned int id : diff.updated)
+    if (previous->at (id).IsHidden () && ! channels->at (id).IsHidden ())
+      visible.push_back (id);
+
+  if (! visible.empty ())
   {
-#if __cplusplus < 201703L
-    int      major = it.first;
-    Conflicts & v1 = it.second;
-#endif
+    // Unchanged pages must be parsed again for those.
+    m_digests.Forget ("/api/v6/tv/epg/");
 
-    sort (v1.begin (), v1.end (), comparator);
+    SharedMutex::Unique lock (m_epg);
+    for (unsigned int id : visible)
+      m_epg_coverage.Invalidate (id);
+  }
 
-    for (size_t j = 1; j < v1.size (); ++j)
+  if (! diff.removed.empty ())
+  {
+    SharedMutex::Unique lock (m_epg);
+    for (unsigned int id : diff.removed)
     {
-      Conflicts & v2 = conflicts_by_uuid [v1[j].uuid];
-      v2.erase (remove_if (v2.begin (), v2.end (),
-        [m = major] (const Conflict & c) {return c.major == m;}));
+      m_epg_coverage.Erase (id);
+      m_epg_events.erase (id);
     }
-
-    v1.erase (v1.begin () + 1, v1.end ());
   }
 
-#if __cplusplus >= 201703L
-  for (auto & [uuid, v1] : conflicts_by_uuid)
-#else
-  for (auto & it : conflicts_by_uuid)
-#endif
-  {
-#if __cplusplus < 201703L
-    const string & uuid = it.first;
-    Conflicts    & v1   = it.second;
-#endif
+  return true;
+}
 
-    if (! v1.empty ())
-    {
-      sort (v1.begin (), v1.end (), comparator);
+bool Freebox::ReadChannelCache ()
+{
+  string text;
+  if (! freebox_gz_read (m_path + "channels.json", &text)) return false;
 
-      for (size_t j = 1; j < v1.size (); ++j)
-      {
-        Conflicts & v2 = conflicts_by_major [v1[j].major];
-        v2.erase (remove_if (v2.begin (), v2.end (),
-          [u = uuid] (const Conflict & c) {return c.uuid == u;}));
-      }
+  json cache = json::parse (text, nullptr, false);
+  if (! cache.is_object ()) return false;
 
-      v1.erase (v1.begin () + 1, v1.end ());
-    }
+  auto f = cache.find ("channels");
+  if (f == cache.end () || ! f->is_array ()) return false;
+
+  auto channels = make_shared<Channels> ();
+  for (auto & c : *f)
+  {
+    Channel channel (c);
+    channels->emplace (ChannelId (channel.uuid), channel);
   }
 
-#if 0
-  for (auto & i : conflicts_by_major)
-    cout << i.first << " : " << StrUUIDs (i.second) << endl;
-#endif
+  return PublishChannels (channels, "cache");
+}
 
-#if 0
-  for (auto & i : conflicts_by_uuid)
-    cout << i.first << " : " << StrNumbers (i.second) << endl;
-#endif
+void Freebox::WriteChannelCache (const Channels & channels)
+{
+  json cache;
+  cache ["date"] = time (NULL);
 
-#if __cplusplus >= 201703L
-  for (auto & [major, q] : conflicts_by_major)
-#else
-  for (auto & it : conflicts_by_major)
-#endif
-  {
-#if __cplusplus < 201703L
-    int           major = it.first;
-    const Conflicts & q = it.second;
-#endif
+  json & c = cache ["channels"] = json::array ();
+  for (auto & i : channels)
+    c.push_back (i.second.Json ());
 
-    if (! q.empty ())
-    {
-      const Conflict & ch = q.front ();
-      const json   & channel = channels[ch.uuid];
-      const string & name    = channel["name"];
-      const string & logo    = URL (channel["logo_url"]);
-      const json   & item    = bouquet[ch.position];
-
-      vector<Stream> data;
-      if (item.value ("available", false))
-      {
-        auto f = item.find ("streams");
-        if (f != item.end () && f->is_array ())
-          for (auto & s : *f)
-            data.emplace_back (ParseSource (s["type"]),
-                               ParseQuality (s["quality"]),
-                               freebox_replace_server (s["rtsp"], m_hostname),
-                               freebox_replace_server (s.value ("hls", ""), m_hostname));
-      }
-#if 0
-      if (! kodi::vfs::DirectoryExists (m_path + "logos"))
-        kodi::vfs::CreateDirectory (m_path + "logos");
+  if (! freebox_gz_write (m_path + "channels.json", cache.dump ()))
+    kodi::Log (ADDON_LOG_ERROR, "Channels: can't write cache");
+}
 
-      std::string path = m_path + "logos/" + ch.uuid;
-      freebox_channel_logo_fix (logo, path);
-      m_tv_channels.emplace (ChannelId (ch.uuid), Channel (ch.uuid, name, path, ch.major, ch.minor, data));
-#else
-      m_tv_channels.emplace (ChannelId (ch.uuid), Channel (ch.uuid, name, logo + "|customrequest=GET", ch.major, ch.minor, data));
-#endif
+void Freebox::ReadPreferences ()
+{
+  map<unsigned int, enum Source>  sources;
+  map<unsigned int, enum Quality> qualities;
+
+  {
+    string text;
+    freebox_gz_read (m_path + "source.txt", &text);
+    json d = json::parse (text, nullptr, false);
+    if (d.is_object ())
+    {
+      for (auto & item : d.items ())
+        sources.emplace (ChannelId (item.key ()), ParseSource (item.value ()));
     }
   }
 
   {
-    ifstream ifs (m_path + "source.txt");
-    json d = json::parse (ifs, nullptr, false);
+    string text;
+    freebox_gz_read (m_path + "quality.txt", &text);
+    json d = json::parse (text, nullptr, false);
     if (d.is_object ())
     {
       for (auto & item : d.items ())
-        m_tv_prefs_source.emplace (ChannelId (item.key ()), ParseSource (item.value ()));
+        qualities.emplace (ChannelId (item.key ()), ParseQuality (item.value ()));
     }
   }
 
+  map<string, Latency> latencies;
   {
-    ifstream ifs (m_path + "quality.txt");
-    json d = json::parse (ifs, nullptr, false);
+    string text;
+    freebox_gz_read (m_path + "latency.txt", &text);
+    json d = json::parse (text, nullptr, false);
     if (d.is_object ())
     {
       for (auto & item : d.items ())
-        m_tv_prefs_quality.emplace (ChannelId (item.key ()), ParseQuality (item.value ()));
+        latencies.emplace (item.key (), Latency (item.value ()));
     }
   }
 
-  return true;
+  {
+    SharedMutex::Unique lock (m_settings);
+    m_tv_prefs_source.swap  (sources);
+    m_tv_prefs_quality.swap (qualities);
+    m_tv_latency.swap (latencies);
+  }
+}
+
+void Freebox::WriteLatencies ()
+{
+  json d = json::object ();
+  {
+    SharedMutex::Shared lock (m_settings);
+    for (auto & i : m_tv_latency)
+      d.emplace (i.first, i.second.Json ());
+  }
+
+  freebox_gz_write (m_path + "latency.txt", d.dump ());
 }
 
 Freebox::Freebox () :
+  m_http (PVR_FREEBOX_DEFAULT_CONNECTIONS),
+  m_throttle (1.0 / PVR_FREEBOX_DEFAULT_DELAY, PVR_FREEBOX_DEFAULT_RATE),
   m_app_token (),
   m_track_id (),
   m_session_token (),
-  m_tv_channels (),
+  m_tv_channels (make_shared<Channels> ()),
   m_tv_prefs_source (),
   m_tv_prefs_quality (),
   m_epg_queries (),
+  m_epg_pending (0),
   m_epg_cache (),
+  m_epg_events (),
+  m_epg_restored (false),
+  m_epg_changes {0, 0, 0},
+  m_epg_details (0),
   m_epg_days_past (0),
   m_epg_days_future (0),
-  m_epg_last (0),
+  m_epg_coverage (),
+  m_epg_requested (),
+  m_epg_sweep (0),
+  m_epg_sweep_queries (0),
   m_recordings (),
   m_unique_id (1),
   m_generators (),
-  m_timers ()
+  m_timers (),
+  m_timer_updates (0),
+  m_timer_queries (0),
+  m_recording_updates (0),
+  m_recording_queries (0)
 {
 }
 
@@ -921,83 +716,115 @@ Freebox::~Freebox ()
 
 void Freebox::SetHostName (const string & hostname)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Unique lock (m_settings);
   m_hostname = hostname;
 }
 
 string Freebox::GetHostName () const
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Shared lock (m_settings);
   return m_hostname;
 }
 
 void Freebox::SetNetBIOS (const string & netbios)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Unique lock (m_settings);
   m_netbios = netbios;
 }
 
 string Freebox::GetNetBIOS () const
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Shared lock (m_settings);
   return m_netbios;
 }
 
-// NOT thread-safe !
+shared_ptr<const Freebox::Channels> Freebox::TvChannels () const
+{
+  return atomic_load (&m_tv_channels);
+}
+
 string Freebox::URL (const string & query) const
 {
-  return "http://" + m_hostname + query;
+  return "http://" + GetHostName () + query;
 }
 
 void Freebox::SetSource (Source s)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Unique lock (m_settings);
   m_tv_source = s;
 }
 
 void Freebox::SetQuality (Quality q)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Unique lock (m_settings);
   m_tv_quality = q;
 }
 
 void Freebox::SetProtocol (Protocol p)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Unique lock (m_settings);
   m_tv_protocol = p;
 }
 
 void Freebox::SetPastDays (int d)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Unique lock (m_epg);
   m_epg_days_past = d != EPG_TIMEFRAME_UNLIMITED ? min (d, 7) : 7;
 }
 
 void Freebox::SetFutureDays (int d)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Unique lock (m_epg);
   m_epg_days_future = d != EPG_TIMEFRAME_UNLIMITED ? min (d, 7) : 7;
 }
 
 void Freebox::SetExtended (bool e)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Unique lock (m_epg);
   m_epg_extended = e;
 }
 
 void Freebox::SetColors (bool c)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Unique lock (m_epg);
   m_epg_colors = c;
 }
 
 void Freebox::SetDelay (int d)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Unique lock (m_settings);
   m_delay = d;
+  m_throttle.SetBounds (1.0 / max (m_delay, 1), m_rate);
 }
 
-void Freebox::ProcessEvent (const Event & e, EPG_EVENT_STATE state)
+void Freebox::SetConnections (int c)
+{
+  m_http.SetConnections (c);
+}
+
+void Freebox::SetCompression (bool c)
+{
+  m_http.SetCompression (c);
+}
+
+void Freebox::SetNotifications (bool n)
+{
+  m_notifications = n;
+}
+
+void Freebox::SetProbe (bool p)
+{
+  m_probe = p;
+}
+
+void Freebox::SetRate (int r)
+{
+  SharedMutex::Unique lock (m_settings);
+  m_rate = r;
+  m_throttle.SetBounds (1.0 / max (m_delay, 1), m_rate);
+}
+
+void Freebox::ProcessEvent (const Event & e, EPG_EVENT_STATE state, bool detail)
 {
   // FIXME: SHOULDN'T HAPPEN!
   if (e.uuid.find ("pluri_") != 0)
@@ -1013,10 +840,46 @@ void Freebox::ProcessEvent (const Event & e, EPG_EVENT_STATE state)
     return;
   }
 
-  m_mutex.lock ();
-  bool colors = m_epg_colors;
+  {
+    SharedMutex::Unique lock (m_epg);
+    map<time_t, Event> & events = m_epg_events [e.channel];
+
+    auto f = events.find (e.date);
+    bool here = f != events.end () && f->second.uuid == e.uuid;
+
+    // Rescheduled or removed.
+    if (state != EPG_EVENT_CREATED && ! here)
+      for (auto i = events.begin (); i != events.end (); ++i)
+        if (i->second.uuid == e.uuid)
+        {
+          events.erase (i);
+          break;
+        }
+
+    if (state != EPG_EVENT_DELETED)
+      events [e.date] = e;
+    else if (here)
+      events.erase (f);
+
+    if (detail)
+      ++m_epg_details;
+    else
+      ++m_epg_changes [state];
+  }
+
+  kodi::addon::PVREPGTag tag = EpgTag (e);
+  EpgEventStateChange (tag, state);
+}
+
+kodi::addon::PVREPGTag Freebox::EpgTag (const Event & e) const
+{
+  bool colors;
+  {
+    SharedMutex::Shared lock (m_epg);
+    colors = m_epg_colors;
+  }
+
   string picture = ! e.picture.empty () ? URL (e.picture + "|customrequest=GET") : "";
-  m_mutex.unlock ();
 
   string actors   = e.GetCastActors   ();
   string director = e.GetCastDirector ();
@@ -1067,131 +930,690 @@ void Freebox::ProcessEvent (const Event & e, EPG_EVENT_STATE state)
   tag.SetEpisodeName       (e.subtitle);
   tag.SetFlags             (EPG_TAG_FLAG_UNDEFINED);
 
-  EpgEventStateChange (tag, state);
-}
+  return tag;
+}
+
+void Freebox::ReadEpgCache ()
+{
+  HttpPool::Clock::time_point start = HttpPool::Clock::now ();
+
+  string text;
+  if (! freebox_gz_read (m_path + "epg.json", &text)) return;
+
+  time_t now   = time (NULL);
+  time_t begin;
+  {
+    SharedMutex::Shared lock (m_epg);
+    begin = now - m_epg_days_past * 24 * 3600;
+  }
+
+  vector<Event> events;
+  EpgParser parser ([&events, begin] (const Event & e)
+  {
+    if (e.date + e.duration > begin) events.push_back (e);
+  });
+
+  istringstream iss (text);
+  json::sax_parse (iss, &parser);
+  if (! parser.IsSuccess ()) return;
+
+  const json & header = parser.Header ();
+  auto hours = header.find ("hours");
+  auto channels = TvChannels ();
+
+  {
+    SharedMutex::Unique lock (m_epg);
+
+    // Hours still fresh are not fetched again.
+    if (hours != header.end () && hours->is_object ())
+      for (auto & h : hours->items ())
+      {
+        time_t hour = stoll (h.key ());
+        time_t date = h.value ().get<time_t> ();
+        if (hour >= begin - (begin % 3600))
+          for (auto & c : *channels)
+            m_epg_coverage.Fetch (hour, c.first, date);
+      }
+
+    events.erase (remove_if (events.begin (), events.end (), [&channels] (const Event & e)
+    {
+      auto f = channels->find (e.channel);
+      return f == channels->end () || f->second.IsHidden ();
+    }), events.end ());
+
+    // Refreshed pages only send what changed.
+    for (auto & e : events)
+      if (e.uuid.compare (0, 6, "pluri_") == 0)
+        m_epg_cache.Update (BroadcastId (e.uuid), e.Fingerprint (), e.date + e.duration);
+  }
+
+  for (auto & e : events)
+    ProcessEvent (e, EPG_EVENT_CREATED);
+
+  {
+    SharedMutex::Unique lock (m_epg);
+    m_epg_restored = ! events.empty ();
+  }
+
+  double ms = chrono::duration<double, milli> (HttpPool::Clock::now () - start).count ();
+  kodi::Log (ADDON_LOG_INFO, "EPG: %d cached events restored in %.0f ms", (int) events.size (), ms);
+}
+
+void Freebox::WriteEpgCache ()
+{
+  map<unsigned int, map<time_t, Event>> events;
+  json cache;
+
+  {
+    SharedMutex::Unique lock (m_epg);
+    time_t now   = time (NULL);
+    time_t begin = now - m_epg_days_past * 24 * 3600;
+
+    // Past events.
+    for (auto & c : m_epg_events)
+      for (auto i = c.second.begin (); i != c.second.end ();)
+        if (i->second.date + i->second.duration <= begin)
+          i = c.second.erase (i);
+        else
+          ++i;
+
+    events = m_epg_events;
+    cache ["date"] = now;
+
+    json & hours = cache ["hours"] = json::object ();
+    for (auto & h : m_epg_coverage.Hours ())
+      hours [to_string (h.first)] = h.second;
+  }
+
+  json & result = cache ["result"] = json::object ();
+  for (auto & c : events)
+  {
+    json & channel = result ["uuid-webtv-" + to_string (c.first)] = json::array ();
+    for (auto & e : c.second)
+      channel.push_back (e.second.Json ());
+  }
+
+  cache ["success"] = true;
+
+  if (! freebox_gz_write (m_path + "epg.json", cache.dump ()))
+    kodi::Log (ADDON_LOG_ERROR, "EPG: can't write cache");
+}
+
+void Freebox::ProcessEvent (const json & event, unsigned int channel, time_t date, EPG_EVENT_STATE state, bool detail)
+{
+  {
+    auto channels = TvChannels ();
+    auto f = channels->find (channel);
+    if (f == channels->end () || f->second.IsHidden ()) return;
+  }
+
+  Event e (event, channel, date);
+
+  if (state == EPG_EVENT_CREATED)
+  {
+    SharedMutex::Unique lock (m_epg);
+    if (m_epg_extended)
+    {
+      string query = "/api/v6/tv/epg/programs/" + e.uuid;
+      m_epg_queries.Push (Query (EVENT, query, channel, date));
+    }
+  }
+
+  ProcessEvent (e, state, detail);
+}
+
+void Freebox::ProcessChannelEvent (const Event & e)
+{
+  static const string PREFIX = "pluri_";
+  if (e.uuid.compare (0, PREFIX.length (), PREFIX) != 0) return;
+
+  unsigned int id = BroadcastId (e.uuid);
+  EPG_EVENT_STATE state;
+
+  {
+    // Not recorded either: the channel may show up later.
+    auto channels = TvChannels ();
+    auto f = channels->find (e.channel);
+    if (f == channels->end () || f->second.IsHidden ()) return;
+  }
+
+  {
+    SharedMutex::Unique lock (m_epg);
+
+    // Unchanged (events spanning several hours show up in concurrent pages).
+    switch (m_epg_cache.Update (id, e.Fingerprint (), e.date + e.duration))
+    {
+      case BroadcastMap::CREATED : state = EPG_EVENT_CREATED; break;
+      case BroadcastMap::UPDATED : state = EPG_EVENT_UPDATED; break;
+      default                    : return;
+    }
+
+    if (m_epg_extended)
+      m_epg_queries.Push (Query (EVENT, "/api/v6/tv/epg/programs/" + e.uuid, e.channel, e.date));
+  }
+
+  ProcessEvent (e, state);
+}
+
+void Freebox::ProcessChannel (const json & epg, unsigned int channel)
+{
+  time_t first = 0;
+  time_t last  = 0;
+
+  for (auto & event : epg)
+  {
+    Event e (event, channel, event.value ("date", 0));
+    if (first == 0 || e.date < first) first = e.date;
+    last = max (last, (time_t) (e.date + e.duration));
+    ProcessChannelEvent (e);
+  }
+
+  time_t now = time (NULL);
+
+  // Hours fully covered by the schedule.
+  SharedMutex::Unique lock (m_epg);
+  for (time_t t = first + (3600 - first % 3600) % 3600; t + 3600 <= last; t += 3600)
+    m_epg_coverage.Fetch (t, channel, now);
+}
+
+// On demand, ahead of the sweep (unless the current hour is fresh).
+void Freebox::RequestChannel (unsigned int id, bool tuned)
+{
+  auto channels = TvChannels ();
+  auto f = channels->find (id);
+  if (f == channels->end () || f->second.IsHidden ()) return;
+
+  SharedMutex::Unique lock (m_epg);
+
+  time_t now  = time (NULL);
+  time_t hour = now - (now % 3600);
+  if (now - m_epg_coverage.Fetched (hour, id) < PVR_FREEBOX_EPG_TTL) return;
+
+  // Guide update (every channel in a row): the current hour page covers it,
+  // don't hold it back with a query per channel.
+  if (! tuned && (m_epg_coverage.IsRequested (hour) || m_epg_requested.size () >= PVR_FREEBOX_EPG_URGENT))
+    return;
+
+  if (! m_epg_requested.insert (id).second) return;
+
+  string query = "/api/v6/tv/epg/by_channel/" + f->second.uuid + '/' + to_string (hour);
+  m_epg_queries.Push (Query (CHANNEL, query, id, hour), true);
+}
+
+void Freebox::ProcessFull (const string & query, time_t hour)
+{
+  // Channels and events found in the page.
+  set<unsigned int> channels;
+  set<string> uuids;
+
+  EpgParser parser ([this, &channels, &uuids] (const Event & e)
+  {
+    channels.insert (e.channel);
+    uuids.insert (e.uuid);
+    ProcessChannelEvent (e);
+  });
+
+  bool same    = false;
+  bool success = HttpGet (query, &parser, &same);
+
+  time_t now = time (NULL);
+  auto tv = TvChannels ();
+
+  vector<Event> deleted;
+  {
+    SharedMutex::Unique lock (m_epg);
+
+    // Failed hours are queued again by the next loop.
+    m_epg_coverage.Release (hour);
+    if (! success) return;
+
+    for (auto & c : *tv)
+      m_epg_coverage.Fetch (hour, c.first, now);
+
+    // Events starting within the hour, but gone from the page.
+    for (unsigned int c : channels)
+    {
+      auto f = m_epg_events.find (c);
+      if (f == m_epg_events.end ()) continue;
+
+      const map<time_t, Event> & events = f->second;
+      for (auto i = events.lower_bound (hour); i != events.end () && i->first < hour + 3600; ++i)
+        if (uuids.count (i->second.uuid) == 0)
+          deleted.push_back (i->second);
+    }
+
+    for (auto & e : deleted)
+      m_epg_cache.Erase (BroadcastId (e.uuid));
+  }
+
+  for (auto & e : deleted)
+    ProcessEvent (e, EPG_EVENT_DELETED);
+}
+
+void Freebox::ProcessQuery (const Query & q)
+{
+  kodi::Log (ADDON_LOG_INFO, "Processing: '%s'", q.query.c_str ());
+
+  // Hour pages are big: stream them.
+  if (q.type == FULL)
+  {
+    ProcessFull (q.query, q.date);
+    return;
+  }
+
+  json result;
+  if (HttpGet (q.query, &result))
+  {
+    switch (q.type)
+    {
+      case CHANNEL : ProcessChannel (result, q.channel); break;
+      case EVENT   : ProcessEvent   (result, q.channel, q.date, EPG_EVENT_UPDATED, true); break;
+      default      : break;
+    }
+  }
+
+  if (q.type == CHANNEL)
+  {
+    SharedMutex::Unique lock (m_epg);
+    m_epg_requested.erase (q.channel);
+  }
+}
+
+void Freebox::ProcessQueries ()
+{
+  while (! m_threadStop)
+  {
+    Query q;
+    bool  popped;
+    {
+      SharedMutex::Unique lock (m_epg);
+      popped = m_epg_queries.Pop (&q, time (NULL));
+      if (popped) ++m_epg_pending;
+    }
+
+    if (! popped)
+    {
+      Sleep (500);
+      continue;
+    }
+
+    // Wait for a slot in the global request budget
+    // (reserved for a query in hand: an idle worker doesn't hold one).
+    HttpThrottle::Clock::time_point slot = m_throttle.Reserve ();
+    while (! m_threadStop && HttpThrottle::Clock::now () < slot)
+      Sleep (50);
+
+    if (! m_threadStop)
+      ProcessQuery (q);
+
+    {
+      SharedMutex::Unique lock (m_epg);
+      --m_epg_pending;
+      ++m_epg_sweep_queries;
+    }
+  }
+}
+
+void Freebox::Process ()
+{
+  int concurrency;
+  {
+    SharedMutex::Shared lock (m_settings);
+    concurrency = max (m_concurrency, 1);
+  }
+
+  // Cached guide first (cold start: it needs the channels).
+  bool cached = ! TvChannels ()->empty ();
+  bool loaded = ! cached && ProcessChannels ();
+  ReadEpgCache ();
+  if (cached) loaded = ProcessChannels ();
+
+  // EPG workers.
+  vector<thread> workers;
+  for (int i = 0; i < concurrency; ++i)
+    workers.emplace_back (&Freebox::ProcessQueries, this);
+
+  // Push notifications.
+  thread notifications (&Freebox::ProcessNotifications, this);
+  // Stream probes.
+  thread probes (&Freebox::ProcessProbes, this);
+
+  // Next refreshes.
+  time_t channels   = loaded ? time (NULL) + PVR_FREEBOX_CHANNELS_INTERVAL : 0;
+  time_t generators = 0;
+  time_t timers     = 0;
+  time_t recordings = 0;
+  // Kodi callbacks, logged hourly.
+  time_t callbacks  = time (NULL);
+
+  while (! m_threadStop)
+  {
+    time_t now = time (NULL);
+
+    // Channel list (retried on every loop until it loads).
+    if (now >= channels)
+      channels = now + (ProcessChannels () ? PVR_FREEBOX_CHANNELS_INTERVAL : 0);
+
+    int delay;
+    {
+      SharedMutex::Shared lock (m_settings);
+      delay = m_delay;
+    }
+
+    time_t begin, end;
+    {
+      SharedMutex::Shared lock (m_epg);
+      begin = now - m_epg_days_past   * 24 * 3600;
+      end   = now + m_epg_days_future * 24 * 3600;
+    }
+
+    if (StartSession ())
+    {
+      // Notifications seen to do the job: polling is just a safety net.
+      bool notified = m_notifications_live;
+
+      if (now >= generators)
+      {
+        ProcessGenerators ();
+        generators = now + max (PVR_FREEBOX_GENERATORS_INTERVAL, notified ? PVR_FREEBOX_NOTIFIED_INTERVAL : 0);
+      }
+
+      bool changed = false;
+      if (now >= timers)
+      {
+        changed = ProcessTimers ();
+        timers  = now + (notified ? PVR_FREEBOX_NOTIFIED_INTERVAL : 0);
+      }
+
+      // Timers starting or ending usually mean recordings changed.
+      if (changed || now >= recordings)
+      {
+        ProcessRecordings ();
+        recordings = now + (notified ? PVR_FREEBOX_NOTIFIED_INTERVAL : PVR_FREEBOX_RECORDINGS_INTERVAL);
+      }
+    }
+
+    if (now - callbacks >= 3600)
+    {
+      kodi::Log (ADDON_LOG_INFO, "Kodi: %d timer updates (%d GetTimers), %d recording updates (%d GetRecordings) in %d s",
+                 (int) m_timer_updates.exchange (0), (int) m_timer_queries.exchange (0),
+                 (int) m_recording_updates.exchange (0), (int) m_recording_queries.exchange (0),
+                 (int) (now - callbacks));
+      callbacks = now;
+    }
 
-void Freebox::ProcessEvent (const json & event, unsigned int channel, time_t date, EPG_EVENT_STATE state)
-{
-  {
-    lock_guard<recursive_mutex> lock (m_mutex);
-    auto f = m_tv_channels.find (channel);
-    if (f == m_tv_channels.end () || f->second.IsHidden ()) return;
-  }
+    kodi::Log (ADDON_LOG_DEBUG, "HTTP: %s", m_http.GetStats ().str ().c_str ());
+    kodi::Log (ADDON_LOG_DEBUG, "Digests: %s", m_digests.str ().c_str ());
+    kodi::Log (ADDON_LOG_DEBUG, "Rate: %.2f req/s (%.0f ms)", m_throttle.GetRate (), m_throttle.GetLatency ());
+    kodi::Log (ADDON_LOG_DEBUG, "Locks: settings: %s", m_settings.GetStats ().str ().c_str ());
+    kodi::Log (ADDON_LOG_DEBUG, "Locks: session: %s",  m_session.GetStats  ().str ().c_str ());
+    kodi::Log (ADDON_LOG_DEBUG, "Locks: epg: %s",      m_epg.GetStats      ().str ().c_str ());
+    kodi::Log (ADDON_LOG_DEBUG, "Locks: pvr: %s",      m_pvr.GetStats      ().str ().c_str ());
 
-  Event e (event, channel, date);
+    {
+      SharedMutex::Unique lock (m_epg);
+      m_epg_coverage.Drop (begin - (begin % 3600));
 
-  if (state == EPG_EVENT_CREATED)
-  {
-    lock_guard<recursive_mutex> lock (m_mutex);
-    if (m_epg_extended)
+      // Missing, failed or stale hours.
+      for (time_t t : m_epg_coverage.Missing (begin, end, now, PVR_FREEBOX_EPG_TTL))
+      {
+        string epoch = to_string (t);
+        string query = "/api/v6/tv/epg/by_time/" + epoch;
+        m_epg_queries.Push (Query (FULL, query, 0, t));
+        //kodi::Log (ADDON_LOG_INFO, "Queued: '%s' %d < %d", query.c_str (), t, end);
+        m_epg_coverage.Request (t, now);
+        if (m_epg_sweep == 0) m_epg_sweep = now;
+      }
+    }
+
+    bool complete = false;
     {
-      string query = "/api/v6/tv/epg/programs/" + e.uuid;
-      m_epg_queries.emplace (EVENT, query, channel, date);
+      SharedMutex::Unique lock (m_epg);
+      if (m_epg_queries.Empty () && m_epg_pending == 0)
+      {
+        if (m_epg_sweep != 0)
+        {
+          kodi::Log (ADDON_LOG_INFO, "EPG: guide complete in %d s (%d queries, %s start)",
+                     (int) (time (NULL) - m_epg_sweep), (int) m_epg_sweep_queries,
+                     m_epg_restored ? "warm" : "cold");
+          kodi::Log (ADDON_LOG_INFO, "EPG: %d created, %d updated, %d deleted, %d detailed",
+                     (int) m_epg_changes [EPG_EVENT_CREATED],
+                     (int) m_epg_changes [EPG_EVENT_UPDATED],
+                     (int) m_epg_changes [EPG_EVENT_DELETED],
+                     (int) m_epg_details);
+          m_epg_sweep = 0;
+          m_epg_sweep_queries = 0;
+          fill (m_epg_changes, m_epg_changes + 3, 0);
+          m_epg_details = 0;
+          complete = true;
+        }
+
+        m_epg_cache.Evict (now);
+      }
+      else
+      {
+        kodi::Log (ADDON_LOG_DEBUG, "EPG: %d queued (full = %d, channel = %d, event = %d), %d pending",
+                   (int) m_epg_queries.Size (),
+                   (int) m_epg_queries.Size (FULL),
+                   (int) m_epg_queries.Size (CHANNEL),
+                   (int) m_epg_queries.Size (EVENT),
+                   m_epg_pending);
+        kodi::Log (ADDON_LOG_DEBUG, "EPG: urgent = %d, current = %d, soon = %d, past = %d, later = %d",
+                   (int) m_epg_queries.Size (Queries::URGENT,  now),
+                   (int) m_epg_queries.Size (Queries::CURRENT, now),
+                   (int) m_epg_queries.Size (Queries::SOON,    now),
+                   (int) m_epg_queries.Size (Queries::PAST,    now),
+                   (int) m_epg_queries.Size (Queries::LATER,   now));
+      }
     }
+
+    if (complete)
+      WriteEpgCache ();
+
+    Sleep (delay * 1000);
   }
 
-  ProcessEvent (e, state);
+  for (auto & w : workers)
+    w.join ();
+
+  notifications.join ();
+  probes.join ();
 }
 
-void Freebox::ProcessChannel (const json & epg, unsigned int channel)
+bool Freebox::OpenNotifications (WebSocket * ws)
 {
-  for (auto & event : epg)
+  if (! StartSession ()) return false;
+
+  string url = "ws://" + GetHostName () + PVR_FREEBOX_NOTIFICATIONS_PATH;
+  string session;
   {
-    string uuid = event.value ("id", "");
-    time_t date = event.value ("date", 0);
+    SharedMutex::Shared lock (m_session);
+    session = m_session_token;
+  }
 
-    static const string PREFIX = "pluri_";
-    if (uuid.find (PREFIX) != 0) continue;
+  if (! ws->Open (url, {{"X-Fbx-App-Auth", session}}))
+    return false;
 
-    string query = "/api/v6/tv/epg/programs/" + uuid;
+  json events = json::array ();
+  for (auto & n : FREEBOX_NOTIFICATIONS)
+    events.push_back (n.first);
 
-    {
-      lock_guard<recursive_mutex> lock (m_mutex);
-      if (m_epg_cache.count (query) > 0) continue;
-    }
+  json request = {{"action", "register"}, {"events", events}};
+  if (! ws->Send (request.dump ()))
+    return false;
 
-    ProcessEvent (event, channel, date, EPG_EVENT_CREATED);
+  // Registration answer (notifications may come first).
+  string message;
+  while (ws->Receive (&message, PVR_FREEBOX_NOTIFICATIONS_WAIT) == WebSocket::MESSAGE)
+  {
+    json m = json::parse (message, nullptr, false);
+    if (! m.is_object () || m.value ("action", "") != "register")
+      continue;
 
-    {
-      lock_guard<recursive_mutex> lock (m_mutex);
-      m_epg_cache.insert (query);
-    }
+    if (m.value ("success", false))
+      return true;
+
+    kodi::Log (ADDON_LOG_ERROR, "Notifications: %s", message.c_str ());
+    break;
   }
-}
 
-void Freebox::ProcessFull (const json & epg)
-{
-  for (auto & item : epg.items ())
-    ProcessChannel (item.value (), ChannelId (item.key ()));
+  ws->Close ();
+  return false;
 }
 
-void Freebox::Process ()
+void Freebox::ProcessNotifications ()
 {
-  while (! m_threadStop )
-  {
-    m_mutex.lock ();
-    int    delay = m_delay;
-    time_t now   = time (NULL);
-    time_t begin = now - m_epg_days_past   * 24 * 3600;
-    time_t end   = now + m_epg_days_future * 24 * 3600;
-    time_t last  = max (begin, m_epg_last);
-    m_mutex.unlock ();
+  WebSocket ws;
+  int backoff = 1;
 
-    if (StartSession ())
+  while (! m_threadStop)
+  {
+    if (! m_notifications)
     {
-      lock_guard<recursive_mutex> lock (m_mutex);
-      ProcessGenerators ();
-      ProcessTimers ();
-      ProcessRecordings ();
+      ws.Close ();
+      m_notifications_live = false;
+      Sleep (1000);
+      continue;
     }
 
-    for (time_t t = last - (last % 3600); t < end; t += 3600)
+    if (! ws.IsOpen ())
     {
-      string epoch = to_string (t);
-      string query = "/api/v6/tv/epg/by_time/" + epoch;
+      if (m_notifications_live)
+        kodi::Log (ADDON_LOG_INFO, "Notifications: disconnected, polling");
+      m_notifications_live = false;
+
+      if (! OpenNotifications (&ws))
       {
-        lock_guard<recursive_mutex> lock (m_mutex);
-        m_epg_queries.emplace (FULL, query);
-        //kodi::Log (ADDON_LOG_INFO, "Queued: '%s' %d < %d", query.c_str (), t, end);
-        m_epg_last = t + 3600;
+        kodi::Log (ADDON_LOG_DEBUG, "Notifications: unavailable, next attempt in %d s", backoff);
+        for (int i = 0; i < backoff * 10 && m_notifications && ! m_threadStop; ++i)
+          Sleep (100);
+        backoff = min (2 * backoff, PVR_FREEBOX_RECONNECT_MAX);
+        continue;
       }
+
+      // Polling as usual until a known notification comes.
+      kodi::Log (ADDON_LOG_INFO, "Notifications: connected");
+      backoff = 1;
+
+      // Changes missed while disconnected.
+      ProcessGenerators ();
+      ProcessTimers ();
+      ProcessRecordings ();
     }
 
-    Query q;
+    string message;
+    if (ws.Receive (&message, 1000) == WebSocket::MESSAGE)
+      ProcessNotification (json::parse (message, nullptr, false));
+  }
+
+  m_notifications_live = false;
+}
+
+void Freebox::ProcessProbes ()
+{
+  int probes = 0;
+
+  while (! m_threadStop)
+  {
+    string url;
+    if (m_probe)
     {
-      lock_guard<recursive_mutex> lock (m_mutex);
-      if (! m_epg_queries.empty ())
-      {
-        q = m_epg_queries.front ();
-        m_epg_queries.pop ();
-      }
+      auto channels = TvChannels ();
+      time_t now    = time (NULL);
+      time_t oldest = now - PVR_FREEBOX_PROBE_TTL;
+
+      // Stream measured the longest ago (never measured first).
+      SharedMutex::Shared lock (m_settings);
+      for (auto & c : *channels)
+        for (auto & s : c.second.streams)
+        {
+          const string * u = s.GetURL (m_tv_protocol);
+          if (u == nullptr || u->empty ()) continue;
+
+          auto f = m_tv_latency.find (*u);
+          time_t date = f != m_tv_latency.end () ? f->second.date : 0;
+          if (date < oldest)
+          {
+            oldest = date;
+            url    = *u;
+          }
+        }
     }
 
-    if (q.type != NONE)
+    if (! url.empty ())
     {
-      //cout << q.query << " [" << delay << ']' << endl;
-      kodi::Log (ADDON_LOG_INFO, "Processing: '%s'", q.query.c_str ());
+      StreamProbe::Result r = StreamProbe::Probe (url, PVR_FREEBOX_PROBE_TIMEOUT);
+      kodi::Log (ADDON_LOG_DEBUG, "Probe: '%s' (first byte: %.0f ms, first frame: %.0f ms)",
+                 url.c_str (), r.first_byte, r.first_frame);
 
-      json result;
-      if (HttpGet (q.query, &result))
       {
-        switch (q.type)
-        {
-          case FULL    : ProcessFull    (result); break;
-          case CHANNEL : ProcessChannel (result, q.channel); break;
-          case EVENT   : ProcessEvent   (result, q.channel, q.date, EPG_EVENT_UPDATED); break;
-          default      : break;
-        }
+        SharedMutex::Unique lock (m_settings);
+        m_tv_latency [url].Add (r.first_byte, r.first_frame, time (NULL));
       }
+
+      if (++probes % PVR_FREEBOX_PROBE_SAVE == 0)
+        WriteLatencies ();
     }
-    else
+
+    for (int i = 0; i < PVR_FREEBOX_PROBE_DELAY * 10 && ! m_threadStop; ++i)
+      Sleep (100);
+  }
+
+  if (probes > 0)
+    WriteLatencies ();
+}
+
+int Freebox::FastestStream (const Channel & channel, enum Source source, enum Quality quality, enum Protocol protocol) const
+{
+  int    index = -1;
+  double best  = 0;
+
+  for (size_t i = 0; i < channel.streams.size (); ++i)
+  {
+    const Stream & s = channel.streams [i];
+
+    // Explicit preferences still apply.
+    if (source != Source::AUTO && s.source != source) continue;
+    if (quality == Quality::AUTO ? s.quality == Quality::STEREO : s.quality != quality) continue;
+
+    const string * url = s.GetURL (protocol);
+    if (url == nullptr) continue;
+
+    auto f = m_tv_latency.find (*url);
+    if (f == m_tv_latency.end () || ! f->second.IsHealthy ()) continue;
+
+    if (index < 0 || f->second.first_frame < best)
     {
-      lock_guard<recursive_mutex> lock (m_mutex);
-      m_epg_cache.clear ();
+      index = i;
+      best  = f->second.first_frame;
     }
+  }
 
-    Sleep (delay * 1000);
+  return index;
+}
+
+void Freebox::ProcessNotification (const json & n)
+{
+  if (! n.is_object () || n.value ("action", "") != "notification")
+    return;
+
+  string name = n.value ("source", "") + '_' + n.value ("event", "");
+  auto f = FREEBOX_NOTIFICATIONS.find (name);
+  if (f == FREEBOX_NOTIFICATIONS.end ())
+  {
+    kodi::Log (ADDON_LOG_DEBUG, "Notification: %s (ignored)", name.c_str ());
+    return;
   }
+
+  kodi::Log (ADDON_LOG_DEBUG, "Notification: %s", name.c_str ());
+
+  // The events are delivered: polling can slow down.
+  if (! m_notifications_live.exchange (true))
+    kodi::Log (ADDON_LOG_INFO, "Notifications: live, polling every %d s", PVR_FREEBOX_NOTIFIED_INTERVAL);
+
+  if (f->second & FREEBOX_REFRESH_GENERATORS) ProcessGenerators ();
+  if (f->second & FREEBOX_REFRESH_TIMERS)     ProcessTimers ();
+  if (f->second & FREEBOX_REFRESH_RECORDINGS) ProcessRecordings ();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1200,6 +1622,7 @@ void Freebox::Process ()
 
 ADDON_STATUS Freebox::Create ()
 {
+  m_created = HttpPool::Clock::now ();
   kodi::Log (ADDON_LOG_DEBUG, "%s - Creating the Freebox TV add-on", __FUNCTION__);
 
   m_path = UserPath ();
@@ -1220,7 +1643,10 @@ ADDON_STATUS Freebox::Create ()
   kodi::QueueNotification (QUEUE_INFO, "", PVR_FREEBOX_VERSION);
   SetPastDays (EpgMaxPastDays ());
   SetFutureDays (EpgMaxFutureDays ());
-  ProcessChannels ();
+
+  // Last known channels: the server is queried in the background.
+  ReadPreferences ();
+  ReadChannelCache ();
   CreateThread ();
 
   return ADDON_STATUS_OK;
@@ -1243,6 +1669,24 @@ ADDON_STATUS Freebox::SetSetting (const string & settingName, const kodi::addon:
   else if (settingName == "delay")
     SetDelay (settingValue.GetInt ());
 
+  else if (settingName == "connections")
+    SetConnections (settingValue.GetInt ());
+
+  else if (settingName == "concurrency")
+    return ADDON_STATUS_NEED_RESTART;
+
+  else if (settingName == "rate")
+    SetRate (settingValue.GetInt ());
+
+  else if (settingName == "compression")
+    SetCompression (settingValue.GetBoolean ());
+
+  else if (settingName == "notifications")
+    SetNotifications (settingValue.GetBoolean ());
+
+  else if (settingName == "probe")
+    SetProbe (settingValue.GetBoolean ());
+
   else if (settingName == "restart")
     return settingValue.GetBoolean() ? ADDON_STATUS_NEED_RESTART : ADDON_STATUS_OK;
 
@@ -1271,12 +1715,20 @@ void Freebox::ReadSettings ()
 {
   m_hostname     = kodi::addon::GetSettingString         ("hostname", PVR_FREEBOX_DEFAULT_HOSTNAME);
   m_netbios      = kodi::addon::GetSettingString         ("netbios",  PVR_FREEBOX_DEFAULT_NETBIOS);
-  m_delay        = kodi::addon::GetSettingInt            ("delay",    PVR_FREEBOX_DEFAULT_DELAY);
   m_tv_source    = kodi::addon::GetSettingEnum<Source>   ("source",   PVR_FREEBOX_DEFAULT_SOURCE);
   m_tv_quality   = kodi::addon::GetSettingEnum<Quality>  ("quality",  PVR_FREEBOX_DEFAULT_QUALITY);
   m_tv_protocol  = kodi::addon::GetSettingEnum<Protocol> ("protocol", PVR_FREEBOX_DEFAULT_PROTOCOL);
   m_epg_extended = kodi::addon::GetSettingBoolean        ("extended", PVR_FREEBOX_DEFAULT_EXTENDED);
   m_epg_colors   = kodi::addon::GetSettingBoolean        ("colors",   PVR_FREEBOX_DEFAULT_COLORS);
+
+  m_concurrency  = kodi::addon::GetSettingInt ("concurrency", PVR_FREEBOX_DEFAULT_CONCURRENCY);
+
+  SetConnections (kodi::addon::GetSettingInt ("connections", PVR_FREEBOX_DEFAULT_CONNECTIONS));
+  SetDelay       (kodi::addon::GetSettingInt ("delay",       PVR_FREEBOX_DEFAULT_DELAY));
+  SetRate        (kodi::addon::GetSettingInt ("rate",        PVR_FREEBOX_DEFAULT_RATE));
+  SetCompression (kodi::addon::GetSettingBoolean ("compression", PVR_FREEBOX_DEFAULT_COMPRESSION));
+  SetNotifications (kodi::addon::GetSettingBoolean ("notifications", PVR_FREEBOX_DEFAULT_NOTIFICATIONS));
+  SetProbe       (kodi::addon::GetSettingBoolean ("probe",       PVR_FREEBOX_DEFAULT_PROBE));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1342,8 +1794,23 @@ PVR_ERROR Freebox::SetEPGMaxFutureDays (int days)
   return PVR_ERROR_NO_ERROR;
 }
 
+// Forced updates only (events are pushed as they come).
 PVR_ERROR Freebox::GetEPGForChannel (int channelUid, time_t start, time_t end, kodi::addon::PVREPGTagsResultSet & results)
 {
+  vector<Event> events;
+
+  {
+    SharedMutex::Shared lock (m_epg);
+    auto f = m_epg_events.find (channelUid);
+    if (f != m_epg_events.end ())
+      EventsBetween (f->second, start, end, &events);
+  }
+
+  for (auto & e : events)
+    results.Add (EpgTag (e));
+
+  RequestChannel (channelUid, false);
+
   return PVR_ERROR_NO_ERROR;
 }
 
@@ -1353,25 +1820,36 @@ PVR_ERROR Freebox::GetEPGForChannel (int channelUid, time_t start, time_t end, k
 
 PVR_ERROR Freebox::GetChannelsAmount (int & amount)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
-  amount = m_tv_channels.size ();
+  amount = TvChannels ()->size ();
   return PVR_ERROR_NO_ERROR;
 }
 
 PVR_ERROR Freebox::GetChannels (bool radio, kodi::addon::PVRChannelsResultSet & results)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  auto channels = TvChannels ();
 
-  //for (auto i = m_tv_channels.begin (); i != m_tv_channels.end (); ++i)
-  for (auto i : m_tv_channels)
-    i.second.GetChannel (results, radio);
+  for (auto & i : *channels)
+  {
+    const Channel & c = i.second;
+
+    kodi::addon::PVRChannel channel;
+
+    channel.SetUniqueId         (ChannelId (c.uuid));
+    channel.SetIsRadio          (radio);
+    channel.SetChannelNumber    (c.major);
+    channel.SetSubChannelNumber (c.minor);
+    channel.SetChannelName      (c.name);
+    channel.SetIconPath         (c.logo);
+    channel.SetIsHidden         (c.IsHidden ());
+
+    results.Add (channel);
+  }
 
   return PVR_ERROR_NO_ERROR;
 }
 
 PVR_ERROR Freebox::GetChannelGroupsAmount (int & amount)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
   amount = 0;
   return PVR_ERROR_NO_ERROR;
 }
@@ -1388,118 +1866,147 @@ PVR_ERROR Freebox::GetChannelGroupMembers (const kodi::addon::PVRChannelGroup &
 
 PVR_ERROR Freebox::GetChannelStreamProperties (const kodi::addon::PVRChannel & channel, PVR_SOURCE /*source*/, std::vector<kodi::addon::PVRStreamProperty> & properties)
 {
-  enum Source  source  = ChannelSource  (channel.GetUniqueId (), true);
-  enum Quality quality = ChannelQuality (channel.GetUniqueId (), true);
+  unsigned int id = channel.GetUniqueId ();
+
+  // Watched channel: its guide first.
+  RequestChannel (id, true);
+
+  auto channels = TvChannels ();
+  auto f = channels->find (id);
+  if (f == channels->end ()) return PVR_ERROR_NO_ERROR;
+
+  const Channel & c = f->second;
 
-  lock_guard<recursive_mutex> lock (m_mutex);
-  auto f = m_tv_channels.find (channel.GetUniqueId ());
-  if (f != m_tv_channels.end ())
-    return f->second.GetStreamProperties (source, quality, m_tv_protocol, properties);
+  // Best streams are computed when channels load (static scores).
+  int index;
+  enum Protocol protocol;
+  {
+    SharedMutex::Shared lock (m_settings);
+    auto s = m_tv_prefs_source.find (id);
+    auto q = m_tv_prefs_quality.find (id);
+    enum Source  source  = s != m_tv_prefs_source.end  () ? s->second : m_tv_source;
+    enum Quality quality = q != m_tv_prefs_quality.end () ? q->second : m_tv_quality;
+    protocol = m_tv_protocol;
+
+    index = c.GetStream (source, quality);
+
+    // AUTO: the fastest stream measured, if any.
+    if (m_probe && (source == Source::AUTO || quality == Quality::AUTO))
+    {
+      int fastest = FastestStream (c, source, quality, protocol);
+      if (fastest >= 0) index = fastest;
+    }
+  }
+
+  if (index >= 0)
+  {
+    const string * url = c.streams [index].GetURL (protocol);
+    if (url != nullptr)
+      properties.emplace_back (PVR_STREAM_PROPERTY_STREAMURL, *url);
+
+    properties.emplace_back (PVR_STREAM_PROPERTY_ISREALTIMESTREAM, "true");
+  }
 
   return PVR_ERROR_NO_ERROR;
 }
 
 enum Freebox::Source Freebox::ChannelSource (unsigned int id, bool fallback)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Shared lock (m_settings);
   auto f = m_tv_prefs_source.find (id);
   return f != m_tv_prefs_source.end () ? f->second : (fallback ? m_tv_source : Source::DEFAULT);
 }
 
 void Freebox::SetChannelSource (unsigned int id, enum Source source)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
-  switch (source)
+  json d;
   {
-    case Source::AUTO : m_tv_prefs_source.erase (id); break;
-    case Source::IPTV : m_tv_prefs_source [id] = Source::IPTV; break;
-    case Source::DVB  : m_tv_prefs_source [id] = Source::DVB;  break;
-    default           : break;
-  }
+    SharedMutex::Unique lock (m_settings);
+    switch (source)
+    {
+      case Source::AUTO : m_tv_prefs_source.erase (id); break;
+      case Source::IPTV : m_tv_prefs_source [id] = Source::IPTV; break;
+      case Source::DVB  : m_tv_prefs_source [id] = Source::DVB;  break;
+      default           : break;
+    }
 
-  json d;
-  for (auto & i : m_tv_prefs_source)
-    d.emplace ("uuid-webtv-" + to_string (i.first), StrSource (i.second));
+    for (auto & i : m_tv_prefs_source)
+      d.emplace ("uuid-webtv-" + to_string (i.first), StrSource (i.second));
+  }
 
-  ofstream ofs (m_path + "source.txt");
-  ofs << d;
+  freebox_gz_write (m_path + "source.txt", d.dump ());
 }
 
 enum Freebox::Quality Freebox::ChannelQuality (unsigned int id, bool fallback)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Shared lock (m_settings);
   auto f = m_tv_prefs_quality.find (id);
   return f != m_tv_prefs_quality.end () ? f->second : (fallback ? m_tv_quality : Quality::DEFAULT);
 }
 
 void Freebox::SetChannelQuality (unsigned int id, enum Quality quality)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
-  switch (quality)
+  json d;
   {
-    case Quality::AUTO   : m_tv_prefs_quality.erase (id); break;
-    case Quality::HD     : m_tv_prefs_quality [id] = Quality::HD;     break;
-    case Quality::SD     : m_tv_prefs_quality [id] = Quality::SD;     break;
-    case Quality::LD     : m_tv_prefs_quality [id] = Quality::LD;     break;
-    case Quality::STEREO : m_tv_prefs_quality [id] = Quality::STEREO; break;
-    default              : break;
-  }
+    SharedMutex::Unique lock (m_settings);
+    switch (quality)
+    {
+      case Quality::AUTO   : m_tv_prefs_quality.erase (id); break;
+      case Quality::HD     : m_tv_prefs_quality [id] = Quality::HD;     break;
+      case Quality::SD     : m_tv_prefs_quality [id] = Quality::SD;     break;
+      case Quality::LD     : m_tv_prefs_quality [id] = Quality::LD;     break;
+      case Quality::STEREO : m_tv_prefs_quality [id] = Quality::STEREO; break;
+      default              : break;
+    }
 
-  json d;
-  for (auto & i : m_tv_prefs_quality)
-    d.emplace ("uuid-webtv-" + to_string (i.first), StrQuality (i.second));
+    for (auto & i : m_tv_prefs_quality)
+      d.emplace ("uuid-webtv-" + to_string (i.first), StrQuality (i.second));
+  }
 
-  ofstream ofs (m_path + "quality.txt");
-  ofs << d;
+  freebox_gz_write (m_path + "quality.txt", d.dump ());
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // R E C O R D I N G S /////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
-Freebox::Recording::Recording (const json & r) :
-  id              (r.value ("id", -1)),
-  start           (r.value ("start", 0)),
-  end             (r.value ("end", 0)),
-  name            (r.value ("name", "")),
-  subname         (r.value ("subname", "")),
-  channel_uuid    (r.value ("channel_uuid", "")),
-  channel_name    (r.value ("channel_name", "")),
-//channel_quality (r.value ("channel_quality", "")),
-//channel_type    (r.value ("channel_type", "")),
-//broadcast_type  (r.value ("broadcast_type", "")),
-  media           (r.value ("media", "")),
-  path            (r.value ("path", "")),
-  filename        (r.value ("filename", "")),
-  byte_size       (r.value ("byte_size", 0)),
-  secure          (r.value ("secure", false))
-{
-}
-
-void Freebox::ProcessRecordings ()
+bool Freebox::ProcessRecordings ()
 {
-  m_recordings.clear ();
+  lock_guard<mutex> refresh (m_refresh_recordings);
 
+  bool same = false;
   json recordings;
-  if (HttpGet ("/api/v6/pvr/finished/", &recordings, json::value_t::array))
+  if (! HttpGet ("/api/v6/pvr/finished/", &recordings, json::value_t::array, &same) || same)
+    return false;
+
+  map<int, Recording> next;
+  for (auto & r : recordings)
+    next.emplace (r.value ("id", -1), Recording (r));
+
+  // Kodi only hears about actual changes.
   {
-    for (auto & r : recordings)
-      m_recordings.emplace (r.value ("id", -1), Recording (r));
+    SharedMutex::Unique lock (m_pvr);
+    if (next == m_recordings)
+      return false;
 
-    TriggerRecordingUpdate ();
+    m_recordings.swap (next);
   }
+
+  NotifyRecordings ();
+  return true;
 }
 
 PVR_ERROR Freebox::GetRecordingsAmount (bool deleted, int& amount)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Shared lock (m_pvr);
   amount = m_recordings.size ();
   return PVR_ERROR_NO_ERROR;
 }
 
 PVR_ERROR Freebox::GetRecordings (bool deleted, kodi::addon::PVRRecordingsResultSet & results)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Shared lock (m_pvr);
+  ++m_recording_queries;
 
 #if __cplusplus >= 201703L
   for (auto & [id, r] : m_recordings)
@@ -1535,7 +2042,7 @@ PVR_ERROR Freebox::GetRecordingSize (const kodi::addon::PVRRecording & recording
 {
   int id = stoi (recording.GetRecordingId ());
 
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Shared lock (m_pvr);
   auto i = m_recordings.find (id);
   if (i == m_recordings.end ())
     return PVR_ERROR_SERVER_ERROR;
@@ -1548,13 +2055,20 @@ PVR_ERROR Freebox::GetRecordingStreamProperties (const kodi::addon::PVRRecording
 {
   int id = stoi (recording.GetRecordingId ());
 
-  lock_guard<recursive_mutex> lock (m_mutex);
-  auto i = m_recordings.find (id);
-  if (i == m_recordings.end ())
-    return PVR_ERROR_SERVER_ERROR;
+  string media, path, filename;
+  {
+    SharedMutex::Shared lock (m_pvr);
+    auto i = m_recordings.find (id);
+    if (i == m_recordings.end ())
+      return PVR_ERROR_SERVER_ERROR;
+
+    const Recording & r = i->second;
+    media    = r.media;
+    path     = r.path;
+    filename = r.filename;
+  }
 
-  const Recording & r = i->second;
-  string stream = "smb://" + m_netbios + '/' + r.media + '/' + r.path + '/' + r.filename;
+  string stream = "smb://" + GetNetBIOS () + '/' + media + '/' + path + '/' + filename;
   properties.emplace_back (PVR_STREAM_PROPERTY_STREAMURL, stream);
   properties.emplace_back (PVR_STREAM_PROPERTY_ISREALTIMESTREAM, "false");
 
@@ -1569,10 +2083,11 @@ PVR_ERROR Freebox::RenameRecording (const kodi::addon::PVRRecording & recording)
   string name    = recording.GetTitle ();
   string subname = recording.GetEpisodeName ();
 
-  lock_guard<recursive_mutex> lock (m_mutex);
-  auto i = m_recordings.find (id);
-  if (i == m_recordings.end ())
-    return PVR_ERROR_SERVER_ERROR;
+  {
+    SharedMutex::Shared lock (m_pvr);
+    if (m_recordings.count (id) == 0)
+      return PVR_ERROR_SERVER_ERROR;
+  }
 
   // Payload.
   json d = {{"name", name}, {"subname", subname}};
@@ -1583,8 +2098,13 @@ PVR_ERROR Freebox::RenameRecording (const kodi::addon::PVRRecording & recording)
     return PVR_ERROR_SERVER_ERROR;
 
   // Update recording (locally).
-  i->second = Recording (result);
-  TriggerRecordingUpdate ();
+  {
+    SharedMutex::Unique lock (m_pvr);
+    m_recordings.erase (id);
+    m_recordings.emplace (id, Recording (result));
+  }
+
+  NotifyRecordings ();
 
   return PVR_ERROR_NO_ERROR;
 }
@@ -1595,18 +2115,23 @@ PVR_ERROR Freebox::DeleteRecording (const kodi::addon::PVRRecording & recording)
 
   int id = stoi (recording.GetRecordingId ());
 
-  lock_guard<recursive_mutex> lock (m_mutex);
-  auto i = m_recordings.find (id);
-  if (i == m_recordings.end ())
-    return PVR_ERROR_SERVER_ERROR;
+  {
+    SharedMutex::Shared lock (m_pvr);
+    if (m_recordings.count (id) == 0)
+      return PVR_ERROR_SERVER_ERROR;
+  }
 
   // Delete recording (Freebox).
   if (! HttpDelete ("/api/v6/pvr/finished/" + to_string (id)))
     return PVR_ERROR_SERVER_ERROR;
 
   // Delete recording (locally).
-  m_recordings.erase (i);
-  TriggerRecordingUpdate ();
+  {
+    SharedMutex::Unique lock (m_pvr);
+    m_recordings.erase (id);
+  }
+
+  NotifyRecordings ();
 
   return PVR_ERROR_NO_ERROR;
 }
@@ -1615,93 +2140,79 @@ PVR_ERROR Freebox::DeleteRecording (const kodi::addon::PVRRecording & recording)
 // T I M E R S /////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
-Freebox::Generator::Generator (const json & g) :
-  id               (g.value ("id", -1)),
-//type             (g.value ("type", "")),
-  media            (g.value ("media", "")),
-  path             (g.value ("path", "")),
-  name             (g.value ("name", "")),
-//subname          (g.value ("name", "")),
-  channel_uuid     (g.value ("/params/channel_uuid"_json_pointer, "")),
-//channel_type     (g.value ("/params/channel_type"_json_pointer, "")),
-//channel_quality  (g.value ("/params/channel_quality"_json_pointer, "")),
-//channel_strict   (g.value ("/params/channel_strict"_json_pointer, ""))
-//broadcast_type   (g.value ("/params/broadcast_type"_json_pointer, ""))
-  start_hour       (g.value ("/params/start_hour"_json_pointer, 0)),
-  start_min        (g.value ("/params/start_min"_json_pointer, 0)),
-  duration         (g.value ("/params/duration"_json_pointer, 0)),
-  margin_before    (g.value ("/params/margin_before"_json_pointer, 0)),
-  margin_after     (g.value ("/params/margin_after"_json_pointer, 0)),
-  repeat_monday    (g.value ("/params/repeat_days/monday"_json_pointer, false)),
-  repeat_tuesday   (g.value ("/params/repeat_days/tuesday"_json_pointer, false)),
-  repeat_wednesday (g.value ("/params/repeat_days/wednesday"_json_pointer, false)),
-  repeat_thursday  (g.value ("/params/repeat_days/thursday"_json_pointer, false)),
-  repeat_friday    (g.value ("/params/repeat_days/friday"_json_pointer, false)),
-  repeat_saturday  (g.value ("/params/repeat_days/saturday"_json_pointer, false)),
-  repeat_sunday    (g.value ("/params/repeat_days/sunday"_json_pointer,  false))
-{
-}
-
-void Freebox::ProcessGenerators ()
-{
-  m_generators.clear ();
+bool Freebox::ProcessGenerators ()
+{
+  lock_guard<mutex> refresh (m_refresh_generators);
 
+  bool same = false;
   json generators;
-  if (HttpGet ("/api/v6/pvr/generator/", &generators, json::value_t::array))
+  if (! HttpGet ("/api/v6/pvr/generator/", &generators, json::value_t::array, &same) || same)
+    return false;
+
+  map<int, Generator> next;
+  for (auto & g : generators)
   {
-    for (auto & g : generators)
-    {
-      int        id = g.value ("id", -1);
-      int unique_id = m_unique_id ("generator/" + to_string (id));
-      m_generators.emplace (unique_id, Generator (g));
-    }
+    int        id = g.value ("id", -1);
+    int unique_id = m_unique_id ("generator/" + to_string (id));
+    next.emplace (unique_id, Generator (g));
+  }
+
+  // Kodi only hears about actual changes.
+  {
+    SharedMutex::Unique lock (m_pvr);
+    if (next == m_generators)
+      return false;
 
-    TriggerTimerUpdate ();
+    m_generators.swap (next);
   }
-}
 
-Freebox::Timer::Timer (const json & t) :
-  id             (t.value ("id", -1)),
-  start          (t.value ("start", 0)),
-  end            (t.value ("end", 0)),
-  margin_before  (t.value ("margin_before", 0)),
-  margin_after   (t.value ("margin_after", 0)),
-  name           (t.value ("name", "")),
-  subname        (t.value ("subname", "")),
-  channel_uuid   (t.value ("channel_uuid", "")),
-  channel_name   (t.value ("channel_name", "")),
-//channel_type   (t.value ("channel_type", "")),
-//broadcast_type (t.value ("broadcast_type", "")),
-  media          (t.value ("media", "")),
-  path           (t.value ("path", "")),
-  has_record_gen (t.value ("has_record_gen", false)),
-  record_gen_id  (t.value ("record_gen_id", 0)),
-  enabled        (t.value ("enabled", false)),
-  conflict       (t.value ("conflict", false)),
-  state          (t.value ("state", "disabled")),
-  error          (t.value ("error", "none"))
-{
+  NotifyTimers ();
+  return true;
 }
 
-void Freebox::ProcessTimers ()
+bool Freebox::ProcessTimers ()
 {
-  m_timers.clear ();
+  lock_guard<mutex> refresh (m_refresh_timers);
 
+  bool same = false;
   json timers;
-  if (HttpGet ("/api/v6/pvr/programmed/", &timers, json::value_t::array))
+  if (! HttpGet ("/api/v6/pvr/programmed/", &timers, json::value_t::array, &same) || same)
+    return false;
+
+  map<int, Timer> next;
+  for (auto & t : timers)
   {
-    for (auto & t : timers)
-    {
-      int        id = t.value ("id", -1);
-      int unique_id = m_unique_id ("programmed/" + to_string (id));
+    int        id = t.value ("id", -1);
+    int unique_id = m_unique_id ("programmed/" + to_string (id));
 
-      const string & state = t.value ("state", "disabled");
-      if (state != "finished" && state != "failed" && state != "start_error" && state != "running_error")
-        m_timers.emplace (unique_id, Timer (t));
-    }
+    const string & state = t.value ("state", "disabled");
+    if (state != "finished" && state != "failed" && state != "start_error" && state != "running_error")
+      next.emplace (unique_id, Timer (t));
+  }
 
-    TriggerTimerUpdate ();
+  // Kodi only hears about actual changes.
+  {
+    SharedMutex::Unique lock (m_pvr);
+    if (next == m_timers)
+      return false;
+
+    m_timers.swap (next);
   }
+
+  NotifyTimers ();
+  return true;
+}
+
+void Freebox::NotifyTimers ()
+{
+  ++m_timer_updates;
+  TriggerTimerUpdate ();
+}
+
+void Freebox::NotifyRecordings ()
+{
+  ++m_recording_updates;
+  TriggerRecordingUpdate ();
 }
 
 PVR_ERROR Freebox::GetTimerTypes (std::vector<kodi::addon::PVRTimerType> & types)
@@ -1773,14 +2284,15 @@ PVR_ERROR Freebox::GetTimerTypes (std::vector<kodi::addon::PVRTimerType> & types
 
 PVR_ERROR Freebox::GetTimersAmount (int & amount)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Shared lock (m_pvr);
   amount = m_generators.size () + m_timers.size ();
   return PVR_ERROR_NO_ERROR;
 }
 
 PVR_ERROR Freebox::GetTimers (kodi::addon::PVRTimersResultSet & results)
 {
-  lock_guard<recursive_mutex> lock (m_mutex);
+  SharedMutex::Shared lock (m_pvr);
+  ++m_timer_queries;
   //cout << "Freebox::GetTimers" << endl;
 
 #if __cplusplus >= 201703L
@@ -1916,7 +2428,6 @@ PVR_ERROR Freebox::AddTimer (const kodi::addon::PVRTimer & timer)
   string channel_uuid = "uuid-webtv-" + to_string (channel);
   string title        = timer.GetTitle ();
 
-  lock_guard<recursive_mutex> lock (m_mutex);
   switch (type)
   {
     case PVR_FREEBOX_TIMER_MANUAL :
@@ -1963,8 +2474,12 @@ PVR_ERROR Freebox::AddTimer (const kodi::addon::PVRTimer & timer)
       // Add timer (locally).
       int id     = result.value ("id", -1);
       int unique = m_unique_id ("programmed/" + to_string (id));
-      m_timers.emplace (unique, Timer (result));
-      TriggerTimerUpdate ();
+      {
+        SharedMutex::Unique lock (m_pvr);
+        m_timers.emplace (unique, Timer (result));
+      }
+
+      NotifyTimers ();
 
       // Update recordings if timer is running.
       string state = result.value ("state", "disabled");
@@ -1991,10 +2506,13 @@ PVR_ERROR Freebox::AddTimer (const kodi::addon::PVRTimer & timer)
       // Add generator (locally).
       int id     = result.value ("id", -1);
       int unique = m_unique_id ("generator/" + to_string (id));
-      m_generators.emplace (unique, Generator (result));
+      {
+        SharedMutex::Unique lock (m_pvr);
+        m_generators.emplace (unique, Generator (result));
+      }
 
-      // Reload timers.
-      ProcessTimers ();
+      // Reload timers (Kodi must hear about the generator anyway).
+      if (! ProcessTimers ()) NotifyTimers ();
       // Reload recordings.
       ProcessRecordings ();
 
@@ -2022,12 +2540,15 @@ PVR_ERROR Freebox::UpdateTimer (const kodi::addon::PVRTimer& timer)
     case PVR_FREEBOX_TIMER_MANUAL :
     case PVR_FREEBOX_TIMER_EPG :
     {
-      lock_guard<recursive_mutex> lock (m_mutex);
-      auto i = m_timers.find (timer.GetClientIndex ());
-      if (i == m_timers.end ())
-        return PVR_ERROR_SERVER_ERROR;
+      int id;
+      {
+        SharedMutex::Shared lock (m_pvr);
+        auto i = m_timers.find (timer.GetClientIndex ());
+        if (i == m_timers.end ())
+          return PVR_ERROR_SERVER_ERROR;
 
-      int id = i->second.id;
+        id = i->second.id;
+      }
       //cout << "UpdateTimer: TIMER[" << type << "]: " << timer.iClientIndex << " > " << id << endl;
 
       string channel_uuid = "uuid-webtv-" + to_string (timer.GetClientChannelUid ());
@@ -2056,21 +2577,28 @@ PVR_ERROR Freebox::UpdateTimer (const kodi::addon::PVRTimer& timer)
         return PVR_ERROR_SERVER_ERROR;
 
       // Update timer (locally).
-      i->second = Timer (result);
-      //cout << "UpdateTimer: TIMER[" << type << "]: '" << i->second.state << "'" << endl;
-      TriggerTimerUpdate ();
+      {
+        SharedMutex::Unique lock (m_pvr);
+        auto i = m_timers.find (timer.GetClientIndex ());
+        if (i != m_timers.end ()) i->second = Timer (result);
+      }
+
+      NotifyTimers ();
 
       break;
     }
 
     case PVR_FREEBOX_TIMER_GENERATED :
     {
-      lock_guard<recursive_mutex> lock (m_mutex);
-      auto i = m_timers.find (timer.GetClientIndex ());
-      if (i == m_timers.end ())
-        return PVR_ERROR_SERVER_ERROR;
+      int id;
+      {
+        SharedMutex::Shared lock (m_pvr);
+        auto i = m_timers.find (timer.GetClientIndex ());
+        if (i == m_timers.end ())
+          return PVR_ERROR_SERVER_ERROR;
 
-      int id = i->second.id;
+        id = i->second.id;
+      }
       //cout << "UpdateTimer: TIMER_GENERATED: " << timer.iClientIndex << " > " << id << endl;
 
       // Payload.
@@ -2082,9 +2610,13 @@ PVR_ERROR Freebox::UpdateTimer (const kodi::addon::PVRTimer& timer)
         return PVR_ERROR_SERVER_ERROR;
 
       // Update generated timer (locally).
-      i->second = Timer (result);
-      //cout << "UpdateTimer: TIMER_GENERATED: '" << i->second.state << "'" << endl;
-      TriggerTimerUpdate ();
+      {
+        SharedMutex::Unique lock (m_pvr);
+        auto i = m_timers.find (timer.GetClientIndex ());
+        if (i != m_timers.end ()) i->second = Timer (result);
+      }
+
+      NotifyTimers ();
 
       break;
     }
@@ -2092,12 +2624,15 @@ PVR_ERROR Freebox::UpdateTimer (const kodi::addon::PVRTimer& timer)
     case PVR_FREEBOX_GENERATOR_MANUAL :
     case PVR_FREEBOX_GENERATOR_EPG :
     {
-      lock_guard<recursive_mutex> lock (m_mutex);
-      auto i = m_generators.find (timer.GetClientIndex ());
-      if (i == m_generators.end ())
-        return PVR_ERROR_SERVER_ERROR;
+      int id;
+      {
+        SharedMutex::Shared lock (m_pvr);
+        auto i = m_generators.find (timer.GetClientIndex ());
+        if (i == m_generators.end ())
+          return PVR_ERROR_SERVER_ERROR;
 
-      int id = i->second.id;
+        id = i->second.id;
+      }
       //cout << "UpdateTimer: GENERATOR[" << type << "]: " << timer.iClientIndex << " > " << id << endl;
 
       // Payload.
@@ -2109,8 +2644,13 @@ PVR_ERROR Freebox::UpdateTimer (const kodi::addon::PVRTimer& timer)
         return PVR_ERROR_SERVER_ERROR;
 
       // Update generator (locally).
-      i->second = Generator (result);
-      ProcessTimers ();
+      {
+        SharedMutex::Unique lock (m_pvr);
+        auto i = m_generators.find (timer.GetClientIndex ());
+        if (i != m_generators.end ()) i->second = Generator (result);
+      }
+
+      if (! ProcessTimers ()) NotifyTimers ();
       ProcessRecordings ();
 
       break;
@@ -2137,12 +2677,15 @@ PVR_ERROR Freebox::DeleteTimer (const kodi::addon::PVRTimer & timer, bool force)
     case PVR_FREEBOX_TIMER_MANUAL :
     case PVR_FREEBOX_TIMER_EPG :
     {
-      lock_guard<recursive_mutex> lock (m_mutex);
-      auto i = m_timers.find (timer.GetClientIndex ());
-      if (i == m_timers.end ())
-        return PVR_ERROR_SERVER_ERROR;
+      int id;
+      {
+        SharedMutex::Shared lock (m_pvr);
+        auto i = m_timers.find (timer.GetClientIndex ());
+        if (i == m_timers.end ())
+          return PVR_ERROR_SERVER_ERROR;
 
-      int id = i->second.id;
+        id = i->second.id;
+      }
       //cout << "DeleteTimer: TIMER[" << type << "]: " << timer.iClientIndex << " > " << id << endl;
 
       // Delete timer (Freebox).
@@ -2150,8 +2693,12 @@ PVR_ERROR Freebox::DeleteTimer (const kodi::addon::PVRTimer & timer, bool force)
         return PVR_ERROR_SERVER_ERROR;
 
       // Delete timer (locally).
-      m_timers.erase (i);
-      TriggerTimerUpdate ();
+      {
+        SharedMutex::Unique lock (m_pvr);
+        m_timers.erase (timer.GetClientIndex ());
+      }
+
+      NotifyTimers ();
 
       // Update recordings if timer was running.
       if (timer.GetState () == PVR_TIMER_STATE_RECORDING)
@@ -2163,28 +2710,36 @@ PVR_ERROR Freebox::DeleteTimer (const kodi::addon::PVRTimer & timer, bool force)
     case PVR_FREEBOX_GENERATOR_MANUAL :
     case PVR_FREEBOX_GENERATOR_EPG :
     {
-      lock_guard<recursive_mutex> lock (m_mutex);
-      auto i = m_generators.find (timer.GetClientIndex ());
-      if (i == m_generators.end ())
-        return PVR_ERROR_SERVER_ERROR;
+      int id;
+      {
+        SharedMutex::Shared lock (m_pvr);
+        auto i = m_generators.find (timer.GetClientIndex ());
+        if (i == m_generators.end ())
+          return PVR_ERROR_SERVER_ERROR;
 
-      int id = i->second.id;
+        id = i->second.id;
+      }
       //cout << "DeleteTimer: GENERATOR[" << type << "]: " << timer.GetClientIndex () << " > " << id << endl;
 
       // Delete generator (Freebox).
       if (! HttpDelete ("/api/v6/pvr/generator/" + to_string (id)))
         return PVR_ERROR_SERVER_ERROR;
 
-      // Delete generated timers (locally).
-      for (auto i = m_timers.begin (); i != m_timers.end ();)
-        if (i->second.record_gen_id == id)
-          i = m_timers.erase (i);
-        else
-          ++i;
+      {
+        SharedMutex::Unique lock (m_pvr);
+
+        // Delete generated timers (locally).
+        for (auto i = m_timers.begin (); i != m_timers.end ();)
+          if (i->second.record_gen_id == id)
+            i = m_timers.erase (i);
+          else
+            ++i;
+
+        // Delete generator (locally).
+        m_generators.erase (timer.GetClientIndex ());
+      }
 
-      // Delete generator (locally).
-      m_generators.erase (i);
-      TriggerTimerUpdate ();
+      NotifyTimers ();
 
       break;
     }
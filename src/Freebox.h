@@ -22,11 +22,14 @@
 
 #include <set>
 #include <map>
-#include <queue>
+#include <atomic>
+#include <memory>
 #include <algorithm> // find_if
 #include <nlohmann/json.hpp>
 #include "kodi/addon-instance/PVR.h"
 #include "kodi/tools/Thread.h"
+#include "Core.h"
+#include "Http.h"
 
 #define PVR_FREEBOX_VERSION STR(FREEBOX_VERSION)
 
@@ -54,282 +57,28 @@
 #define PVR_FREEBOX_STRING_CHANNEL_QUALITY_LD   30018
 #define PVR_FREEBOX_STRING_CHANNEL_QUALITY_3D   30019
 
-#define PVR_FREEBOX_DEFAULT_HOSTNAME "mafreebox.freebox.fr"
-#define PVR_FREEBOX_DEFAULT_NETBIOS  "FREEBOX"
-#define PVR_FREEBOX_DEFAULT_DELAY    10
-#define PVR_FREEBOX_DEFAULT_SOURCE   Source::IPTV
-#define PVR_FREEBOX_DEFAULT_QUALITY  Quality::HD
-#define PVR_FREEBOX_DEFAULT_PROTOCOL Protocol::RTSP
-#define PVR_FREEBOX_DEFAULT_EXTENDED false
-#define PVR_FREEBOX_DEFAULT_COLORS   false
-
-template <class K>
-class Index
-{
-  private:
-    int              m_id;
-    std::map<K, int> m_map;
-
-  public:
-    inline
-    Index (int first = 0) :
-      m_id (first),
-      m_map ()
-    {
-    }
-
-    inline
-    int operator() (const K & key)
-    {
-#if __cplusplus >= 201703L
-      auto [i, success] = m_map.emplace (key, m_id);
-      return success ? m_id++ : i->second;
-#else
-      auto r = m_map.emplace (key, m_id);
-      return r.second ? m_id++ : r.first->second;
-#endif
-    }
-};
-
+#define PVR_FREEBOX_DEFAULT_HOSTNAME     "mafreebox.freebox.fr"
+#define PVR_FREEBOX_DEFAULT_NETBIOS      "FREEBOX"
+#define PVR_FREEBOX_DEFAULT_DELAY        10
+#define PVR_FREEBOX_DEFAULT_CONNECTIONS  4
+#define PVR_FREEBOX_DEFAULT_CONCURRENCY  2
+#define PVR_FREEBOX_DEFAULT_RATE         2
+#define PVR_FREEBOX_DEFAULT_COMPRESSION  true
+#define PVR_FREEBOX_DEFAULT_NOTIFICATIONS false
+#define PVR_FREEBOX_DEFAULT_PROBE        false
+#define PVR_FREEBOX_DEFAULT_SOURCE       Source::IPTV
+#define PVR_FREEBOX_DEFAULT_QUALITY      Quality::HD
+#define PVR_FREEBOX_DEFAULT_PROTOCOL     Protocol::RTSP
+#define PVR_FREEBOX_DEFAULT_EXTENDED     false
+#define PVR_FREEBOX_DEFAULT_COLORS       false
+
+// Kodi adapter over the core.
 class ATTR_DLL_LOCAL Freebox :
+  public Core,
   public kodi::addon::CAddonBase,
   public kodi::addon::CInstancePVRClient,
   public kodi::tools::CThread
 {
-  protected:
-    inline static unsigned int ChannelId (const std::string & uuid)
-    {
-      return std::stoi (uuid.substr (11)); // uuid-webtv-*
-    }
-
-    inline static unsigned int BroadcastId (const std::string & uuid)
-    {
-      return std::stoi (uuid.substr (6)); // pluri_*
-    }
-
-    // Channel source.
-    enum class Source {DEFAULT = -1, AUTO = 0, IPTV = 1, DVB = 2};
-
-    // Channel quality.
-    enum class Quality {DEFAULT = -1, AUTO = 0, HD = 1, SD = 2, LD = 3, STEREO = 4};
-
-    // Streaming protocol.
-    enum class Protocol {DEFAULT = -1, RTSP = 1, HLS = 2};
-
-    class Stream
-    {
-      public:
-        enum Source  source;
-        enum Quality quality;
-        std::string  rtsp;
-        std::string  hls;
-
-      protected:
-        int score (enum Source)  const;
-        int score (enum Quality) const;
-
-      public:
-        Stream (enum Source,
-                enum Quality,
-                const std::string & rtsp,
-                const std::string & hls);
-        int score (enum Source, enum Quality) const;
-    };
-
-    class Channel
-    {
-      public:
-        typedef std::map<enum Quality, std::string> Streams;
-
-      public:
-        bool                radio;
-        std::string         uuid;
-        std::string         name;
-        std::string         logo;
-        int                 major;
-        int                 minor;
-        std::vector<Stream> streams;
-
-      public:
-        Channel (const std::string & uuid,
-                 const std::string & name,
-                 const std::string & logo,
-                 int major, int minor,
-                 const std::vector<Stream> &);
-
-        bool IsHidden () const;
-        void GetChannel (kodi::addon::PVRChannelsResultSet & results, bool radio) const;
-        PVR_ERROR GetStreamProperties (enum Source, enum Quality, enum Protocol,
-                                       std::vector<kodi::addon::PVRStreamProperty> & properties) const;
-    };
-
-    // Query types.
-    enum QueryType {NONE = 0, FULL = 1, CHANNEL = 2, EVENT = 3};
-
-    class Query
-    {
-      public:
-        QueryType    type;
-        std::string  query;
-        unsigned int channel;
-        time_t       date;
-
-      public:
-        Query () : type (NONE) {}
-
-        Query (QueryType t,
-               const std::string & q,
-               unsigned int c = 0,
-               time_t d = 0) :
-          type (t),
-          query (q),
-          channel (c),
-          date (d)
-        {
-        }
-    };
-
-    // EPG events.
-    class Event
-    {
-      public:
-        static std::string Native (int);
-        static int         Colors (int);
-
-      public:
-        class CastMember
-        {
-          public:
-            std::string job;
-            std::string first_name;
-            std::string last_name;
-            std::string role;
-
-          public:
-            CastMember (const nlohmann::json &);
-        };
-
-        typedef std::vector<CastMember> Cast;
-
-      protected:
-        class ConcatIfJob
-        {
-          private:
-            std::string m_job;
-
-          public:
-            ConcatIfJob (const std::string & job);
-            std::string operator() (const std::string &, const Freebox::Event::CastMember &) const;
-        };
-
-      public:
-        unsigned int channel;
-        std::string  uuid;
-        time_t       date;
-        int          duration;
-        std::string  title;
-        std::string  subtitle;
-        int          season;
-        int          episode;
-        int          category;
-        std::string  picture;
-        std::string  plot;
-        std::string  outline;
-        int          year;
-        Cast         cast;
-
-      public:
-        Event (const nlohmann::json &, unsigned int channel, time_t date);
-        std::string GetCastDirector () const;
-        std::string GetCastActors   () const;
-    };
-
-    // Generator.
-    class Generator
-    {
-      public:
-        int          id;
-      //std::string  type;
-        std::string  media;
-        std::string  path;
-        std::string  name;
-      //std::string  subname;
-        std::string  channel_uuid;
-      //std::string  channel_type;
-      //std::string  channel_quality;
-      //bool         channel_strict;
-      //std::string  broadcast_type;
-        unsigned int start_hour;
-        unsigned int start_min;
-      //unsigned int start_sec;
-        unsigned int duration;
-        unsigned int margin_before;
-        unsigned int margin_after;
-        bool         repeat_monday;
-        bool         repeat_tuesday;
-        bool         repeat_wednesday;
-        bool         repeat_thursday;
-        bool         repeat_friday;
-        bool         repeat_saturday;
-        bool         repeat_sunday;
-
-      public:
-        Generator (const nlohmann::json &);
-    };
-
-    // Timer.
-    class Timer
-    {
-      public:
-        int          id;
-        time_t       start;
-        time_t       end;
-        unsigned int margin_before;
-        unsigned int margin_after;
-        std::string  name;
-        std::string  subname;
-        std::string  channel_uuid;
-        std::string  channel_name;
-      //std::string  channel_type;
-      //std::string  channel_quality;
-      //std::string  broadcast_type;
-        std::string  media;
-        std::string  path;
-        bool         has_record_gen;
-        int          record_gen_id;
-        bool         enabled;
-        bool         conflict;
-        std::string  state;
-        std::string  error;
-
-      public:
-        Timer (const nlohmann::json &);
-    };
-
-    // Recording.
-    class Recording
-    {
-      public:
-        int          id;
-        time_t       start;
-        time_t       end;
-        std::string  name;
-        std::string  subname;
-        std::string  channel_uuid;
-        std::string  channel_name;
-      //std::string  channel_type;
-      //std::string  channel_quality;
-      //std::string  broadcast_type;
-        std::string  media;
-        std::string  path;
-        std::string  filename;
-        int          byte_size;
-        bool         secure;
-
-      public:
-        Recording (const nlohmann::json &);
-    };
-
   public:
     Freebox ();
     virtual ~Freebox ();
@@ -377,6 +126,10 @@ class ATTR_DLL_LOCAL Freebox :
     // M E N U / H O O K S /////////////////////////////////////////////////////
     PVR_ERROR CallChannelMenuHook (const kodi::addon::PVRMenuhook &, const kodi::addon::PVRChannel &) override;
 
+  protected:
+    // Current channel list (thread-safe).
+    std::shared_ptr<const Channels> TvChannels () const;
+
   protected:
     void Process () override;
 
@@ -404,16 +157,29 @@ class ATTR_DLL_LOCAL Freebox :
     void SetColors (bool);
     // Delay setting.
     void SetDelay (int);
+    // Connections per host.
+    void SetConnections (int);
+    // Maximum request budget (requests/sec).
+    void SetRate (int);
+    // HTTP compression.
+    void SetCompression (bool);
+    // Push notifications (websocket).
+    void SetNotifications (bool);
+    // Stream probes (start latency).
+    void SetProbe (bool);
 
     // H T T P /////////////////////////////////////////////////////////////////
+    // With "same", unchanged bodies are not parsed (*same = true).
     bool Http       (const std::string & custom,
                      const std::string & url,
                      const nlohmann::json &,
                      nlohmann::json *,
-                     nlohmann::json::value_t = nlohmann::json::value_t::object) const;
+                     nlohmann::json::value_t = nlohmann::json::value_t::object,
+                     bool * same = nullptr) const;
     bool HttpGet    (const std::string & url,
                      nlohmann::json *,
-                     nlohmann::json::value_t = nlohmann::json::value_t::object) const;
+                     nlohmann::json::value_t = nlohmann::json::value_t::object,
+                     bool * same = nullptr) const;
     bool HttpPost   (const std::string & url,
                      const nlohmann::json &,
                      nlohmann::json *,
@@ -423,6 +189,13 @@ class ATTR_DLL_LOCAL Freebox :
                      nlohmann::json *,
                      nlohmann::json::value_t = nlohmann::json::value_t::object) const;
     bool HttpDelete (const std::string & url) const;
+    // Streamed response (status code, or -1).
+    long HttpStream (const std::string & custom,
+                     const std::string & url,
+                     const nlohmann::json &,
+                     const HttpPool::Reader &) const;
+    // EPG page, buffered then parsed (SAX) unless the same as last time.
+    bool HttpGet    (const std::string & url, EpgParser *, bool * same) const;
 
     // Session.
     bool StartSession ();
@@ -430,18 +203,55 @@ class ATTR_DLL_LOCAL Freebox :
 
     // Process JSON channels.
     bool ProcessChannels ();
+    // Swap the channel list, if different.
+    bool PublishChannels (std::shared_ptr<const Channels>, const char * origin);
+
+    // Channel list cache (on disk).
+    bool ReadChannelCache  ();
+    void WriteChannelCache (const Channels &);
+    // Channel preferences (on disk).
+    void ReadPreferences ();
+    // Stream latencies (on disk).
+    void WriteLatencies ();
 
     // Process JSON EPG.
-    void ProcessFull    (const nlohmann::json & epg);
+    void ProcessFull    (const std::string & query, time_t hour);
     void ProcessChannel (const nlohmann::json & epg, unsigned int channel);
-    void ProcessEvent   (const nlohmann::json & epg, unsigned int channel, time_t, EPG_EVENT_STATE);
+    void ProcessChannelEvent (const Event &);
+    void ProcessEvent   (const nlohmann::json & epg, unsigned int channel, time_t, EPG_EVENT_STATE, bool detail = false);
 
     // If /api/v6/tv/epg/programs/* queries had a "date", things would be *way* easier!
-    void ProcessEvent   (const Event &, EPG_EVENT_STATE);
-
-    void ProcessGenerators ();
-    void ProcessTimers     ();
-    void ProcessRecordings ();
+    // Details (extended EPG) fill known events in: not counted as changes.
+    void ProcessEvent   (const Event &, EPG_EVENT_STATE, bool detail = false);
+    kodi::addon::PVREPGTag EpgTag (const Event &) const;
+
+    // EPG cache (on disk).
+    void ReadEpgCache  ();
+    void WriteEpgCache ();
+
+    // Process EPG queries.
+    void ProcessQueries ();
+    void ProcessQuery   (const Query &);
+    // Current hour of a channel, urgently (capped unless tuned).
+    void RequestChannel (unsigned int id, bool tuned);
+
+    // Refresh from the Freebox (true if Kodi was notified).
+    bool ProcessGenerators ();
+    bool ProcessTimers     ();
+    bool ProcessRecordings ();
+
+    // Trigger Kodi (counted).
+    void NotifyTimers     ();
+    void NotifyRecordings ();
+
+    // Freebox OS notifications (websocket), polling when down.
+    bool OpenNotifications    (WebSocket *);
+    void ProcessNotifications ();
+    // Stream probes, in the background.
+    void ProcessProbes ();
+    // Fastest healthy stream for AUTO (-1 if none measured), settings locked.
+    int FastestStream (const Channel &, enum Source, enum Quality, enum Protocol) const;
+    void ProcessNotification  (const nlohmann::json &);
 
     // Channel preferences.
     enum Source  ChannelSource  (unsigned int id, bool fallback = true);
@@ -450,25 +260,28 @@ class ATTR_DLL_LOCAL Freebox :
     void SetChannelQuality (unsigned int id, enum Quality);
 
   protected:
-    static enum Source   ParseSource   (const std::string &);
-    static enum Quality  ParseQuality  (const std::string &);
-    static enum Protocol ParseProtocol (const std::string &);
-
-    static std::string StrSource   (enum Source);
-    static std::string StrQuality  (enum Quality);
-    static std::string StrProtocol (enum Protocol);
-
     static enum Source  DialogSource  (enum Source  selected =  Source::DEFAULT);
     static enum Quality DialogQuality (enum Quality selected = Quality::DEFAULT);
 
-    static std::string Password (const std::string & token, const std::string & challenge);
-
   protected:
     // Full URL (protocol + server + query).
     std::string URL (const std::string & query) const;
 
   private:
-    mutable std::recursive_mutex m_mutex;
+    // One lock per domain, never nested, never held across a request:
+    // settings (incl. channel prefs), session, EPG, and PVR (recordings, timers).
+    // Logins and PVR refreshes are serialized by their own mutexes instead.
+    mutable SharedMutex m_settings;
+    mutable SharedMutex m_session;
+    mutable SharedMutex m_epg;
+    mutable SharedMutex m_pvr;
+    // Serializes logins.
+    std::mutex m_login;
+    // Serialize each PVR refresh (fetch, digest, swap), held across the request:
+    // an older list can't be installed after a newer one.
+    std::mutex m_refresh_generators;
+    std::mutex m_refresh_timers;
+    std::mutex m_refresh_recordings;
     // Add-on path.
     std::string m_path;
     // Freebox Server.
@@ -476,23 +289,56 @@ class ATTR_DLL_LOCAL Freebox :
     std::string m_netbios  = PVR_FREEBOX_DEFAULT_NETBIOS;
     // Delay between queries.
     int m_delay = PVR_FREEBOX_DEFAULT_DELAY;
+    // HTTP connections (thread-safe).
+    mutable HttpPool m_http;
+    // EPG requests in flight.
+    int m_concurrency = PVR_FREEBOX_DEFAULT_CONCURRENCY;
+    // EPG request budget: adaptive, between 1/m_delay and m_rate (thread-safe).
+    int m_rate = PVR_FREEBOX_DEFAULT_RATE;
+    mutable HttpThrottle m_throttle;
+    // Hashes of the last responses (thread-safe).
+    mutable Digests m_digests;
+    // Push notifications: enabled, and connected with a known one received.
+    std::atomic<bool> m_notifications {PVR_FREEBOX_DEFAULT_NOTIFICATIONS};
+    std::atomic<bool> m_notifications_live {false};
     // Freebox OS //////////////////////////////////////////////////////////////
     std::string m_app_token;
     int m_track_id;
     std::string m_session_token;
     // TV //////////////////////////////////////////////////////////////////////
-    std::map<unsigned int, Channel> m_tv_channels;
+    // Immutable, swapped as a whole: read without locking (see TvChannels).
+    std::shared_ptr<const Channels> m_tv_channels;
+    // Time to first channel.
+    HttpPool::Clock::time_point m_created;
+    std::atomic<bool> m_tv_ready {false};
     enum Source   m_tv_source;
     enum Quality  m_tv_quality;
     enum Protocol m_tv_protocol;
     std::map<unsigned int, enum Source>  m_tv_prefs_source;
     std::map<unsigned int, enum Quality> m_tv_prefs_quality;
+    // Stream probes: enabled, and latencies (by URL).
+    std::atomic<bool> m_probe {PVR_FREEBOX_DEFAULT_PROBE};
+    std::map<std::string, Latency> m_tv_latency;
     // EPG /////////////////////////////////////////////////////////////////////
-    std::queue<Query> m_epg_queries;
-    std::set<std::string> m_epg_cache;
+    Queries m_epg_queries;
+    int m_epg_pending;
+    // Fingerprints of the events sent to Kodi (until they end).
+    BroadcastMap m_epg_cache;
+    // Events sent to Kodi (channel > date > event).
+    std::map<unsigned int, std::map<time_t, Event>> m_epg_events;
+    bool m_epg_restored;
+    // Events sent to Kodi during the sweep (created, updated, deleted), and details filled in.
+    size_t m_epg_changes [3];
+    size_t m_epg_details;
     int m_epg_days_past;
     int m_epg_days_future;
-    time_t m_epg_last;
+    // Fetch dates (hour × channel).
+    Coverage m_epg_coverage;
+    // Channels queued on demand.
+    std::set<unsigned int> m_epg_requested;
+    // Time to complete guide.
+    time_t m_epg_sweep;
+    size_t m_epg_sweep_queries;
     bool m_epg_extended = PVR_FREEBOX_DEFAULT_EXTENDED;
     bool m_epg_colors   = PVR_FREEBOX_DEFAULT_COLORS;
     // Recordings //////////////////////////////////////////////////////////////
@@ -501,5 +347,10 @@ class ATTR_DLL_LOCAL Freebox :
     mutable Index<std::string> m_unique_id;
     std::map<int, Generator> m_generators;
     std::map<int, Timer> m_timers;
+    // Kodi callbacks (updates triggered, lists queried).
+    std::atomic<size_t> m_timer_updates;
+    std::atomic<size_t> m_timer_queries;
+    std::atomic<size_t> m_recording_updates;
+    std::atomic<size_t> m_recording_queries;
 };
 
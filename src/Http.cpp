@@ -0,0 +1,1370 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET freebox_socket;
+#define FREEBOX_INVALID_SOCKET INVALID_SOCKET
+#define freebox_close closesocket
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+typedef int freebox_socket;
+#define FREEBOX_INVALID_SOCKET (-1)
+#define freebox_close close
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#include "Http.h"
+#include "Zlib.h"
+
+#include "openssl/sha.h"
+
+using namespace std;
+
+#define HTTP_CONNECT_TIMEOUT  5 // seconds
+#define HTTP_IO_TIMEOUT      30 // seconds
+#define HTTP_IDLE_TIMEOUT    30 // seconds
+#define HTTP_LATENCIES     1024 // samples
+#define WS_MESSAGE_MAX  (1 << 20) // bytes
+#define PROBE_PLAYLIST_MAX (1 << 20) // bytes
+#define PROBE_SCAN_MAX     (4 << 20) // bytes scanned for a keyframe
+#define PROBE_MESSAGE_MAX  (1 << 16) // bytes (RTSP message between packets)
+
+inline string freebox_lower (string s)
+{
+  transform (s.begin (), s.end (), s.begin (), [] (unsigned char c) {return tolower (c);});
+  return s;
+}
+
+// http://host[:port]/path, rtsp://host[:port]/path
+inline bool freebox_parse_url (const string & url, string * host, string * port, string * target)
+{
+  static const string HTTP = "http://";
+  static const string RTSP = "rtsp://";
+
+  size_t begin;
+  string fallback;
+  if (url.compare (0, HTTP.length (), HTTP) == 0)
+    begin = HTTP.length (), fallback = "80";
+  else if (url.compare (0, RTSP.length (), RTSP) == 0)
+    begin = RTSP.length (), fallback = "554";
+  else
+    return false;
+
+  size_t slash = url.find ('/', begin);
+  string authority = url.substr (begin, slash - begin);
+  *target = slash != string::npos ? url.substr (slash) : "/";
+
+  size_t colon = authority.rfind (':');
+  if (colon != string::npos && authority.find (']', colon) == string::npos)
+  {
+    *host = authority.substr (0, colon);
+    *port = authority.substr (colon + 1);
+  }
+  else
+  {
+    *host = authority;
+    *port = fallback;
+  }
+
+  // IPv6 literal.
+  if (host->size () >= 2 && host->front () == '[' && host->back () == ']')
+    *host = host->substr (1, host->size () - 2);
+
+  return ! host->empty ();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// C O N N E C T I O N /////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+class HttpPool::Connection
+{
+  private:
+    freebox_socket    m_socket;
+    string            m_buffer;
+    Clock::time_point m_last;
+    Clock::time_point m_deadline;
+
+  protected:
+    bool Fill ();
+    // Receive timeout: what is left before the deadline, if any (false once past it).
+    bool Arm ();
+
+  public:
+    Connection ();
+    ~Connection ();
+
+    bool IsOpen () const {return m_socket != FREEBOX_INVALID_SOCKET;}
+    bool IsExpired () const {return Clock::now () - m_last > chrono::seconds (HTTP_IDLE_TIMEOUT);}
+    void Touch () {m_last = Clock::now ();}
+
+    bool Open (const string & host, const string & port);
+    void Close ();
+
+    bool Send (const string &);
+    bool ReadLine (string *);
+    size_t ReadSome (char *, size_t);
+    // Data available within the timeout (ms)?
+    bool Wait (int timeout);
+    // Reads fail past the deadline (instead of the I/O timeout).
+    void SetDeadline (Clock::time_point deadline) {m_deadline = deadline;}
+};
+
+HttpPool::Connection::Connection () :
+  m_socket (FREEBOX_INVALID_SOCKET),
+  m_buffer (),
+  m_last (Clock::now ()),
+  m_deadline (Clock::time_point::max ())
+{
+}
+
+HttpPool::Connection::~Connection ()
+{
+  Close ();
+}
+
+inline void freebox_blocking (freebox_socket s, bool blocking)
+{
+#ifdef _WIN32
+  u_long mode = blocking ? 0 : 1;
+  ioctlsocket (s, FIONBIO, &mode);
+#else
+  int flags = fcntl (s, F_GETFL, 0);
+  fcntl (s, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+#endif
+}
+
+inline bool freebox_connect (freebox_socket s, const sockaddr * address, socklen_t length)
+{
+  freebox_blocking (s, false);
+
+  if (connect (s, address, length) != 0)
+  {
+#ifdef _WIN32
+    if (WSAGetLastError () != WSAEWOULDBLOCK) return false;
+#else
+    if (errno != EINPROGRESS) return false;
+#endif
+
+    fd_set w; FD_ZERO (&w); FD_SET (s, &w);
+    timeval tv = {HTTP_CONNECT_TIMEOUT, 0};
+    if (select ((int) s + 1, nullptr, &w, nullptr, &tv) != 1) return false;
+
+    int error = 0; socklen_t size = sizeof (error);
+    if (getsockopt (s, SOL_SOCKET, SO_ERROR, (char *) &error, &size) != 0 || error != 0) return false;
+  }
+
+  freebox_blocking (s, true);
+  return true;
+}
+
+bool HttpPool::Connection::Open (const string & host, const string & port)
+{
+  Close ();
+
+  addrinfo hints;
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo * info = nullptr;
+  if (getaddrinfo (host.c_str (), port.c_str (), &hints, &info) != 0)
+    return false;
+
+  for (addrinfo * i = info; i != nullptr && ! IsOpen (); i = i->ai_next)
+  {
+    freebox_socket s = socket (i->ai_family, i->ai_socktype, i->ai_protocol);
+    if (s == FREEBOX_INVALID_SOCKET) continue;
+
+    if (freebox_connect (s, i->ai_addr, (socklen_t) i->ai_addrlen))
+      m_socket = s;
+    else
+      freebox_close (s);
+  }
+
+  freeaddrinfo (info);
+
+  if (! IsOpen ()) return false;
+
+#ifdef _WIN32
+  DWORD timeout = HTTP_IO_TIMEOUT * 1000;
+#else
+  timeval timeout = {HTTP_IO_TIMEOUT, 0};
+#endif
+  setsockopt (m_socket, SOL_SOCKET, SO_RCVTIMEO, (const char *) &timeout, sizeof (timeout));
+  setsockopt (m_socket, SOL_SOCKET, SO_SNDTIMEO, (const char *) &timeout, sizeof (timeout));
+
+  int one = 1;
+  setsockopt (m_socket, IPPROTO_TCP, TCP_NODELAY, (const char *) &one, sizeof (one));
+#ifdef SO_NOSIGPIPE
+  setsockopt (m_socket, SOL_SOCKET, SO_NOSIGPIPE, (const char *) &one, sizeof (one));
+#endif
+
+  Touch ();
+  return true;
+}
+
+void HttpPool::Connection::Close ()
+{
+  if (IsOpen ())
+  {
+    freebox_close (m_socket);
+    m_socket = FREEBOX_INVALID_SOCKET;
+  }
+
+  m_buffer.clear ();
+}
+
+bool HttpPool::Connection::Send (const string & data)
+{
+  for (size_t offset = 0; offset < data.size ();)
+  {
+    int n = send (m_socket, data.data () + offset, (int) (data.size () - offset), MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    offset += n;
+  }
+
+  return true;
+}
+
+bool HttpPool::Connection::Arm ()
+{
+  if (m_deadline == Clock::time_point::max ()) return true;
+
+  long long left = chrono::duration_cast<chrono::milliseconds> (m_deadline - Clock::now ()).count ();
+  if (left <= 0) return false;
+
+#ifdef _WIN32
+  DWORD timeout = (DWORD) left;
+#else
+  timeval timeout = {(time_t) (left / 1000), (suseconds_t) ((left % 1000) * 1000)};
+#endif
+  return setsockopt (m_socket, SOL_SOCKET, SO_RCVTIMEO, (const char *) &timeout, sizeof (timeout)) == 0;
+}
+
+bool HttpPool::Connection::Fill ()
+{
+  if (! Arm ()) return false;
+
+  char buffer [16384];
+  int n = recv (m_socket, buffer, sizeof (buffer), 0);
+  if (n <= 0) return false;
+  m_buffer.append (buffer, n);
+  return true;
+}
+
+bool HttpPool::Connection::ReadLine (string * line)
+{
+  size_t k;
+  while ((k = m_buffer.find ("\r\n")) == string::npos)
+    if (! Fill ()) return false;
+
+  line->assign (m_buffer, 0, k);
+  m_buffer.erase (0, k + 2);
+  return true;
+}
+
+bool HttpPool::Connection::Wait (int timeout)
+{
+  if (! m_buffer.empty ()) return true;
+
+  fd_set r; FD_ZERO (&r); FD_SET (m_socket, &r);
+  timeval tv = {timeout / 1000, (timeout % 1000) * 1000};
+  return select ((int) m_socket + 1, &r, nullptr, nullptr, &tv) == 1;
+}
+
+size_t HttpPool::Connection::ReadSome (char * data, size_t length)
+{
+  if (m_buffer.empty ())
+  {
+    if (! Arm ()) return 0;
+    int n = recv (m_socket, data, (int) length, 0);
+    return n > 0 ? n : 0;
+  }
+
+  size_t n = min (length, m_buffer.size ());
+  memcpy (data, m_buffer.data (), n);
+  m_buffer.erase (0, n);
+  return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// B O D Y /////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+// Response body, read from the connection as it arrives.
+class HttpPool::Body : public streambuf
+{
+  public:
+    enum Mode {EMPTY, LENGTH, CHUNKED, CLOSE};
+
+  private:
+    Connection & m_connection;
+    Mode         m_mode;
+    size_t       m_remaining; // in the body (LENGTH) or in the current chunk (CHUNKED)
+    bool         m_chunk;     // a chunk has been read (CHUNKED)
+    bool         m_complete;
+    bool         m_error;
+    size_t       m_received;
+    char         m_buffer [16384];
+
+  protected:
+    int_type underflow () override;
+    bool NextChunk ();
+
+  public:
+    Body (Connection &, Mode, size_t length = 0);
+
+    // Read (and discard) the rest of the body.
+    bool Drain ();
+
+    bool   IsComplete () const {return m_complete;}
+    bool   IsError    () const {return m_error;}
+    size_t Received   () const {return m_received;}
+};
+
+HttpPool::Body::Body (Connection & c, Mode mode, size_t length) :
+  m_connection (c),
+  m_mode (mode),
+  m_remaining (length),
+  m_chunk (false),
+  m_complete (mode == EMPTY || (mode == LENGTH && length == 0)),
+  m_error (false),
+  m_received (0)
+{
+  setg (m_buffer, m_buffer, m_buffer);
+}
+
+bool HttpPool::Body::NextChunk ()
+{
+  string line;
+
+  // CRLF after the previous chunk.
+  if (m_chunk && (! m_connection.ReadLine (&line) || ! line.empty ()))
+    return false;
+
+  if (! m_connection.ReadLine (&line))
+    return false;
+
+  m_chunk     = true;
+  m_remaining = strtoul (line.c_str (), nullptr, 16);
+
+  if (m_remaining == 0)
+  {
+    // Trailers.
+    do if (! m_connection.ReadLine (&line)) return false; while (! line.empty ());
+    m_complete = true;
+  }
+
+  return true;
+}
+
+HttpPool::Body::int_type HttpPool::Body::underflow ()
+{
+  if (gptr () < egptr ())
+    return traits_type::to_int_type (*gptr ());
+
+  if (m_complete || m_error)
+    return traits_type::eof ();
+
+  if (m_mode == CHUNKED && m_remaining == 0 && ! NextChunk ())
+  {
+    m_error = true;
+    return traits_type::eof ();
+  }
+
+  if (m_complete)
+    return traits_type::eof ();
+
+  size_t length = m_mode == CLOSE ? sizeof (m_buffer) : min (m_remaining, sizeof (m_buffer));
+  size_t n = m_connection.ReadSome (m_buffer, length);
+
+  if (n == 0)
+  {
+    if (m_mode == CLOSE)
+      m_complete = true;
+    else
+      m_error = true;
+
+    return traits_type::eof ();
+  }
+
+  m_received += n;
+
+  if (m_mode != CLOSE)
+  {
+    m_remaining -= n;
+    if (m_mode == LENGTH && m_remaining == 0)
+      m_complete = true;
+  }
+
+  setg (m_buffer, m_buffer, m_buffer + n);
+  return traits_type::to_int_type (*gptr ());
+}
+
+bool HttpPool::Body::Drain ()
+{
+  while (underflow () != traits_type::eof ())
+    setg (m_buffer, egptr (), egptr ());
+
+  return m_complete;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// P O O L /////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+string HttpPool::Stats::str () const
+{
+  ostringstream oss;
+  oss << fixed << setprecision (1)
+      << requests << " requests (" << failures << " failures), "
+      << connections << " connections, "
+      << reused << " reused, "
+      << received / 1024 << " KiB received (" << decoded / 1024 << " KiB decoded), "
+      << rate << " req/s, "
+      << "p50 = " << p50 << " ms, "
+      << "p99 = " << p99 << " ms";
+  return oss.str ();
+}
+
+HttpPool::HttpPool (int connections) :
+  m_mutex (),
+  m_available (),
+  m_connections (max (connections, 1)),
+  m_compression (true),
+  m_hosts (),
+  m_start (Clock::now ()),
+  m_stats (),
+  m_latencies ()
+{
+}
+
+HttpPool::~HttpPool ()
+{
+}
+
+void HttpPool::SetConnections (int connections)
+{
+  lock_guard<mutex> lock (m_mutex);
+  m_connections = max (connections, 1);
+  m_available.notify_all ();
+}
+
+void HttpPool::SetCompression (bool compression)
+{
+  lock_guard<mutex> lock (m_mutex);
+  m_compression = compression;
+}
+
+unique_ptr<HttpPool::Connection> HttpPool::Acquire (const string & key)
+{
+  unique_lock<mutex> lock (m_mutex);
+  Host & host = m_hosts [key];
+  m_available.wait (lock, [&] {return host.active < m_connections;});
+  ++host.active;
+
+  while (! host.idle.empty ())
+  {
+    unique_ptr<Connection> c = move (host.idle.back ());
+    host.idle.pop_back ();
+    if (c->IsOpen () && ! c->IsExpired ()) return c;
+  }
+
+  return unique_ptr<Connection> (new Connection);
+}
+
+void HttpPool::Release (const string & key, unique_ptr<Connection> c, bool keep)
+{
+  lock_guard<mutex> lock (m_mutex);
+  Host & host = m_hosts [key];
+  --host.active;
+
+  if (keep && static_cast<int> (host.idle.size ()) < m_connections)
+  {
+    c->Touch ();
+    host.idle.push_back (move (c));
+  }
+
+  m_available.notify_all ();
+}
+
+void HttpPool::Record (Clock::duration d, bool success, bool reused, bool opened, size_t received, size_t decoded)
+{
+  lock_guard<mutex> lock (m_mutex);
+
+  if (opened) ++m_stats.connections;
+  m_stats.received += received;
+  m_stats.decoded  += decoded;
+
+  if (! success)
+  {
+    ++m_stats.failures;
+    return;
+  }
+
+  ++m_stats.requests;
+  if (reused) ++m_stats.reused;
+
+  m_latencies.push_back (chrono::duration<double, milli> (d).count ());
+  if (m_latencies.size () > HTTP_LATENCIES)
+    m_latencies.pop_front ();
+}
+
+HttpPool::Stats HttpPool::GetStats () const
+{
+  lock_guard<mutex> lock (m_mutex);
+
+  Stats s = m_stats;
+
+  double elapsed = chrono::duration<double> (Clock::now () - m_start).count ();
+  s.rate = elapsed > 0 ? s.requests / elapsed : 0;
+
+  if (! m_latencies.empty ())
+  {
+    vector<double> v (m_latencies.begin (), m_latencies.end ());
+    sort (v.begin (), v.end ());
+    s.p50 = v [(v.size () - 1) * 50 / 100];
+    s.p99 = v [(v.size () - 1) * 99 / 100];
+  }
+
+  return s;
+}
+
+// Response headers (lowercase names).
+typedef map<string, string> freebox_headers;
+
+inline int freebox_read_head (HttpPool::Connection & c, string * version, freebox_headers * headers)
+{
+  int status = 0;
+
+  do
+  {
+    string line;
+    if (! c.ReadLine (&line)) return -1;
+
+    istringstream iss (line);
+    if (! (iss >> *version >> status)) return -1;
+
+    headers->clear ();
+    while (c.ReadLine (&line))
+    {
+      if (line.empty ()) break;
+
+      size_t colon = line.find (':');
+      if (colon == string::npos) continue;
+
+      string name  = freebox_lower (line.substr (0, colon));
+      size_t begin = line.find_first_not_of (" \t", colon + 1);
+      (*headers) [name] = begin != string::npos ? line.substr (begin) : "";
+    }
+  }
+  // 1xx informational responses (but "101 Switching Protocols").
+  while (status >= 100 && status < 200 && status != 101);
+
+  return status;
+}
+
+int HttpPool::Request (const string & method,
+                       const string & url,
+                       const Headers & headers,
+                       const string & body,
+                       string * response)
+{
+  return Request (method, url, headers, body, [response] (istream & is)
+  {
+    if (response != nullptr)
+      response->append (istreambuf_iterator<char> (is), istreambuf_iterator<char> ());
+  });
+}
+
+int HttpPool::Request (const string & method,
+                       const string & url,
+                       const Headers & headers,
+                       const string & body,
+                       const Reader & reader,
+                       Clock::duration * latency)
+{
+  string host, port, target;
+  if (! freebox_parse_url (url, &host, &port, &target))
+    return -1;
+
+  string key = host + ':' + port;
+
+  m_mutex.lock ();
+  bool compression = m_compression;
+  m_mutex.unlock ();
+
+  ostringstream oss;
+  oss << method << ' ' << target << " HTTP/1.1\r\n";
+  oss << "Host: " << (port == "80" ? host : key) << "\r\n";
+  oss << "Connection: keep-alive\r\n";
+  if (compression)
+    oss << "Accept-Encoding: gzip, deflate\r\n";
+  for (auto & h : headers)
+    oss << h.first << ": " << h.second << "\r\n";
+  if (! body.empty () || method == "POST" || method == "PUT")
+  {
+    oss << "Content-Type: application/json\r\n";
+    oss << "Content-Length: " << body.size () << "\r\n";
+  }
+  oss << "\r\n" << body;
+  string request = oss.str ();
+
+  // A kept-alive connection may have been closed by the server: retry once,
+  // if the request wasn't sent, or if sending it twice is harmless.
+  bool idempotent = method == "GET" || method == "HEAD" || method == "DELETE";
+
+  for (int attempt = 0; attempt < 2; ++attempt)
+  {
+    Clock::time_point start = Clock::now ();
+
+    unique_ptr<Connection> c = Acquire (key);
+    bool reused = c->IsOpen ();
+    bool opened = false;
+
+    // Time on the wire (local queueing excluded).
+    Clock::time_point acquired = Clock::now ();
+
+    if (! reused)
+    {
+      if (! c->Open (host, port))
+      {
+        Release (key, move (c), false);
+        Record (Clock::now () - start, false, false, false);
+        if (latency != nullptr) *latency = Clock::now () - acquired;
+        return -1;
+      }
+
+      opened = true;
+    }
+
+    string version;
+    freebox_headers h;
+    bool sent   = c->Send (request);
+    int  status = sent ? freebox_read_head (*c, &version, &h) : -1;
+
+    if (status < 0)
+    {
+      Release (key, move (c), false);
+      // Stale connection: not a failure of the request itself.
+      if (reused && attempt == 0 && (! sent || idempotent)) continue;
+      Record (Clock::now () - start, false, reused, opened);
+      if (latency != nullptr) *latency = Clock::now () - acquired;
+      return -1;
+    }
+
+    string connection = freebox_lower (h ["connection"]);
+    bool keep = version == "HTTP/1.1" ? connection != "close" : connection == "keep-alive";
+
+    Body::Mode mode   = Body::CLOSE;
+    size_t     length = 0;
+    if (method == "HEAD" || status == 204 || status == 304)
+      mode = Body::EMPTY;
+    else if (freebox_lower (h ["transfer-encoding"]).find ("chunked") != string::npos)
+      mode = Body::CHUNKED;
+    else if (h.count ("content-length") > 0)
+      mode = Body::LENGTH, length = strtoull (h ["content-length"].c_str (), nullptr, 10);
+    else
+      keep = false;
+
+    Body b (*c, mode, length);
+
+    string encoding = freebox_lower (h ["content-encoding"]);
+    bool   inflate  = encoding == "gzip" || encoding == "x-gzip" || encoding == "deflate";
+
+    size_t decoded;
+    bool   corrupt = false;
+    if (inflate)
+    {
+      ZlibInflate z (&b);
+      istream is (&z);
+      reader (is);
+      decoded = z.Decoded ();
+      corrupt = z.IsError ();
+    }
+    else
+    {
+      istream is (&b);
+      reader (is);
+      decoded = b.Received ();
+    }
+
+    bool success = b.Drain () && ! corrupt;
+
+    Release (key, move (c), keep && success);
+    Record (Clock::now () - start, success, reused, opened, b.Received (), decoded);
+    if (latency != nullptr) *latency = Clock::now () - acquired;
+
+    return success ? status : -1;
+  }
+
+  return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// T H R O T T L E /////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+HttpThrottle::HttpThrottle (double min, double max) :
+  m_mutex (),
+  m_min (min),
+  m_max (std::max (min, max)),
+  m_rate ((m_min + m_max) / 2),
+  m_latency (0),
+  m_baseline (0),
+  m_next (Clock::now ()),
+  m_decrease ()
+{
+}
+
+void HttpThrottle::SetBounds (double min, double max)
+{
+  lock_guard<mutex> lock (m_mutex);
+  m_min  = min;
+  m_max  = std::max (min, max);
+  m_rate = std::min (std::max (m_rate, m_min), m_max);
+}
+
+double HttpThrottle::GetRate () const
+{
+  lock_guard<mutex> lock (m_mutex);
+  return m_rate;
+}
+
+double HttpThrottle::GetLatency () const
+{
+  lock_guard<mutex> lock (m_mutex);
+  return m_latency;
+}
+
+HttpThrottle::Clock::time_point HttpThrottle::Reserve ()
+{
+  lock_guard<mutex> lock (m_mutex);
+  Clock::time_point now  = Clock::now ();
+  Clock::time_point slot = max (now, m_next);
+  m_next = slot + chrono::duration_cast<Clock::duration> (chrono::duration<double> (1.0 / max (m_rate, 0.01)));
+  return slot;
+}
+
+HttpThrottle::Decision HttpThrottle::Feedback (int status, Clock::duration latency)
+{
+  lock_guard<mutex> lock (m_mutex);
+  Clock::time_point now = Clock::now ();
+
+  bool failed = status < 0 || status == 429 || status >= 500;
+
+  if (! failed)
+  {
+    double ms = chrono::duration<double, milli> (latency).count ();
+    m_latency  = m_latency  > 0 ? 0.8 * m_latency + 0.2 * ms : ms;
+    m_baseline = m_baseline > 0 ? min (m_baseline + 0.01 * (m_latency - m_baseline), m_latency) : m_latency;
+  }
+
+  bool slow = m_latency > max (2 * m_baseline, 250.0);
+
+  if (failed || slow)
+  {
+    // At most one decrease per second (requests in flight share the blame).
+    if (now - m_decrease < chrono::seconds (1) || m_rate <= m_min) return HOLD;
+    m_rate = max (m_rate / 2, m_min);
+    m_decrease = now;
+    return DECREASE;
+  }
+
+  if (m_rate >= m_max) return HOLD;
+  m_rate = min (m_rate + (m_max - m_min) / 20, m_max);
+  return INCREASE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// W E B S O C K E T ///////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+inline string freebox_base64 (const unsigned char * data, size_t length)
+{
+  static const char * DIGITS = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  string s;
+  for (size_t i = 0; i < length; i += 3)
+  {
+    uint32_t n = data [i] << 16;
+    if (i + 1 < length) n |= data [i + 1] << 8;
+    if (i + 2 < length) n |= data [i + 2];
+    s += DIGITS [(n >> 18) & 63];
+    s += DIGITS [(n >> 12) & 63];
+    s += i + 1 < length ? DIGITS [(n >> 6) & 63] : '=';
+    s += i + 2 < length ? DIGITS [n & 63] : '=';
+  }
+
+  return s;
+}
+
+WebSocket::WebSocket () :
+  m_connection (),
+  m_fragments ()
+{
+}
+
+WebSocket::~WebSocket ()
+{
+  Close ();
+}
+
+bool WebSocket::IsOpen () const
+{
+  return m_connection && m_connection->IsOpen ();
+}
+
+bool WebSocket::Open (const string & url, const HttpPool::Headers & headers)
+{
+  Close ();
+
+  // ws://host[:port]/path
+  static const string SCHEME = "ws://";
+  if (url.compare (0, SCHEME.length (), SCHEME) != 0) return false;
+
+  string host, port, target;
+  if (! freebox_parse_url ("http://" + url.substr (SCHEME.length ()), &host, &port, &target))
+    return false;
+
+  m_connection.reset (new HttpPool::Connection);
+  if (! m_connection->Open (host, port))
+  {
+    Close ();
+    return false;
+  }
+
+  // Random key.
+  unsigned char nonce [16];
+  random_device random;
+  for (auto & b : nonce) b = (unsigned char) random ();
+  string key = freebox_base64 (nonce, sizeof (nonce));
+
+  ostringstream oss;
+  oss << "GET " << target << " HTTP/1.1\r\n";
+  oss << "Host: " << (port == "80" ? host : host + ':' + port) << "\r\n";
+  oss << "Upgrade: websocket\r\n";
+  oss << "Connection: Upgrade\r\n";
+  oss << "Sec-WebSocket-Key: " << key << "\r\n";
+  oss << "Sec-WebSocket-Version: 13\r\n";
+  for (auto & h : headers)
+    oss << h.first << ": " << h.second << "\r\n";
+  oss << "\r\n";
+
+  string version;
+  freebox_headers h;
+  if (! m_connection->Send (oss.str ()) || freebox_read_head (*m_connection, &version, &h) != 101)
+  {
+    Close ();
+    return false;
+  }
+
+  // The server must prove it understood the handshake.
+  string accept = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+  unsigned char digest [SHA_DIGEST_LENGTH];
+  SHA1 ((const unsigned char *) accept.data (), accept.size (), digest);
+  if (h ["sec-websocket-accept"] != freebox_base64 (digest, sizeof (digest)))
+  {
+    Close ();
+    return false;
+  }
+
+  return true;
+}
+
+void WebSocket::Close ()
+{
+  m_connection.reset ();
+  m_fragments.clear ();
+}
+
+bool WebSocket::Send (const string & text)
+{
+  return SendFrame (0x1, text);
+}
+
+bool WebSocket::SendFrame (int opcode, const string & payload)
+{
+  if (! IsOpen ()) return false;
+
+  string frame;
+  frame += (char) (0x80 | opcode);
+
+  // Client frames are masked.
+  size_t n = payload.size ();
+  if (n < 126)
+    frame += (char) (0x80 | n);
+  else if (n < 65536)
+  {
+    frame += (char) (0x80 | 126);
+    for (int i = 1; i >= 0; --i) frame += (char) (n >> (8 * i));
+  }
+  else
+  {
+    frame += (char) (0x80 | 127);
+    for (int i = 7; i >= 0; --i) frame += (char) ((uint64_t) n >> (8 * i));
+  }
+
+  static thread_local mt19937 random {random_device () ()};
+  char mask [4];
+  for (auto & b : mask) b = (char) random ();
+  frame.append (mask, 4);
+
+  for (size_t i = 0; i < n; ++i)
+    frame += payload [i] ^ mask [i % 4];
+
+  if (m_connection->Send (frame)) return true;
+
+  Close ();
+  return false;
+}
+
+bool WebSocket::ReadExact (char * data, size_t length)
+{
+  for (size_t offset = 0; offset < length;)
+  {
+    size_t n = m_connection->ReadSome (data + offset, length - offset);
+    if (n == 0) return false;
+    offset += n;
+  }
+
+  return true;
+}
+
+WebSocket::Status WebSocket::Receive (string * message, int timeout)
+{
+  for (;;)
+  {
+    if (! IsOpen ()) return CLOSED;
+
+    // Timeout between frames only: a started frame is read to the end.
+    if (! m_connection->Wait (timeout)) return TIMEOUT;
+
+    unsigned char head [2];
+    if (! ReadExact ((char *) head, 2)) break;
+
+    bool     fin    = (head [0] & 0x80) != 0;
+    int      opcode =  head [0] & 0x0F;
+    bool     masked = (head [1] & 0x80) != 0;
+    uint64_t length =  head [1] & 0x7F;
+
+    if (length >= 126)
+    {
+      unsigned char extended [8];
+      int k = length == 126 ? 2 : 8;
+      if (! ReadExact ((char *) extended, k)) break;
+      length = 0;
+      for (int i = 0; i < k; ++i) length = (length << 8) | extended [i];
+    }
+
+    if (m_fragments.size () + length > WS_MESSAGE_MAX) break;
+
+    char mask [4] = {0, 0, 0, 0};
+    if (masked && ! ReadExact (mask, 4)) break;
+
+    string payload (length, '\0');
+    if (length > 0 && ! ReadExact (&payload [0], length)) break;
+    if (masked)
+      for (size_t i = 0; i < length; ++i) payload [i] ^= mask [i % 4];
+
+    switch (opcode)
+    {
+      // Continuation, text, binary.
+      case 0x0:
+      case 0x1:
+      case 0x2:
+        m_fragments += payload;
+        if (fin)
+        {
+          message->swap (m_fragments);
+          m_fragments.clear ();
+          return MESSAGE;
+        }
+        continue;
+
+      // Ping.
+      case 0x9:
+        SendFrame (0xA, payload);
+        continue;
+
+      // Pong.
+      case 0xA:
+        continue;
+
+      // Close (echoing the status code).
+      case 0x8:
+        SendFrame (0x8, payload.substr (0, 2));
+        Close ();
+        return CLOSED;
+    }
+
+    // Unknown opcode.
+    break;
+  }
+
+  Close ();
+  return CLOSED;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// P R O B E ///////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+// Milliseconds left before a deadline.
+inline int freebox_remaining (StreamProbe::Clock::time_point deadline)
+{
+  auto d = chrono::duration_cast<chrono::milliseconds> (deadline - StreamProbe::Clock::now ());
+  return max ((int) d.count (), 0);
+}
+
+inline double freebox_elapsed (StreamProbe::Clock::time_point start)
+{
+  return chrono::duration<double, milli> (StreamProbe::Clock::now () - start).count ();
+}
+
+inline bool freebox_read_exact (HttpPool::Connection & c, char * data, size_t length)
+{
+  for (size_t offset = 0; offset < length;)
+  {
+    size_t n = c.ReadSome (data + offset, length - offset);
+    if (n == 0) return false;
+    offset += n;
+  }
+
+  return true;
+}
+
+// MPEG-TS packet flagged as a random access point, from *offset on.
+inline bool freebox_ts_keyframe (const string & data, size_t * offset)
+{
+  size_t i = *offset;
+  while (i + 188 <= data.size ())
+  {
+    const unsigned char * p = (const unsigned char *) data.data () + i;
+
+    // Resync.
+    if (p [0] != 0x47) {++i; continue;}
+
+    // Adaptation field, random_access_indicator.
+    if ((p [3] & 0x20) && p [4] > 0 && (p [5] & 0x40))
+      return true;
+
+    i += 188;
+  }
+
+  *offset = i;
+  return false;
+}
+
+// URI relative to a playlist.
+inline string freebox_resolve_url (const string & base, const string & uri)
+{
+  if (uri.find ("://") != string::npos) return uri;
+
+  if (! uri.empty () && uri [0] == '/')
+  {
+    size_t slash = base.find ('/', base.find ("://") + 3);
+    return base.substr (0, slash) + uri;
+  }
+
+  string path = base.substr (0, base.find ('?'));
+  return path.substr (0, path.rfind ('/') + 1) + uri;
+}
+
+// GET on a fresh connection: status (-1 on failure), the body is left to the caller.
+inline int freebox_probe_get (HttpPool::Connection & c,
+                              const string & url,
+                              StreamProbe::Clock::time_point deadline,
+                              HttpPool::Body::Mode * mode,
+                              size_t * length)
+{
+  string host, port, target;
+  if (! freebox_parse_url (url, &host, &port, &target)) return -1;
+  if (! c.Open (host, port)) return -1;
+  c.SetDeadline (deadline);
+
+  ostringstream oss;
+  oss << "GET " << target << " HTTP/1.1\r\n";
+  oss << "Host: " << (port == "80" ? host : host + ':' + port) << "\r\n";
+  oss << "Connection: close\r\n";
+  oss << "\r\n";
+
+  if (! c.Send (oss.str ()) || ! c.Wait (freebox_remaining (deadline))) return -1;
+
+  string version;
+  freebox_headers h;
+  int status = freebox_read_head (c, &version, &h);
+
+  *mode   = HttpPool::Body::CLOSE;
+  *length = 0;
+  if (freebox_lower (h ["transfer-encoding"]).find ("chunked") != string::npos)
+    *mode = HttpPool::Body::CHUNKED;
+  else if (h.count ("content-length") > 0)
+    *mode = HttpPool::Body::LENGTH, *length = strtoull (h ["content-length"].c_str (), nullptr, 10);
+
+  return status;
+}
+
+// Playlist body (HLS).
+inline bool freebox_probe_playlist (const string & url, StreamProbe::Clock::time_point deadline, string * playlist)
+{
+  HttpPool::Connection c;
+  HttpPool::Body::Mode mode;
+  size_t length;
+  if (freebox_probe_get (c, url, deadline, &mode, &length) != 200) return false;
+
+  HttpPool::Body b (c, mode, length);
+  char buffer [4096];
+  for (streamsize n; (n = b.sgetn (buffer, sizeof (buffer))) > 0;)
+  {
+    playlist->append (buffer, (size_t) n);
+    if (playlist->size () > PROBE_PLAYLIST_MAX) return false;
+  }
+
+  return ! b.IsError ();
+}
+
+// First URI of a playlist (after a tag, if any).
+inline string freebox_playlist_uri (const string & playlist, const string & tag = "")
+{
+  istringstream iss (playlist);
+  bool found = tag.empty ();
+  for (string line; getline (iss, line);)
+  {
+    if (! line.empty () && line.back () == '\r') line.pop_back ();
+    if (line.empty ()) continue;
+
+    if (line [0] == '#')
+      found = found || line.compare (0, tag.length (), tag) == 0;
+    else if (found)
+      return line;
+  }
+
+  return "";
+}
+
+/* static */
+StreamProbe::Result StreamProbe::Probe (const string & url, int timeout)
+{
+  Clock::time_point deadline = Clock::now () + chrono::milliseconds (timeout);
+  return url.compare (0, 7, "rtsp://") == 0 ? ProbeRTSP (url, deadline) : ProbeHLS (url, deadline);
+}
+
+/* static */
+StreamProbe::Result StreamProbe::ProbeRTSP (const string & url, Clock::time_point deadline)
+{
+  Result r;
+  Clock::time_point start = Clock::now ();
+
+  string host, port, target;
+  if (! freebox_parse_url (url, &host, &port, &target)) return r;
+
+  HttpPool::Connection c;
+  if (! c.Open (host, port)) return r;
+  c.SetDeadline (deadline);
+
+  int    cseq = 0;
+  string session;
+
+  // Request, answer (status, or -1 on failure).
+  auto request = [&] (const string & method, const string & uri, const string & headers, freebox_headers * h, string * body)
+  {
+    ostringstream oss;
+    oss << method << ' ' << uri << " RTSP/1.0\r\n";
+    oss << "CSeq: " << ++cseq << "\r\n";
+    if (! session.empty ())
+      oss << "Session: " << session << "\r\n";
+    oss << headers << "\r\n";
+
+    if (! c.Send (oss.str ()) || ! c.Wait (freebox_remaining (deadline))) return -1;
+
+    string version;
+    int status = freebox_read_head (c, &version, h);
+    if (status < 0) return -1;
+
+    body->resize (strtoull ((*h) ["content-length"].c_str (), nullptr, 10));
+    if (! freebox_read_exact (c, &(*body) [0], body->size ())) return -1;
+
+    return status;
+  };
+
+  freebox_headers h;
+  string sdp;
+  if (request ("DESCRIBE", url, "Accept: application/sdp\r\n", &h, &sdp) != 200) return r;
+  r.first_byte = freebox_elapsed (start);
+
+  // Control URL of the first media.
+  string base = h.count ("content-base") > 0 ? h ["content-base"] : url;
+  string control;
+  {
+    istringstream iss (sdp);
+    bool media = false;
+    for (string line; getline (iss, line);)
+    {
+      if (! line.empty () && line.back () == '\r') line.pop_back ();
+      if (line.compare (0, 2, "m=") == 0) media = true;
+      if (media && line.compare (0, 10, "a=control:") == 0) {control = line.substr (10); break;}
+    }
+  }
+
+  string setup = base;
+  if (control.find ("://") != string::npos)
+    setup = control;
+  else if (! control.empty () && control != "*")
+    setup = base + (base.back () == '/' ? "" : "/") + control;
+
+  // Interleaved: a single TCP connection.
+  string body;
+  if (request ("SETUP", setup, "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n", &h, &body) != 200) return r;
+  session = h ["session"].substr (0, h ["session"].find (';'));
+
+  if (request ("PLAY", url, "Range: npt=0.000-\r\n", &h, &body) != 200) return r;
+
+  string ts;
+  size_t offset = 0;
+  while (ts.size () < PROBE_SCAN_MAX && c.Wait (freebox_remaining (deadline)))
+  {
+    char magic;
+    if (! freebox_read_exact (c, &magic, 1)) break;
+
+    // RTSP message in between (request from the server, late answer): skipped, body included.
+    if (magic != '$')
+    {
+      string line;
+      size_t length = 0;
+      bool   read   = c.ReadLine (&line); // rest of the first line
+      while (read && (read = c.ReadLine (&line)) && ! line.empty ())
+      {
+        size_t colon = line.find (':');
+        if (colon != string::npos && freebox_lower (line.substr (0, colon)) == "content-length")
+          length = strtoull (line.c_str () + colon + 1, nullptr, 10);
+      }
+
+      if (! read || length > PROBE_MESSAGE_MAX) break;
+
+      string skipped (length, '\0');
+      if (length > 0 && ! freebox_read_exact (c, &skipped [0], length)) break;
+      continue;
+    }
+
+    unsigned char head [3];
+    if (! freebox_read_exact (c, (char *) head, 3)) break;
+
+    string packet ((head [1] << 8) | head [2], '\0');
+    if (! freebox_read_exact (c, &packet [0], packet.size ())) break;
+
+    // RTP on channel 0: header, CSRCs, extension.
+    if (head [0] != 0 || packet.size () < 12) continue;
+
+    const unsigned char * p = (const unsigned char *) packet.data ();
+    size_t k = 12 + 4 * (p [0] & 0x0F);
+    if ((p [0] & 0x10) && k + 4 <= packet.size ())
+      k += 4 + 4 * ((p [k + 2] << 8) | p [k + 3]);
+    if (k >= packet.size ()) continue;
+
+    ts.append (packet, k, string::npos);
+    if (freebox_ts_keyframe (ts, &offset))
+    {
+      r.first_frame = freebox_elapsed (start);
+      break;
+    }
+  }
+
+  request ("TEARDOWN", url, "", &h, &body);
+  return r;
+}
+
+/* static */
+StreamProbe::Result StreamProbe::ProbeHLS (const string & url, Clock::time_point deadline)
+{
+  Result r;
+  Clock::time_point start = Clock::now ();
+
+  string playlist;
+  if (! freebox_probe_playlist (url, deadline, &playlist)) return r;
+  r.first_byte = freebox_elapsed (start);
+
+  // Master playlist: first variant.
+  string base = url;
+  string variant = freebox_playlist_uri (playlist, "#EXT-X-STREAM-INF");
+  if (! variant.empty ())
+  {
+    base = freebox_resolve_url (url, variant);
+    playlist.clear ();
+    if (! freebox_probe_playlist (base, deadline, &playlist)) return r;
+  }
+
+  string segment = freebox_playlist_uri (playlist);
+  if (segment.empty ()) return r;
+
+  HttpPool::Connection c;
+  HttpPool::Body::Mode mode;
+  size_t length;
+  if (freebox_probe_get (c, freebox_resolve_url (base, segment), deadline, &mode, &length) != 200) return r;
+
+  HttpPool::Body b (c, mode, length);
+  string ts;
+  size_t offset = 0;
+  char buffer [16384];
+  while (ts.size () < PROBE_SCAN_MAX && freebox_remaining (deadline) > 0)
+  {
+    streamsize n = b.sgetn (buffer, sizeof (buffer));
+    if (n <= 0) break;
+
+    // Not MPEG-TS (fMP4): segments start with a keyframe.
+    if (ts.empty () && buffer [0] != 0x47)
+    {
+      r.first_frame = freebox_elapsed (start);
+      break;
+    }
+
+    ts.append (buffer, (size_t) n);
+    if (freebox_ts_keyframe (ts, &offset))
+    {
+      r.first_frame = freebox_elapsed (start);
+      break;
+    }
+  }
+
+  return r;
+}
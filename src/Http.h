@@ -0,0 +1,202 @@
+#pragma once
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <istream>
+#include <functional>
+#include <condition_variable>
+
+// Keep-alive HTTP/1.1 client, with a bounded number of connections per host.
+class HttpPool
+{
+  public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::vector<std::pair<std::string, std::string>> Headers;
+    typedef std::function<void (std::istream &)> Reader;
+
+    // Connection (opaque).
+    class Connection;
+    // Response body (opaque).
+    class Body;
+
+    // Statistics.
+    class Stats
+    {
+      public:
+        size_t requests    = 0; // completed requests
+        size_t failures    = 0; // network failures
+        size_t connections = 0; // opened connections
+        size_t reused      = 0; // requests on a kept-alive connection
+        size_t received    = 0; // body bytes on the wire
+        size_t decoded     = 0; // body bytes after decompression
+        double rate        = 0; // requests/sec
+        double p50         = 0; // median latency (ms)
+        double p99         = 0; // 99th percentile latency (ms)
+
+      public:
+        std::string str () const;
+    };
+
+  protected:
+    class Host
+    {
+      public:
+        int                                     active = 0;
+        std::deque<std::unique_ptr<Connection>> idle;
+    };
+
+  public:
+    HttpPool (int connections);
+    ~HttpPool ();
+
+    // Maximum number of connections per host.
+    void SetConnections (int);
+    // Accept gzip/deflate responses.
+    void SetCompression (bool);
+
+    // Perform a request (status code, or -1 on network failure).
+    int Request (const std::string & method,
+                 const std::string & url,
+                 const Headers &,
+                 const std::string & body,
+                 std::string * response);
+
+    // Same, but the response body is streamed to the reader as it arrives;
+    // latency excludes the wait for a connection.
+    int Request (const std::string & method,
+                 const std::string & url,
+                 const Headers &,
+                 const std::string & body,
+                 const Reader &,
+                 Clock::duration * latency = nullptr);
+
+    Stats GetStats () const;
+
+  protected:
+    std::unique_ptr<Connection> Acquire (const std::string & key);
+    void Release (const std::string & key, std::unique_ptr<Connection>, bool keep);
+    void Record (Clock::duration, bool success, bool reused, bool opened, size_t received = 0, size_t decoded = 0);
+
+  private:
+    mutable std::mutex          m_mutex;
+    std::condition_variable     m_available;
+    int                         m_connections;
+    bool                        m_compression;
+    std::map<std::string, Host> m_hosts;
+    // Statistics.
+    Clock::time_point           m_start;
+    Stats                       m_stats;
+    std::deque<double>          m_latencies;
+};
+
+// Adaptive request budget (requests/sec), shared by concurrent callers:
+// additive increase while the server answers fast, multiplicative decrease
+// when it slows down or fails.
+class HttpThrottle
+{
+  public:
+    typedef HttpPool::Clock Clock;
+
+    enum Decision {HOLD = 0, INCREASE = 1, DECREASE = 2};
+
+  public:
+    HttpThrottle (double min, double max);
+
+    // Floor and ceiling (requests/sec).
+    void SetBounds (double min, double max);
+
+    double GetRate    () const; // requests/sec
+    double GetLatency () const; // smoothed latency (ms)
+
+    // Reserve the next slot (the caller must wait until then).
+    Clock::time_point Reserve ();
+
+    // Feedback from a completed request (status < 0 on network failure).
+    Decision Feedback (int status, Clock::duration latency);
+
+  private:
+    mutable std::mutex m_mutex;
+    double             m_min;
+    double             m_max;
+    double             m_rate;
+    double             m_latency;  // EWMA (ms)
+    double             m_baseline; // fastest EWMA seen (ms)
+    Clock::time_point  m_next;
+    Clock::time_point  m_decrease;
+};
+
+// Websocket client (RFC 6455): messages over a single connection, no extensions.
+class WebSocket
+{
+  public:
+    enum Status {MESSAGE = 0, TIMEOUT = 1, CLOSED = 2};
+
+  public:
+    WebSocket ();
+    ~WebSocket ();
+
+    // Handshake (ws://host[:port]/path).
+    bool Open (const std::string & url, const HttpPool::Headers &);
+    void Close ();
+    bool IsOpen () const;
+
+    // Text message.
+    bool Send (const std::string &);
+    // Next message (pings are answered on the way), waiting up to timeout (ms).
+    Status Receive (std::string * message, int timeout);
+
+  protected:
+    bool SendFrame (int opcode, const std::string & payload);
+    bool ReadExact (char *, size_t);
+
+  private:
+    std::unique_ptr<HttpPool::Connection> m_connection;
+    std::string                           m_fragments;
+};
+
+// Stream start latency, without playback: first answer, first keyframe (MPEG-TS).
+class StreamProbe
+{
+  public:
+    typedef HttpPool::Clock Clock;
+
+    class Result
+    {
+      public:
+        double first_byte  = -1; // ms: RTSP DESCRIBE answer, HLS playlist (-1 on failure)
+        double first_frame = -1; // ms: first random access point (-1 on failure)
+    };
+
+  public:
+    // rtsp://host[:port]/path or http://host[:port]/path (HLS), within the timeout (ms).
+    static Result Probe (const std::string & url, int timeout);
+
+  protected:
+    static Result ProbeRTSP (const std::string & url, Clock::time_point deadline);
+    static Result ProbeHLS  (const std::string & url, Clock::time_point deadline);
+};
@@ -0,0 +1,139 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <cstring>
+
+#include "Zlib.h"
+
+using namespace std;
+
+ZlibInflate::ZlibInflate (streambuf * source) :
+  m_source (source),
+  m_stream (),
+  m_started (false),
+  m_raw (false),
+  m_end (false),
+  m_error (false),
+  m_decoded (0)
+{
+  memset (&m_stream, 0, sizeof (m_stream));
+  setg (m_output, m_output, m_output);
+}
+
+ZlibInflate::~ZlibInflate ()
+{
+  if (m_started)
+    inflateEnd (&m_stream);
+}
+
+bool ZlibInflate::Start ()
+{
+  uInt size = 0;
+  while (size < 2)
+  {
+    streamsize n = m_source->sgetn (m_input + size, sizeof (m_input) - size);
+    if (n <= 0) return false;
+    size += (uInt) n;
+  }
+
+  // Some servers send raw deflate data for "Content-Encoding: deflate":
+  // anything but a gzip (1f 8b) or zlib (CMF/FLG check) header.
+  unsigned char b0 = m_input [0], b1 = m_input [1];
+  bool gzip = b0 == 0x1f && b1 == 0x8b;
+  bool zlib = (b0 & 0x0f) == Z_DEFLATED && (b0 >> 4) <= 7 && (b0 << 8 | b1) % 31 == 0;
+  m_raw = ! gzip && ! zlib;
+
+  // 15 + 32: zlib or gzip header, automatically detected.
+  if (inflateInit2 (&m_stream, m_raw ? -15 : 15 + 32) != Z_OK) return false;
+
+  m_started         = true;
+  m_stream.next_in  = (Bytef *) m_input;
+  m_stream.avail_in = size;
+  return true;
+}
+
+ZlibInflate::int_type ZlibInflate::underflow ()
+{
+  if (gptr () < egptr ())
+    return traits_type::to_int_type (*gptr ());
+
+  if (! m_started && ! m_error && ! Start ())
+    m_error = true;
+
+  while (! m_end && ! m_error)
+  {
+    if (m_stream.avail_in == 0)
+    {
+      streamsize n = m_source->sgetn (m_input, sizeof (m_input));
+      if (n <= 0)
+      {
+        // Truncated stream.
+        m_error = true;
+        break;
+      }
+
+      m_stream.next_in  = (Bytef *) m_input;
+      m_stream.avail_in = (uInt) n;
+    }
+
+    m_stream.next_out  = (Bytef *) m_output;
+    m_stream.avail_out = sizeof (m_output);
+
+    int r = inflate (&m_stream, Z_NO_FLUSH);
+
+    if (r == Z_STREAM_END)
+      m_end = true;
+    else if (r != Z_OK && r != Z_BUF_ERROR)
+      m_error = true;
+
+    size_t n = sizeof (m_output) - m_stream.avail_out;
+    if (n > 0)
+    {
+      m_decoded += n;
+      setg (m_output, m_output, m_output + n);
+      return traits_type::to_int_type (*gptr ());
+    }
+  }
+
+  return traits_type::eof ();
+}
+
+bool freebox_gz_read (const string & path, string * data)
+{
+  gzFile f = gzopen (path.c_str (), "rb");
+  if (f == nullptr) return false;
+
+  char buffer [16384];
+  int n;
+  while ((n = gzread (f, buffer, sizeof (buffer))) > 0)
+    data->append (buffer, n);
+
+  return gzclose (f) == Z_OK && n == 0;
+}
+
+bool freebox_gz_write (const string & path, const string & data)
+{
+  gzFile f = gzopen (path.c_str (), "wb6");
+  if (f == nullptr) return false;
+
+  bool success = data.empty () || gzwrite (f, data.data (), (unsigned int) data.size ()) > 0;
+  return gzclose (f) == Z_OK && success;
+}
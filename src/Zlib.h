@@ -0,0 +1,56 @@
+#pragma once
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string>
+#include <streambuf>
+#include "zlib.h"
+
+// Streaming decompression (gzip, zlib or raw deflate) of another stream.
+class ZlibInflate : public std::streambuf
+{
+  private:
+    std::streambuf * m_source;
+    z_stream         m_stream;
+    bool             m_started;
+    bool             m_raw;   // raw deflate (no zlib header)
+    bool             m_end;
+    bool             m_error;
+    size_t           m_decoded;
+    char             m_input  [16384];
+    char             m_output [16384];
+
+  protected:
+    // Format from the first two bytes of input.
+    bool Start ();
+    int_type underflow () override;
+
+  public:
+    ZlibInflate (std::streambuf * source);
+    ~ZlibInflate ();
+
+    bool   IsError () const {return m_error;}
+    size_t Decoded () const {return m_decoded;}
+};
+
+// Compressed files (plain files are read transparently).
+bool freebox_gz_read  (const std::string & path, std::string * data);
+bool freebox_gz_write (const std::string & path, const std::string & data);
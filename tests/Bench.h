@@ -0,0 +1,96 @@
+#pragma once
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <nlohmann/json.hpp>
+
+// Timing and machine-readable results for the benchmarks:
+// one JSON object per line, {"bench": name, ...}, to diff between commits.
+class Bench
+{
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+  public:
+    // "--quick": small sizes, so that ctest only checks the benchmarks still run.
+    static bool Quick (int argc, char ** argv)
+    {
+      for (int i = 1; i < argc; ++i)
+        if (std::strcmp (argv [i], "--quick") == 0)
+          return true;
+      return false;
+    }
+
+    static double Ms (Clock::duration d)
+    {
+      return std::chrono::duration<double, std::milli> (d).count ();
+    }
+
+    static double Ns (Clock::duration d)
+    {
+      return std::chrono::duration<double, std::nano> (d).count ();
+    }
+
+    // Nanoseconds per call, over n calls.
+    template <class F>
+    static double NsPerOp (size_t n, F f)
+    {
+      Clock::time_point start = Clock::now ();
+      for (size_t i = 0; i < n; ++i) f (i);
+      return Ns (Clock::now () - start) / std::max<size_t> (n, 1);
+    }
+
+    // p in [0, 1].
+    static double Percentile (std::vector<double> samples, double p)
+    {
+      if (samples.empty ()) return 0;
+      size_t k = std::min (samples.size () - 1, (size_t) (p * samples.size ()));
+      std::nth_element (samples.begin (), samples.begin () + k, samples.end ());
+      return samples [k];
+    }
+
+    static void Report (const std::string & name, nlohmann::json fields)
+    {
+      nlohmann::json line {{"bench", name}};
+      line.update (fields);
+      std::cout << line.dump () << std::endl;
+    }
+
+    // Keeps a result alive (not optimized away): its address escapes, and
+    // the memory behind it may be read.
+    template <class T>
+    static void Use (const T & x)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+      asm volatile ("" : : "r" (&x) : "memory");
+#else
+      static const void * volatile sink;
+      sink = &x;
+      (void) sink;
+#endif
+    }
+};
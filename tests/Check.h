@@ -0,0 +1,49 @@
+#pragma once
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <iostream>
+
+// Minimal checks for the tests: failures are counted, main returns them.
+class Check
+{
+  public:
+    static int & Failures ()
+    {
+      static int failures = 0;
+      return failures;
+    }
+
+    static void Fail (const char * file, int line, const char * condition)
+    {
+      std::cerr << file << ':' << line << ": check failed: " << condition << std::endl;
+      ++Failures ();
+    }
+
+    static int Result ()
+    {
+      if (Failures () == 0) std::cout << "OK" << std::endl;
+      return Failures () == 0 ? 0 : 1;
+    }
+};
+
+#define CHECK(condition) \
+  do {if (! (condition)) Check::Fail (__FILE__, __LINE__, #condition);} while (0)
@@ -0,0 +1,97 @@
+#pragma once
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <tuple>
+#include <nlohmann/json.hpp>
+
+#include "Core.h"
+
+// Former bouquet conflict resolution (maps of conflict lists, erased in
+// nested loops), kept as the reference of Core::ResolveConflicts.
+// Only defined without duplicate (major, minor) or (uuid, major) pairs:
+// the sort isn't stable, and erase (remove_if (...)) drops one element.
+inline std::map<int, Core::Conflict> reference_resolve_conflicts (const nlohmann::json & bouquet)
+{
+  typedef std::vector<Core::Conflict> Conflicts;
+
+  auto comparator = [] (const Core::Conflict & c1, const Core::Conflict & c2)
+  {
+    return std::tie (c1.major, c1.minor) < std::tie (c2.major, c2.minor);
+  };
+
+  std::map<std::string, Conflicts> conflicts_by_uuid;
+  std::map<int, Conflicts>         conflicts_by_major;
+
+  for (size_t i = 0; i < bouquet.size (); ++i)
+  {
+    std::string uuid  = bouquet [i].value ("uuid", "");
+    int         major = bouquet [i].value ("number", 0);
+    int         minor = bouquet [i].value ("sub_number", 0);
+
+    Core::Conflict c (uuid, major, minor, (int) i);
+
+    conflicts_by_uuid  [uuid] .push_back (c);
+    conflicts_by_major [major].push_back (c);
+  }
+
+  for (auto & [major, v1] : conflicts_by_major)
+  {
+    std::sort (v1.begin (), v1.end (), comparator);
+
+    for (size_t j = 1; j < v1.size (); ++j)
+    {
+      Conflicts & v2 = conflicts_by_uuid [v1 [j].uuid];
+      v2.erase (std::remove_if (v2.begin (), v2.end (),
+        [m = major] (const Core::Conflict & c) {return c.major == m;}));
+    }
+
+    v1.erase (v1.begin () + 1, v1.end ());
+  }
+
+  for (auto & [uuid, v1] : conflicts_by_uuid)
+  {
+    if (! v1.empty ())
+    {
+      std::sort (v1.begin (), v1.end (), comparator);
+
+      for (size_t j = 1; j < v1.size (); ++j)
+      {
+        Conflicts & v2 = conflicts_by_major [v1 [j].major];
+        v2.erase (std::remove_if (v2.begin (), v2.end (),
+          [u = uuid] (const Core::Conflict & c) {return c.uuid == u;}));
+      }
+
+      v1.erase (v1.begin () + 1, v1.end ());
+    }
+  }
+
+  std::map<int, Core::Conflict> result;
+  for (auto & [major, q] : conflicts_by_major)
+    if (! q.empty ())
+      result.emplace (major, q.front ());
+
+  return result;
+}
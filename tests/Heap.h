@@ -0,0 +1,78 @@
+#pragma once
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include <cstddef>
+
+// Out of line: inlined into a delete expression, free () would be matched
+// against the new expression (-Wmismatched-new-delete).
+#ifdef _MSC_VER
+#define HEAP_NOINLINE __declspec(noinline)
+#else
+#define HEAP_NOINLINE __attribute__((noinline))
+#endif
+
+// Heap accounting for the benchmarks: replaces the global operator new and
+// delete, so include it in a single file of the executable.
+class Heap
+{
+  public:
+    static std::atomic<size_t> & Live  () {static std::atomic<size_t> n (0); return n;} // bytes
+    static std::atomic<size_t> & Peak  () {static std::atomic<size_t> n (0); return n;} // bytes
+    static std::atomic<size_t> & Count () {static std::atomic<size_t> n (0); return n;} // allocations
+
+    // Start a measurement: peak and count from the current live bytes.
+    static size_t Reset ()
+    {
+      Peak  () = Live ().load ();
+      Count () = 0;
+      return Live ();
+    }
+};
+
+// Size stored in front of each block (malloc/free, paired here).
+HEAP_NOINLINE void * operator new (size_t n)
+{
+  size_t * p = (size_t *) malloc (n + sizeof (max_align_t));
+  if (p == nullptr) throw std::bad_alloc ();
+  *p = n;
+  size_t live = Heap::Live () += n;
+  size_t peak = Heap::Peak ();
+  while (live > peak && ! Heap::Peak ().compare_exchange_weak (peak, live));
+  ++Heap::Count ();
+  return (char *) p + sizeof (max_align_t);
+}
+
+HEAP_NOINLINE void operator delete (void * q) noexcept
+{
+  if (q == nullptr) return;
+  size_t * p = (size_t *) ((char *) q - sizeof (max_align_t));
+  Heap::Live () -= *p;
+  free (p);
+}
+
+void operator delete (void * q, size_t) noexcept
+{
+  operator delete (q);
+}
@@ -0,0 +1,1017 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <random>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+
+#include "MockServer.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+#define MOCK_REQUEST_MAX (1 << 20) // bytes
+
+// Valid categories (see Core::Event::Colors).
+static const int MOCK_CATEGORIES [] = {1, 2, 3, 5, 9, 10, 11, 13, 19, 20};
+
+const string MockServer::APP_TOKEN = "mock-app-token";
+const string MockServer::CHALLENGE = "mock-challenge";
+const string MockServer::WS_PATH   = "/api/v8/ws/event";
+
+inline string mock_lower (string s)
+{
+  transform (s.begin (), s.end (), s.begin (), [] (unsigned char c) {return tolower (c);});
+  return s;
+}
+
+inline json mock_success (const json & result)
+{
+  return json {{"success", true}, {"result", result}};
+}
+
+inline json mock_failure (const string & code)
+{
+  return json {{"success", false}, {"error_code", code}, {"msg", code}};
+}
+
+inline const char * mock_reason (int status)
+{
+  switch (status)
+  {
+    case 101: return "Switching Protocols";
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 500: return "Internal Server Error";
+    default:  return "Unknown";
+  }
+}
+
+inline bool mock_send (int s, const string & data)
+{
+  for (size_t offset = 0; offset < data.size ();)
+  {
+    ssize_t n = send (s, data.data () + offset, data.size () - offset, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    offset += n;
+  }
+
+  return true;
+}
+
+// At least n bytes in the buffer (false once the connection is lost).
+inline bool mock_recv (int s, string & buffer, size_t n)
+{
+  char chunk [16384];
+  while (buffer.size () < n)
+  {
+    ssize_t k = recv (s, chunk, sizeof (chunk), 0);
+    if (k <= 0) return false;
+    buffer.append (chunk, k);
+  }
+
+  return true;
+}
+
+// Plain HTTP answer, JSON body.
+inline string mock_response (int status, const json & response, bool keep)
+{
+  string body = response.dump ();
+  ostringstream oss;
+  oss << "HTTP/1.1 " << status << ' ' << mock_reason (status) << "\r\n";
+  oss << "Content-Type: application/json; charset=utf-8\r\n";
+  oss << "Content-Length: " << body.size () << "\r\n";
+  oss << "Connection: " << (keep ? "keep-alive" : "close") << "\r\n";
+  oss << "\r\n" << body;
+  return oss.str ();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// D A T A /////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+json MockServer::Faults::Json () const
+{
+  return json {{"latency", latency}, {"jitter", jitter}, {"errors", errors}, {"drops", drops}};
+}
+
+/* static */
+MockServer::Faults MockServer::Faults::Parse (const json & j)
+{
+  Faults f;
+  f.latency = j.value ("latency", 0);
+  f.jitter  = j.value ("jitter",  0);
+  f.errors  = j.value ("errors",  0.0);
+  f.drops   = j.value ("drops",   0.0);
+  return f;
+}
+
+/* static */
+string MockServer::ChannelUUID (int channel)
+{
+  return "uuid-webtv-" + to_string (channel);
+}
+
+// Half-hour slots: one ID per (slot, channel), within BroadcastId range.
+/* static */
+string MockServer::EventUUID (int channel, time_t slot)
+{
+  return "pluri_" + to_string ((slot % 100000) * 10000 + channel % 10000);
+}
+
+/* static */
+json MockServer::Event (int channel, time_t slot, bool extended)
+{
+  int n = (int) ((slot * 31 + channel) % 1000);
+
+  json e {{"id",             EventUUID (channel, slot)},
+          {"date",           slot * 1800},
+          {"duration",       1800},
+          {"title",          "Programme " + to_string (n)},
+          {"sub_title",      "Épisode " + to_string (slot % 52 + 1)},
+          {"season_number",  (int) (n % 5 + 1)},
+          {"episode_number", (int) (slot % 52 + 1)},
+          {"category",       MOCK_CATEGORIES [n % 10]},
+          {"picture",        "/api/v6/tv/img/programs/" + to_string (n) + ".jpg"},
+          {"short_desc",     "Résumé du programme " + to_string (n) + '.'},
+          {"year",           1980 + n % 40}};
+
+  if (extended)
+  {
+    e ["picture_big"] = "/api/v6/tv/img/programs/big/" + to_string (n) + ".jpg";
+    e ["desc"] = "Description détaillée du programme " + to_string (n) + ", diffusé sur la chaîne " + to_string (channel) + '.';
+
+    json cast = json::array ();
+    cast.push_back ({{"job", "Réalisateur"}, {"first_name", "Prénom"}, {"last_name", "Réalisateur " + to_string (n)}, {"role", ""}});
+    for (int i = 0; i < 4; ++i)
+      cast.push_back ({{"job", "Acteur"}, {"first_name", "Prénom"}, {"last_name", "Acteur " + to_string (n + i)}, {"role", "Rôle " + to_string (i)}});
+    e ["cast"] = cast;
+  }
+
+  return e;
+}
+
+/* static */
+json MockServer::ByTime (int channels, time_t hour)
+{
+  hour -= hour % 3600;
+
+  json result = json::object ();
+  for (int c = 1; c <= channels; ++c)
+  {
+    json & events = result [ChannelUUID (c)] = json::array ();
+    for (time_t slot = hour / 1800; slot < (hour + 3600) / 1800; ++slot)
+      events.push_back (Event (c, slot, false));
+  }
+
+  return result;
+}
+
+/* static */
+json MockServer::Bouquet (int channels, int conflicts, unsigned seed)
+{
+  mt19937 random (seed);
+  json bouquet = json::array ();
+
+  for (int c = 1; c <= channels; ++c)
+  {
+    string uuid    = ChannelUUID (c);
+    string service = "rtsp://mafreebox.freebox.fr/fbxtv_pub/stream?namespace=1&service=" + to_string (c);
+    string hls     = "http://mafreebox.freebox.fr/api/v6/tv/hls/" + to_string (c);
+
+    json streams = json::array ();
+    for (const char * q : {"hd", "sd", "ld"})
+      streams.push_back ({{"type", "iptv"}, {"quality", q}, {"rtsp", service + "&flavour=" + q}, {"hls", hls + '/' + q + "/index.m3u8"}});
+    if (c % 3 == 0)
+      streams.push_back ({{"type", "dvb"}, {"quality", "hd"}, {"rtsp", "rtsp://mafreebox.freebox.fr/freeboxtv/" + to_string (c)}, {"hls", ""}});
+
+    bouquet.push_back ({{"uuid", uuid}, {"number", c}, {"sub_number", 0}, {"available", true}, {"streams", streams}});
+  }
+
+  // Same channel under another number, or another channel under the same one.
+  for (int i = 0; i < conflicts && channels > 0; ++i)
+  {
+    json entry = bouquet [random () % channels];
+    if (random () % 2)
+      entry ["number"] = (int) (random () % channels) + 1;
+    else
+      entry ["sub_number"] = (int) (random () % 3) + 1;
+    bouquet.push_back (entry);
+  }
+
+  return bouquet;
+}
+
+/* static */
+Core::Channels MockServer::ChannelList (int channels)
+{
+  Core::Channels list;
+  for (const json & entry : Bouquet (channels, 0, 1))
+  {
+    vector<Core::Stream> streams;
+    for (const json & s : entry ["streams"])
+      streams.emplace_back (s);
+
+    int c = entry ["number"];
+    list.emplace (c, Core::Channel (entry ["uuid"], "Chaîne " + to_string (c),
+                                    "/api/v6/tv/img/channels/logos68x60/" + ChannelUUID (c) + ".png",
+                                    c, entry ["sub_number"], streams));
+  }
+  return list;
+}
+
+MockServer::MockServer () :
+  MockServer (Options ())
+{
+}
+
+MockServer::MockServer (const Options & options) :
+  m_options (options),
+  m_mutex (),
+  m_faults (),
+  m_channels (json::object ()),
+  m_bouquet (json::array ()),
+  m_pvr (),
+  m_next_id (1),
+  m_session_token (),
+  m_listen (-1),
+  m_port (-1),
+  m_accept (),
+  m_clients (),
+  m_active (0),
+  m_idle (),
+  m_stop (false),
+  m_requests (0),
+  m_ws_mutex (),
+  m_websockets (),
+  m_pong ()
+{
+  mt19937 random (options.seed);
+
+  for (int c = 1; c <= options.channels; ++c)
+  {
+    string uuid = ChannelUUID (c);
+    m_channels [uuid] = {{"uuid",       uuid},
+                         {"name",       "Chaîne " + to_string (c)},
+                         {"short_name", "C" + to_string (c)},
+                         {"logo_url",   "/api/v6/tv/img/channels/logos68x60/" + uuid + ".png"},
+                         {"available",  true}};
+  }
+
+  m_bouquet = Bouquet (options.channels, options.conflicts, options.seed);
+
+  time_t now = time (NULL);
+  auto channel = [&random, &options] () {return (int) (random () % max (options.channels, 1)) + 1;};
+
+  for (int i = 0; i < options.timers; ++i)
+  {
+    int    c     = channel ();
+    time_t start = now - now % 1800 + (i + 1) * 3600;
+    int    id    = m_next_id++;
+    m_pvr ["programmed"][id] = {{"id", id}, {"start", start}, {"end", start + 3600},
+                                {"margin_before", 300}, {"margin_after", 600},
+                                {"name", "Timer " + to_string (id)}, {"subname", ""},
+                                {"channel_uuid", ChannelUUID (c)}, {"channel_name", "Chaîne " + to_string (c)},
+                                {"media", "Disque dur"}, {"path", "Enregistrements"},
+                                {"has_record_gen", false}, {"record_gen_id", 0},
+                                {"enabled", true}, {"conflict", false},
+                                {"state", "waiting_start_time"}, {"error", "none"}};
+  }
+
+  for (int i = 0; i < options.generators; ++i)
+  {
+    int c  = channel ();
+    int id = m_next_id++;
+    m_pvr ["generator"][id] = {{"id", id}, {"type", "manual_repeat"},
+                               {"media", "Disque dur"}, {"path", "Enregistrements"},
+                               {"name", "Generator " + to_string (id)},
+                               {"params", {{"channel_uuid", ChannelUUID (c)},
+                                           {"start_hour", 20}, {"start_min", 50}, {"duration", 5400},
+                                           {"margin_before", 300}, {"margin_after", 600},
+                                           {"repeat_days", {{"monday", true}, {"tuesday", false}, {"wednesday", true},
+                                                            {"thursday", false}, {"friday", true},
+                                                            {"saturday", false}, {"sunday", false}}}}}};
+  }
+
+  for (int i = 0; i < options.recordings; ++i)
+  {
+    int    c     = channel ();
+    time_t start = now - now % 1800 - (i + 1) * 7200;
+    int    id    = m_next_id++;
+    m_pvr ["finished"][id] = {{"id", id}, {"start", start}, {"end", start + 3600},
+                              {"name", "Recording " + to_string (id)}, {"subname", ""},
+                              {"channel_uuid", ChannelUUID (c)}, {"channel_name", "Chaîne " + to_string (c)},
+                              {"media", "Disque dur"}, {"path", "Enregistrements"},
+                              {"filename", "recording-" + to_string (id) + ".m2ts"},
+                              {"byte_size", 1500000000}, {"secure", false}, {"state", "finished"}};
+  }
+}
+
+MockServer::~MockServer ()
+{
+  Stop ();
+}
+
+void MockServer::SetFaults (const Faults & f)
+{
+  lock_guard<mutex> lock (m_mutex);
+  m_faults = f;
+}
+
+MockServer::Faults MockServer::GetFaults () const
+{
+  lock_guard<mutex> lock (m_mutex);
+  return m_faults;
+}
+
+string MockServer::URL () const
+{
+  return "http://127.0.0.1:" + to_string (m_port);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// A N S W E R S ///////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+int MockServer::Answer (const Request & r, json * response)
+{
+  static const string API = "/api/v6/";
+
+  if (r.path == "/mock/faults")
+  {
+    if (r.method == "POST")
+      SetFaults (Faults::Parse (json::parse (r.body, nullptr, false)));
+    *response = mock_success (GetFaults ().Json ());
+    return 200;
+  }
+
+  if (r.path == "/mock/stats")
+  {
+    *response = mock_success ({{"requests", Requests ()}});
+    return 200;
+  }
+
+  if (r.path.compare (0, API.length (), API) != 0)
+  {
+    *response = mock_failure ("invalid_request");
+    return 404;
+  }
+
+  string path = r.path.substr (API.length ());
+
+  if (path.compare (0, 6, "login/") == 0) return AnswerLogin (r, path.substr (6), response);
+  if (path.compare (0, 3, "tv/")    == 0) return AnswerTv    (r, path.substr (3), response);
+  if (path.compare (0, 4, "pvr/")   == 0) return AnswerPvr   (r, path.substr (4), response);
+
+  *response = mock_failure ("invalid_request");
+  return 404;
+}
+
+int MockServer::AnswerLogin (const Request & r, const string & path, json * response)
+{
+  lock_guard<mutex> lock (m_mutex);
+
+  auto f = r.headers.find ("x-fbx-app-auth");
+  bool logged_in = f != r.headers.end () && ! m_session_token.empty () && f->second == m_session_token;
+
+  if (path.empty ())
+  {
+    *response = mock_success ({{"logged_in", logged_in}, {"challenge", CHALLENGE}});
+    return 200;
+  }
+
+  if (path == "authorize" && r.method == "POST")
+  {
+    *response = mock_success ({{"app_token", APP_TOKEN}, {"track_id", 1}});
+    return 200;
+  }
+
+  if (path.compare (0, 10, "authorize/") == 0)
+  {
+    *response = mock_success ({{"status", "granted"}, {"challenge", CHALLENGE}, {"password_salt", "salt"}});
+    return 200;
+  }
+
+  if (path == "session" && r.method == "POST")
+  {
+    json request = json::parse (r.body, nullptr, false);
+    if (! request.is_object () || request.value ("password", "") != Core::Password (APP_TOKEN, CHALLENGE))
+    {
+      *response = mock_failure ("invalid_token");
+      return 403;
+    }
+
+    m_session_token = "mock-session-" + to_string (++m_next_id);
+    *response = mock_success ({{"session_token", m_session_token}, {"challenge", CHALLENGE}});
+    return 200;
+  }
+
+  *response = mock_failure ("invalid_request");
+  return 404;
+}
+
+int MockServer::AnswerTv (const Request &, const string & path, json * response)
+{
+  static const string BY_TIME    = "epg/by_time/";
+  static const string BY_CHANNEL = "epg/by_channel/";
+  static const string PROGRAMS   = "epg/programs/";
+
+  if (path == "channels")
+  {
+    *response = mock_success (m_channels);
+    return 200;
+  }
+
+  if (path == "bouquets/freeboxtv/channels")
+  {
+    *response = mock_success (m_bouquet);
+    return 200;
+  }
+
+  // Events starting within the hour, by channel.
+  if (path.compare (0, BY_TIME.length (), BY_TIME) == 0)
+  {
+    *response = mock_success (ByTime (m_options.channels, atoll (path.c_str () + BY_TIME.length ())));
+    return 200;
+  }
+
+  // Six hours of a channel, by event ID.
+  if (path.compare (0, BY_CHANNEL.length (), BY_CHANNEL) == 0)
+  {
+    string rest  = path.substr (BY_CHANNEL.length ());
+    size_t slash = rest.find ('/');
+    if (slash == string::npos || rest.compare (0, 11, "uuid-webtv-") != 0)
+    {
+      *response = mock_failure ("invalid_request");
+      return 404;
+    }
+
+    int    c    = Core::ChannelId (rest.substr (0, slash));
+    time_t hour = atoll (rest.c_str () + slash + 1);
+    hour -= hour % 3600;
+
+    json result = json::object ();
+    for (time_t slot = hour / 1800; slot < (hour + 6 * 3600) / 1800; ++slot)
+      result [EventUUID (c, slot)] = Event (c, slot, false);
+
+    *response = mock_success (result);
+    return 200;
+  }
+
+  if (path.compare (0, PROGRAMS.length (), PROGRAMS) == 0)
+  {
+    string uuid = path.substr (PROGRAMS.length ());
+    if (uuid.compare (0, 6, "pluri_") != 0)
+    {
+      *response = mock_failure ("invalid_request");
+      return 404;
+    }
+
+    // Slot modulo 100000: the closest one to now.
+    unsigned int id   = Core::BroadcastId (uuid);
+    int          c    = id % 10000;
+    time_t       now  = time (NULL) / 1800;
+    time_t       slot = now - now % 100000 + id / 10000;
+    if (slot > now + 50000) slot -= 100000;
+
+    *response = mock_success (Event (c, slot, true));
+    return 200;
+  }
+
+  *response = mock_failure ("invalid_request");
+  return 404;
+}
+
+int MockServer::AnswerPvr (const Request & r, const string & path, json * response)
+{
+  lock_guard<mutex> lock (m_mutex);
+
+  auto f = r.headers.find ("x-fbx-app-auth");
+  if (f == r.headers.end () || m_session_token.empty () || f->second != m_session_token)
+  {
+    *response = mock_failure ("auth_required");
+    return 403;
+  }
+
+  // "programmed/", "generator/" or "finished/", then an optional ID.
+  size_t slash = path.find ('/');
+  string name  = path.substr (0, slash);
+  string rest  = slash != string::npos ? path.substr (slash + 1) : "";
+
+  auto p = m_pvr.find (name);
+  if (p == m_pvr.end ())
+  {
+    *response = mock_failure ("invalid_request");
+    return 404;
+  }
+
+  map<int, json> & items = p->second;
+
+  if (rest.empty ())
+  {
+    if (r.method == "GET")
+    {
+      json result = json::array ();
+      for (auto & i : items) result.push_back (i.second);
+      *response = mock_success (result);
+      return 200;
+    }
+
+    if (r.method == "POST" && name != "finished")
+    {
+      json item = json::parse (r.body, nullptr, false);
+      if (! item.is_object ())
+      {
+        *response = mock_failure ("invalid_request");
+        return 500;
+      }
+
+      int id = m_next_id++;
+      item ["id"] = id;
+      if (name == "programmed")
+      {
+        if (! item.contains ("end")) item ["end"] = item.value ("start", 0) + item.value ("duration", 0);
+        item ["state"]   = "waiting_start_time";
+        item ["error"]   = "none";
+        item ["enabled"] = true;
+      }
+      items [id] = item;
+      *response = mock_success (item);
+      return 200;
+    }
+  }
+  else
+  {
+    auto i = items.find (atoi (rest.c_str ()));
+    if (i == items.end ())
+    {
+      *response = mock_failure ("noent");
+      return 404;
+    }
+
+    if (r.method == "GET")
+    {
+      *response = mock_success (i->second);
+      return 200;
+    }
+
+    if (r.method == "PUT")
+    {
+      json patch = json::parse (r.body, nullptr, false);
+      if (patch.is_object ()) i->second.update (patch);
+      *response = mock_success (i->second);
+      return 200;
+    }
+
+    if (r.method == "DELETE")
+    {
+      items.erase (i);
+      *response = json {{"success", true}};
+      return 200;
+    }
+  }
+
+  *response = mock_failure ("invalid_request");
+  return 404;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// S O C K E T S ///////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+int MockServer::Start (int port)
+{
+  Stop ();
+  m_stop = false;
+
+  m_listen = socket (AF_INET, SOCK_STREAM, 0);
+  if (m_listen < 0) return -1;
+
+  int one = 1;
+  setsockopt (m_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
+  sockaddr_in address;
+  memset (&address, 0, sizeof (address));
+  address.sin_family      = AF_INET;
+  address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  address.sin_port        = htons (port);
+
+  socklen_t length = sizeof (address);
+  if (::bind (m_listen, (sockaddr *) &address, sizeof (address)) != 0 ||
+      listen (m_listen, 128) != 0 ||
+      getsockname (m_listen, (sockaddr *) &address, &length) != 0)
+  {
+    close (m_listen);
+    m_listen = -1;
+    return -1;
+  }
+
+  m_port   = ntohs (address.sin_port);
+  m_accept = thread (&MockServer::Accept, this);
+  return m_port;
+}
+
+void MockServer::Stop ()
+{
+  if (m_listen < 0) return;
+
+  m_stop = true;
+  shutdown (m_listen, SHUT_RDWR);
+  close (m_listen);
+  m_listen = -1;
+  if (m_accept.joinable ()) m_accept.join ();
+
+  unique_lock<mutex> lock (m_mutex);
+  for (int s : m_clients) shutdown (s, SHUT_RDWR);
+  m_idle.wait (lock, [this] {return m_active == 0;});
+}
+
+void MockServer::Accept ()
+{
+  while (! m_stop)
+  {
+    int s = accept (m_listen, nullptr, nullptr);
+    if (s < 0)
+    {
+      if (m_stop) break;
+      continue;
+    }
+
+    int one = 1;
+    setsockopt (s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+    {
+      lock_guard<mutex> lock (m_mutex);
+      m_clients.insert (s);
+      ++m_active;
+    }
+
+    thread (&MockServer::Serve, this, s).detach ();
+  }
+}
+
+void MockServer::Serve (int s)
+{
+  thread_local mt19937 random (random_device {} ());
+  uniform_real_distribution<double> uniform (0, 1);
+
+  string buffer;
+  char   chunk [16384];
+  bool   keep = true;
+
+  while (keep && ! m_stop)
+  {
+    // Head.
+    size_t end;
+    while ((end = buffer.find ("\r\n\r\n")) == string::npos && buffer.size () < MOCK_REQUEST_MAX)
+    {
+      ssize_t n = recv (s, chunk, sizeof (chunk), 0);
+      if (n <= 0) {keep = false; break;}
+      buffer.append (chunk, n);
+    }
+    if (! keep || end == string::npos) break;
+
+    Request r;
+    istringstream head (buffer.substr (0, end));
+    buffer.erase (0, end + 4);
+
+    string line, target, version;
+    getline (head, line);
+    istringstream (line) >> r.method >> target >> version;
+    r.path = target.substr (0, target.find ('?'));
+
+    while (getline (head, line))
+    {
+      if (! line.empty () && line.back () == '\r') line.pop_back ();
+      size_t colon = line.find (':');
+      if (colon == string::npos) continue;
+      size_t begin = line.find_first_not_of (" \t", colon + 1);
+      r.headers [mock_lower (line.substr (0, colon))] = begin != string::npos ? line.substr (begin) : "";
+    }
+
+    // Body.
+    size_t length = strtoull (r.headers ["content-length"].c_str (), nullptr, 10);
+    while (buffer.size () < length)
+    {
+      ssize_t n = recv (s, chunk, sizeof (chunk), 0);
+      if (n <= 0) {keep = false; break;}
+      buffer.append (chunk, n);
+    }
+    if (! keep) break;
+
+    r.body = buffer.substr (0, length);
+    buffer.erase (0, length);
+
+    ++m_requests;
+
+    keep = m_options.keepalive && mock_lower (r.headers ["connection"]) != "close";
+
+    Faults faults = GetFaults ();
+    int delay = faults.latency + (faults.jitter > 0 ? (int) (uniform (random) * faults.jitter) : 0);
+    if (delay > 0) this_thread::sleep_for (chrono::milliseconds (delay));
+
+    // Connection lost before the answer.
+    if (uniform (random) < faults.drops) break;
+
+    // Notifications: the connection is handed over.
+    if (mock_lower (r.headers ["upgrade"]) == "websocket")
+    {
+      ServeWebSocket (s, r, buffer);
+      break;
+    }
+
+    json response;
+    int  status = uniform (random) < faults.errors ? 500 : Answer (r, &response);
+    if (status == 500 && response.is_null ()) response = mock_failure ("internal_error");
+
+    if (! mock_send (s, mock_response (status, response, keep)))
+      keep = false;
+  }
+
+  close (s);
+
+  lock_guard<mutex> lock (m_mutex);
+  m_clients.erase (s);
+  if (--m_active == 0) m_idle.notify_all ();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// W E B S O C K E T ///////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+void MockServer::ServeWebSocket (int s, const Request & r, string & buffer)
+{
+  auto header = [&r] (const string & name)
+  {
+    auto f = r.headers.find (name);
+    return f != r.headers.end () ? f->second : string ();
+  };
+
+  string key = header ("sec-websocket-key");
+
+  int status = 101;
+  if (r.method != "GET" || r.path != WS_PATH)
+    status = 404;
+  else if (key.empty () || header ("sec-websocket-version") != "13")
+    status = 400;
+  else
+  {
+    lock_guard<mutex> lock (m_mutex);
+    if (m_session_token.empty () || header ("x-fbx-app-auth") != m_session_token)
+      status = 403;
+  }
+
+  if (status != 101)
+  {
+    mock_send (s, mock_response (status, mock_failure (status == 403 ? "auth_required" : "invalid_request"), false));
+    return;
+  }
+
+  // Accept key (RFC 6455, 4.2.2).
+  string accept = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+  unsigned char digest [SHA_DIGEST_LENGTH];
+  SHA1 ((const unsigned char *) accept.data (), accept.size (), digest);
+  unsigned char encoded [4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1];
+  EVP_EncodeBlock (encoded, digest, SHA_DIGEST_LENGTH);
+
+  {
+    lock_guard<mutex> lock (m_ws_mutex);
+    ostringstream oss;
+    oss << "HTTP/1.1 101 " << mock_reason (101) << "\r\n";
+    oss << "Upgrade: websocket\r\n";
+    oss << "Connection: Upgrade\r\n";
+    oss << "Sec-WebSocket-Accept: " << (const char *) encoded << "\r\n";
+    oss << "\r\n";
+    if (! mock_send (s, oss.str ())) return;
+    m_websockets [s];
+  }
+
+  string message;
+  for (;;)
+  {
+    if (! mock_recv (s, buffer, 2)) break;
+
+    bool     fin    = (buffer [0] & 0x80) != 0;
+    int      opcode =  buffer [0] & 0x0F;
+    bool     masked = (buffer [1] & 0x80) != 0;
+    uint64_t length =  buffer [1] & 0x7F;
+    size_t   offset = 2;
+
+    if (length >= 126)
+    {
+      size_t k = length == 126 ? 2 : 8;
+      if (! mock_recv (s, buffer, offset + k)) break;
+      length = 0;
+      for (size_t i = 0; i < k; ++i) length = (length << 8) | (unsigned char) buffer [offset + i];
+      offset += k;
+    }
+
+    // Client frames are masked (RFC 6455, 5.1), and small.
+    if (! masked || message.size () + length > MOCK_REQUEST_MAX)
+    {
+      lock_guard<mutex> lock (m_ws_mutex);
+      SendFrame (s, 0x8, string ("\x03\xea", 2));
+      break;
+    }
+
+    if (! mock_recv (s, buffer, offset + 4 + length)) break;
+    string payload = buffer.substr (offset + 4, length);
+    for (size_t i = 0; i < length; ++i) payload [i] ^= buffer [offset + i % 4];
+    buffer.erase (0, offset + 4 + length);
+
+    // Continuation, text.
+    if (opcode == 0x0 || opcode == 0x1)
+    {
+      message += payload;
+      if (fin)
+      {
+        Receive (s, message);
+        message.clear ();
+      }
+      continue;
+    }
+
+    // Ping.
+    if (opcode == 0x9)
+    {
+      lock_guard<mutex> lock (m_ws_mutex);
+      SendFrame (s, 0xA, payload);
+      continue;
+    }
+
+    // Pong.
+    if (opcode == 0xA)
+    {
+      lock_guard<mutex> lock (m_ws_mutex);
+      m_pong = payload;
+      continue;
+    }
+
+    // Close (echoing the status code), or anything else.
+    if (opcode == 0x8)
+    {
+      lock_guard<mutex> lock (m_ws_mutex);
+      SendFrame (s, 0x8, payload.substr (0, 2));
+    }
+    break;
+  }
+
+  lock_guard<mutex> lock (m_ws_mutex);
+  m_websockets.erase (s);
+}
+
+// Caller holds m_ws_mutex.
+bool MockServer::SendFrame (int s, int opcode, const string & payload, bool fin, bool masked)
+{
+  thread_local mt19937 random (random_device {} ());
+
+  string frame;
+  frame += (char) ((fin ? 0x80 : 0) | opcode);
+
+  size_t n = payload.size ();
+  char   m = masked ? (char) 0x80 : 0;
+  if (n < 126)
+    frame += (char) (m | n);
+  else if (n < 65536)
+  {
+    frame += (char) (m | 126);
+    for (int i = 1; i >= 0; --i) frame += (char) (n >> (8 * i));
+  }
+  else
+  {
+    frame += (char) (m | 127);
+    for (int i = 7; i >= 0; --i) frame += (char) ((uint64_t) n >> (8 * i));
+  }
+
+  if (masked)
+  {
+    char mask [4];
+    for (auto & b : mask) b = (char) random ();
+    frame.append (mask, 4);
+    for (size_t i = 0; i < n; ++i) frame += payload [i] ^ mask [i % 4];
+  }
+  else
+    frame += payload;
+
+  return mock_send (s, frame);
+}
+
+void MockServer::Receive (int s, const string & message)
+{
+  json m = json::parse (message, nullptr, false);
+  string action = m.is_object () ? m.value ("action", "") : "";
+
+  json answer;
+  if (action == "register" && m ["events"].is_array ())
+  {
+    set<string> events;
+    for (auto & e : m ["events"])
+      if (e.is_string ()) events.insert (e.get<string> ());
+
+    lock_guard<mutex> lock (m_ws_mutex);
+    m_websockets [s] = events;
+    answer = {{"action", action}, {"success", true}};
+  }
+  else
+    answer = {{"action", action}, {"success", false}, {"error_code", "invalid_request"}};
+
+  lock_guard<mutex> lock (m_ws_mutex);
+  SendFrame (s, 0x1, answer.dump ());
+}
+
+size_t MockServer::Notify (const string & source, const string & event, int fragments, bool masked)
+{
+  json n = {{"action", "notification"}, {"success", true},
+            {"source", source}, {"event", event}, {"result", json::object ()}};
+  string text = n.dump ();
+
+  // Fragments of (about) the same size.
+  size_t count = max (fragments, 1);
+  size_t size  = (text.size () + count - 1) / count;
+
+  lock_guard<mutex> lock (m_ws_mutex);
+  size_t reached = 0;
+  for (auto & w : m_websockets)
+  {
+    if (w.second.count (source + '_' + event) == 0) continue;
+
+    bool sent = true;
+    for (size_t i = 0, offset = 0; i < count && sent; ++i, offset += size)
+      sent = SendFrame (w.first, i == 0 ? 0x1 : 0x0, text.substr (min (offset, text.size ()), size), i + 1 == count, masked);
+
+    if (sent) ++reached;
+  }
+
+  return reached;
+}
+
+size_t MockServer::Ping (const string & payload)
+{
+  lock_guard<mutex> lock (m_ws_mutex);
+  size_t reached = 0;
+  for (auto & w : m_websockets)
+    if (SendFrame (w.first, 0x9, payload)) ++reached;
+  return reached;
+}
+
+string MockServer::Pong () const
+{
+  lock_guard<mutex> lock (m_ws_mutex);
+  return m_pong;
+}
+
+size_t MockServer::CloseWebSockets (int code)
+{
+  string status {(char) (code >> 8), (char) code};
+
+  lock_guard<mutex> lock (m_ws_mutex);
+  size_t reached = 0;
+  for (auto & w : m_websockets)
+    if (SendFrame (w.first, 0x8, status)) ++reached;
+  return reached;
+}
+
+size_t MockServer::DropWebSockets ()
+{
+  lock_guard<mutex> lock (m_ws_mutex);
+  for (auto & w : m_websockets)
+    shutdown (w.first, SHUT_RDWR);
+  return m_websockets.size ();
+}
+
+size_t MockServer::WebSockets () const
+{
+  lock_guard<mutex> lock (m_ws_mutex);
+  return m_websockets.size ();
+}
@@ -0,0 +1,160 @@
+#pragma once
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <map>
+#include <set>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <nlohmann/json.hpp>
+
+#include "Core.h"
+
+// Freebox OS stand-in: HTTP/1.1 (keep-alive) server for the login, TV, EPG
+// and PVR endpoints used by the add-on, and for the notifications (WebSocket),
+// over synthetic data of any size, with latency and errors injected on demand
+// (POSIX only).
+class MockServer
+{
+  public:
+    class Options
+    {
+      public:
+        int      channels   = 500;  // bouquet entries (one per channel)
+        int      conflicts  = 0;    // extra entries, reusing numbers and UUIDs
+        int      recordings = 100;
+        int      timers     = 20;
+        int      generators = 5;
+        bool     keepalive  = true;
+        unsigned seed       = 1;
+    };
+
+    // Faults (may change while running, see also POST /mock/faults).
+    class Faults
+    {
+      public:
+        int    latency = 0; // ms, before each answer
+        int    jitter  = 0; // ms, uniform, on top of latency
+        double errors  = 0; // probability of a 500
+        double drops   = 0; // probability of closing without answering
+
+      public:
+        nlohmann::json Json () const;
+        static Faults Parse (const nlohmann::json &);
+    };
+
+    // Synthetic data (deterministic).
+    static std::string    ChannelUUID (int channel);
+    static std::string    EventUUID   (int channel, time_t slot);
+    static nlohmann::json Event       (int channel, time_t slot, bool extended);
+    // Bouquet: one entry per channel (3 or 4 streams), then the conflicts.
+    static nlohmann::json Bouquet     (int channels, int conflicts, unsigned seed);
+    // Same bouquet (without conflicts), as the add-on loads it.
+    static Core::Channels ChannelList (int channels);
+    // EPG page: events starting within the hour, by channel ("result" only).
+    static nlohmann::json ByTime      (int channels, time_t hour);
+
+    static const std::string APP_TOKEN;
+    static const std::string CHALLENGE;
+    // Notifications (WebSocket, behind the session).
+    static const std::string WS_PATH;
+
+  protected:
+    class Request
+    {
+      public:
+        std::string                        method;
+        std::string                        path;  // without the query string
+        std::map<std::string, std::string> headers; // lowercase names
+        std::string                        body;
+    };
+
+  private:
+    Options                   m_options;
+    mutable std::mutex        m_mutex;
+    Faults                    m_faults;
+    // Data.
+    nlohmann::json            m_channels;
+    nlohmann::json            m_bouquet;
+    std::map<std::string, std::map<int, nlohmann::json>> m_pvr; // programmed, generator, finished
+    int                       m_next_id;
+    std::string               m_session_token;
+    // Sockets.
+    int                       m_listen;
+    int                       m_port;
+    std::thread               m_accept;
+    std::set<int>             m_clients;
+    int                       m_active;
+    std::condition_variable   m_idle;
+    std::atomic<bool>         m_stop;
+    std::atomic<size_t>       m_requests;
+    // WebSocket clients (socket > registered events); the lock also keeps
+    // the frames sent to a socket whole.
+    mutable std::mutex        m_ws_mutex;
+    std::map<int, std::set<std::string>> m_websockets;
+    std::string               m_pong;
+
+  protected:
+    void Accept ();
+    void Serve (int socket);
+    // Upgraded connection (the buffer holds what was read past the head).
+    void ServeWebSocket (int socket, const Request &, std::string & buffer);
+    bool SendFrame (int socket, int opcode, const std::string & payload, bool fin = true, bool masked = false);
+    // Client message (text).
+    void Receive (int socket, const std::string & message);
+    // Status code and JSON body.
+    int Answer (const Request &, nlohmann::json * response);
+    int AnswerLogin (const Request &, const std::string & path, nlohmann::json * response);
+    int AnswerTv    (const Request &, const std::string & path, nlohmann::json * response);
+    int AnswerPvr   (const Request &, const std::string & path, nlohmann::json * response);
+
+  public:
+    MockServer ();
+    MockServer (const Options &);
+    ~MockServer ();
+
+    // Port 0: any free port. Returns the port, or -1.
+    int  Start (int port = 0);
+    void Stop ();
+
+    std::string URL () const; // http://127.0.0.1:port
+    int    Port     () const {return m_port;}
+    size_t Requests () const {return m_requests;}
+
+    void   SetFaults (const Faults &);
+    Faults GetFaults () const;
+
+    // Notification to the clients registered for source_event, split into
+    // fragments, masked or not (clients reached).
+    size_t Notify (const std::string & source, const std::string & event, int fragments = 1, bool masked = false);
+    // Ping to every client, and the last pong payload received.
+    size_t      Ping (const std::string & payload);
+    std::string Pong () const;
+    // Close frame to every client (status code).
+    size_t CloseWebSockets (int code);
+    // Connections lost, without a close frame.
+    size_t DropWebSockets ();
+    // Connected clients.
+    size_t WebSockets () const;
+};
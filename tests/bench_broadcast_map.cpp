@@ -0,0 +1,149 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <set>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Bench.h"
+#include "Heap.h"
+#include "MockServer.h"
+#include "Core.h"
+
+using namespace std;
+
+// EPG dedup cache at a 14-day guide size (500 channels, half-hour events):
+// BroadcastMap versus the former set of URL strings, insert/lookup ns/op,
+// heap footprint, and eviction as days go by.
+//   bench_broadcast_map [--quick]
+int main (int argc, char ** argv)
+{
+  bool quick    = Bench::Quick (argc, argv);
+  int  channels = quick ? 50 : 500;
+  int  days     = quick ? 2 : 14;
+
+  time_t first = time (NULL) / 1800;
+  time_t slots = days * 48;
+
+  // Arrival order: page by page (hour by hour, every channel).
+  vector<unsigned int> ids;
+  vector<time_t>       expiries;
+  for (time_t s = first; s < first + slots; ++s)
+    for (int c = 1; c <= channels; ++c)
+    {
+      ids.push_back (Core::BroadcastId (MockServer::EventUUID (c, s)));
+      expiries.push_back ((s + 1) * 1800);
+    }
+
+  vector<unsigned int> shuffled = ids;
+  shuffle (shuffled.begin (), shuffled.end (), mt19937 (1));
+
+  // Not in the guide.
+  vector<unsigned int> missing;
+  for (size_t i = 0; i < ids.size (); ++i)
+    missing.push_back (Core::BroadcastId (MockServer::EventUUID (channels + 1 + i % 1000, first - 1 - i / 1000)));
+
+  auto report = [&] (const string & structure, const string & op, double ns)
+  {
+    Bench::Report ("broadcast_map", {{"structure", structure}, {"op", op}, {"n", ids.size ()}, {"ns_per_op", ns}});
+  };
+
+  // BroadcastMap.
+  {
+    size_t base = Heap::Reset ();
+    Core::BroadcastMap map;
+
+    report ("broadcast_map", "insert", Bench::NsPerOp (ids.size (), [&] (size_t i)
+    {
+      map.Update (ids [i], ids [i] * 2654435761u, expiries [i]);
+    }));
+    size_t footprint = Heap::Live () - base;
+    size_t peak      = Heap::Peak () - base;
+
+    report ("broadcast_map", "update_same", Bench::NsPerOp (ids.size (), [&] (size_t i)
+    {
+      Bench::Use (map.Update (shuffled [i], shuffled [i] * 2654435761u, 0));
+    }));
+
+    // Expiries back in place.
+    for (size_t i = 0; i < ids.size (); ++i)
+      map.Update (ids [i], ids [i] * 2654435761u, expiries [i]);
+
+    report ("broadcast_map", "lookup_hit", Bench::NsPerOp (shuffled.size (), [&] (size_t i)
+    {
+      Bench::Use (map.Contains (shuffled [i]));
+    }));
+
+    report ("broadcast_map", "lookup_miss", Bench::NsPerOp (missing.size (), [&] (size_t i)
+    {
+      Bench::Use (map.Contains (missing [i]));
+    }));
+
+    Bench::Report ("broadcast_map", {{"structure", "broadcast_map"}, {"op", "memory"}, {"n", map.Size ()},
+                                     {"bytes", footprint}, {"peak_bytes", peak},
+                                     {"bytes_per_id", (double) footprint / max<size_t> (map.Size (), 1)}});
+
+    // A day goes by, then another...
+    for (int d = 1; d <= days; ++d)
+    {
+      size_t before = map.Size ();
+      Bench::Clock::time_point start = Bench::Clock::now ();
+      map.Evict (first * 1800 + d * 86400 + 1);
+      Bench::Report ("broadcast_map", {{"structure", "broadcast_map"}, {"op", "evict_day"}, {"day", d},
+                                       {"evicted", before - map.Size ()}, {"ms", Bench::Ms (Bench::Clock::now () - start)}});
+    }
+
+    if (map.Size () != 0) return 1;
+  }
+
+  // Former cache: URL strings in a tree (key built for each event).
+  {
+    static const string PREFIX = "/api/v6/tv/epg/programs/pluri_";
+
+    size_t base = Heap::Reset ();
+    set<string> cache;
+
+    report ("string_set", "insert", Bench::NsPerOp (ids.size (), [&] (size_t i)
+    {
+      cache.insert (PREFIX + to_string (ids [i]));
+    }));
+    size_t footprint = Heap::Live () - base;
+    size_t peak      = Heap::Peak () - base;
+
+    report ("string_set", "lookup_hit", Bench::NsPerOp (shuffled.size (), [&] (size_t i)
+    {
+      Bench::Use (cache.count (PREFIX + to_string (shuffled [i])));
+    }));
+
+    report ("string_set", "lookup_miss", Bench::NsPerOp (missing.size (), [&] (size_t i)
+    {
+      Bench::Use (cache.count (PREFIX + to_string (missing [i])));
+    }));
+
+    Bench::Report ("broadcast_map", {{"structure", "string_set"}, {"op", "memory"}, {"n", cache.size ()},
+                                     {"bytes", footprint}, {"peak_bytes", peak},
+                                     {"bytes_per_id", (double) footprint / max<size_t> (cache.size (), 1)}});
+  }
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string>
+
+#include "Bench.h"
+#include "MockServer.h"
+#include "Core.h"
+
+using namespace std;
+
+// Channel refresh diff (ChannelDiff) for large bouquets: time per diff,
+// unchanged list, 1 % of logos changed, 1 % of channels added and removed,
+// every stream URL changed.
+//   bench_channel_diff [--quick]
+int main (int argc, char ** argv)
+{
+  bool quick = Bench::Quick (argc, argv);
+
+  for (int n : {1000, 5000, 10000, 50000})
+  {
+    if (quick && n > 1000) break;
+
+    const Core::Channels before = MockServer::ChannelList (n);
+
+    Core::Channels same = before;
+
+    Core::Channels logos = before;
+    for (auto & c : logos)
+      if (c.first % 100 == 0) c.second.logo += "?v=2";
+
+    Core::Channels moved = before;
+    for (unsigned int id = 50; id <= (unsigned int) n; id += 100)
+    {
+      moved.erase (id);
+      moved.emplace (n + id, moved.begin ()->second);
+    }
+
+    Core::Channels streams;
+    for (auto & c : before)
+    {
+      vector<Core::Stream> s = c.second.streams;
+      for (auto & x : s) x.rtsp += "&v=2";
+      streams.emplace (c.first, Core::Channel (c.second.uuid, c.second.name, c.second.logo, c.second.major, c.second.minor, s));
+    }
+
+    struct Case {const char * name; const Core::Channels * after; size_t changes;};
+    for (const Case & k : {Case {"same",    &same,    0},
+                           Case {"logos",   &logos,   (size_t) n / 100},
+                           Case {"moved",   &moved,   (size_t) (2 * ((n + 50) / 100))},
+                           Case {"streams", &streams, (size_t) n}})
+    {
+      int loops = max (1, 200000 / n);
+      size_t changes = 0;
+
+      double ns = Bench::NsPerOp (loops, [&] (size_t)
+      {
+        Core::ChannelDiff diff (before, *k.after);
+        changes = diff.added.size () + diff.removed.size () + diff.updated.size ();
+      });
+
+      Bench::Report ("channel_diff", {{"channels", n}, {"case", k.name}, {"changes", changes}, {"us", ns / 1000}});
+      if (changes != k.changes) return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <set>
+#include <random>
+#include <string>
+#include <algorithm>
+
+#include "Bench.h"
+#include "ConflictsReference.h"
+#include "MockServer.h"
+#include "Core.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Random bouquet of n entries over a number of UUIDs and channel numbers,
+// within the reference's domain (see reference_resolve_conflicts).
+static json bench_bouquet (int n, int uuids, int numbers, unsigned seed)
+{
+  mt19937 random (seed);
+  set<pair<int, int>> taken, pairs;
+
+  json bouquet = json::array ();
+  for (int attempts = 0; (int) bouquet.size () < n && attempts < 20 * n; ++attempts)
+  {
+    int uuid  = random () % uuids + 1;
+    int major = random () % numbers + 1;
+    int minor = random () % 4;
+    if (! taken.insert ({major, minor}).second || ! pairs.insert ({uuid, major}).second) continue;
+
+    bouquet.push_back ({{"uuid", MockServer::ChannelUUID (uuid)}, {"number", major}, {"sub_number", minor}});
+  }
+  return bouquet;
+}
+
+// Bouquet conflict resolution from 500 to 50,000 entries: sort-based
+// resolver versus the former one, with about as many UUIDs and channel
+// numbers as entries (light), or 4 entries per UUID and per number (heavy).
+//   bench_conflicts [--quick]
+int main (int argc, char ** argv)
+{
+  bool quick = Bench::Quick (argc, argv);
+  int  limit = quick ? 5000 : 50000;
+
+  for (const string profile : {"light", "heavy"})
+    for (int n : {500, 1000, 5000, 10000, 50000})
+    {
+      if (n > limit) break;
+
+      json bouquet = profile == "light" ? bench_bouquet (n, n * 10 / 11, n * 20 / 21, n)
+                                            : bench_bouquet (n, n / 4, n / 4, n);
+
+      int loops = max (1, 20000 / n);
+
+      double sorted    = Bench::NsPerOp (loops, [&] (size_t) {Bench::Use (Core::ResolveConflicts (bouquet));});
+      double reference = Bench::NsPerOp (loops, [&] (size_t) {Bench::Use (reference_resolve_conflicts (bouquet));});
+
+      Bench::Report ("conflicts", {{"profile",      profile},
+                                   {"entries",      bouquet.size ()},
+                                   {"channels",     Core::ResolveConflicts (bouquet).size ()},
+                                   {"sorted_ms",    sorted / 1e6},
+                                   {"reference_ms", reference / 1e6}});
+    }
+
+  return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+#include "MockServer.h"
+#include "Core.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+typedef Core::Source  Source;
+typedef Core::Quality Quality;
+
+// CPU hot paths, on synthetic inputs at a realistic size and 10 times that:
+// ns/op, one JSON line per path and scale.
+//   bench_core [--quick]
+int main (int argc, char ** argv)
+{
+  bool quick = Bench::Quick (argc, argv);
+  int  loops = quick ? 1 : 20;
+
+  for (int scale : {1, 10})
+  {
+    int channels = 500 * scale;
+    int events   = 1000 * scale; // an hour of the guide, extended
+
+    // Inputs.
+    time_t slot = time (NULL) / 1800;
+    vector<json> documents;
+    for (int i = 0; i < events; ++i)
+      documents.push_back (MockServer::Event (i % channels + 1, slot + i / channels, true));
+
+    json bouquet = MockServer::Bouquet (channels, channels / 10, 1);
+
+    vector<string> channel_uuids, event_uuids;
+    for (int c = 1; c <= channels; ++c) channel_uuids.push_back (MockServer::ChannelUUID (c));
+    for (const json & d : documents)    event_uuids.push_back (d ["id"].get<string> ());
+
+    auto report = [scale] (const string & path, size_t n, double ns)
+    {
+      Bench::Report ("core", {{"path", path}, {"scale", scale}, {"n", n}, {"ns_per_op", ns}});
+    };
+
+    // Event from JSON, cast included.
+    vector<Core::Event> parsed;
+    report ("event_json", documents.size (), Bench::NsPerOp (documents.size () * loops, [&] (size_t i)
+    {
+      if (i < documents.size ())
+        parsed.emplace_back (documents [i], Core::ChannelId (channel_uuids [i % channels]), 0);
+      else
+        Bench::Use (Core::Event (documents [i % documents.size ()], 1, 0));
+    }));
+
+    // Cast folding (actors, director).
+    report ("cast", parsed.size (), Bench::NsPerOp (parsed.size () * loops, [&] (size_t i)
+    {
+      const Core::Event & e = parsed [i % parsed.size ()];
+      Bench::Use (e.GetCastActors ());
+      Bench::Use (e.GetCastDirector ());
+    }));
+
+    // Core part of the EPG tag mapping (the Kodi setters aside).
+    report ("tag_fields", parsed.size (), Bench::NsPerOp (parsed.size () * loops, [&] (size_t i)
+    {
+      const Core::Event & e = parsed [i % parsed.size ()];
+      Bench::Use (Core::BroadcastId (e.uuid));
+      Bench::Use (Core::Event::Colors (e.category));
+      Bench::Use (Core::Event::Native (e.category));
+    }));
+
+    // Bouquet conflict resolution (whole bouquet per op).
+    report ("conflicts", bouquet.size (), Bench::NsPerOp (loops, [&] (size_t)
+    {
+      Bench::Use (Core::ResolveConflicts (bouquet));
+    }));
+
+    // Channel from a bouquet entry: streams, then the best stream index.
+    vector<Core::Channel> built;
+    report ("channel", channels, Bench::NsPerOp (channels * loops, [&] (size_t i)
+    {
+      const json & entry = bouquet [i % channels];
+      vector<Core::Stream> streams;
+      for (const json & s : entry ["streams"]) streams.emplace_back (s);
+      Core::Channel c (entry ["uuid"], "", "", entry ["number"], entry ["sub_number"], streams);
+      if (i < (size_t) channels) built.push_back (c); else Bench::Use (c);
+    }));
+
+    // Stream selection, for every source/quality setting.
+    static const Source  SOURCES   [] = {Source::DEFAULT, Source::AUTO, Source::IPTV, Source::DVB};
+    static const Quality QUALITIES [] = {Quality::DEFAULT, Quality::AUTO, Quality::HD, Quality::SD, Quality::LD, Quality::STEREO};
+    report ("stream_select", built.size () * 24, Bench::NsPerOp (built.size () * 24 * loops, [&] (size_t i)
+    {
+      Bench::Use (built [(i / 24) % built.size ()].GetStream (SOURCES [i % 4], QUALITIES [i / 4 % 6]));
+    }));
+
+    // IDs.
+    report ("channel_id", channel_uuids.size (), Bench::NsPerOp (channel_uuids.size () * loops, [&] (size_t i)
+    {
+      Bench::Use (Core::ChannelId (channel_uuids [i % channel_uuids.size ()]));
+    }));
+
+    report ("broadcast_id", event_uuids.size (), Bench::NsPerOp (event_uuids.size () * loops, [&] (size_t i)
+    {
+      Bench::Use (Core::BroadcastId (event_uuids [i % event_uuids.size ()]));
+    }));
+  }
+
+  return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+#include "Bench.h"
+#include "Heap.h"
+#include "MockServer.h"
+#include "Core.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+// DOM: the whole page, then an Event per element.
+static size_t epg_dom (const string & body, vector<Core::Event> * events)
+{
+  json page = json::parse (body, nullptr, false);
+  if (! page.is_object () || ! page.value ("success", false)) return 0;
+
+  const json & result = page ["result"];
+  for (auto i = result.begin (); i != result.end (); ++i)
+    if (i.key ().compare (0, 11, "uuid-webtv-") == 0 && i->is_array ())
+      for (const json & e : *i)
+        events->emplace_back (e, Core::ChannelId (i.key ()), 0);
+
+  return events->size ();
+}
+
+// SAX: Events straight from the tokens.
+static size_t epg_sax (const string & body, vector<Core::Event> * events)
+{
+  Core::EpgParser parser ([events] (const Core::Event & e) {events->push_back (e);});
+  if (! json::sax_parse (body, &parser) || ! parser.IsSuccess ()) return 0;
+  return events->size ();
+}
+
+// EPG pages (by_time), DOM versus SAX: events/sec, peak heap above the body.
+//   bench_epg [--quick] [recorded page.json ...]
+int main (int argc, char ** argv)
+{
+  bool quick = Bench::Quick (argc, argv);
+
+  vector<pair<string, string>> pages;
+  for (int i = 1; i < argc; ++i)
+    if (argv [i][0] != '-')
+    {
+      ifstream ifs (argv [i], ios::binary);
+      ostringstream oss;
+      oss << ifs.rdbuf ();
+      pages.emplace_back (argv [i], oss.str ());
+    }
+
+  if (pages.empty ())
+  {
+    time_t hour = time (NULL) / 3600 * 3600;
+    for (int channels : {100, 500, 1000})
+      pages.emplace_back ("synthetic-" + to_string (channels),
+                          json {{"success", true}, {"result", MockServer::ByTime (channels, hour)}}.dump ());
+  }
+
+  int rounds = quick ? 1 : 20;
+
+  for (auto & page : pages)
+  {
+    for (auto path : {make_pair ("dom", epg_dom), make_pair ("sax", epg_sax)})
+    {
+      size_t events = 0, peak = 0, allocations = 0;
+      Bench::Clock::duration elapsed {};
+
+      for (int r = 0; r < rounds; ++r)
+      {
+        vector<Core::Event> result;
+        result.reserve (4096);
+
+        size_t base = Heap::Reset ();
+
+        Bench::Clock::time_point start = Bench::Clock::now ();
+        events   = path.second (page.second, &result);
+        elapsed += Bench::Clock::now () - start;
+
+        peak        = Heap::Peak () - base;
+        allocations = Heap::Count ();
+      }
+
+      Bench::Report ("epg", {{"page",         page.first},
+                             {"bytes",        page.second.size ()},
+                             {"path",         path.first},
+                             {"events",       events},
+                             {"events_per_s", events * rounds * 1000.0 / max (Bench::Ms (elapsed), 1e-3)},
+                             {"peak_bytes",   peak},
+                             {"allocations",  allocations}});
+
+      if (events == 0) return 1;
+    }
+  }
+
+  return 0;
+}
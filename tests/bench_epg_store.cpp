@@ -0,0 +1,121 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+#include "MockServer.h"
+#include "Core.h"
+
+using namespace std;
+
+// Linear reference: every event overlapping [start, end).
+static void epg_scan (const map<time_t, Core::Event> & m, time_t start, time_t end, vector<Core::Event> * events)
+{
+  for (auto & i : m)
+    if (i.second.date < end && i.second.date + i.second.duration > start)
+      events->push_back (i.second);
+}
+
+// GetEPGForChannel range queries over the in-memory store
+// (per channel, by start time): latency per window, 500 channels x 14 days.
+//   bench_epg_store [--quick]
+int main (int argc, char ** argv)
+{
+  bool quick    = Bench::Quick (argc, argv);
+  int  channels = quick ? 50 : 500;
+  int  days     = quick ? 2 : 14;
+  int  queries  = quick ? 1000 : 20000;
+
+  // Half-hour events, from now on.
+  time_t first = time (NULL) / 1800;
+  time_t slots = days * 48;
+
+  map<unsigned int, map<time_t, Core::Event>> store;
+  size_t total = 0;
+  for (int c = 1; c <= channels; ++c)
+    for (time_t s = first; s < first + slots; ++s)
+    {
+      Core::Event e (MockServer::Event (c, s, false), c, 0);
+      store [c].emplace (e.date, e);
+      ++total;
+    }
+
+  mt19937 random (1);
+
+  for (auto window : {make_pair ("1h", 3600), make_pair ("1d", 86400), make_pair ("all", (int) slots * 1800)})
+  {
+    for (bool scan : {false, true})
+    {
+      // The scan is only a reference: fewer queries.
+      int n = scan ? queries / 10 : queries;
+
+      vector<double> latencies;
+      size_t found = 0;
+
+      for (int q = 0; q < n; ++q)
+      {
+        unsigned int c     = random () % channels + 1;
+        time_t       start = first * 1800 + random () % max<time_t> (slots * 1800 - window.second, 1) + 900;
+        time_t       end   = start + window.second;
+
+        vector<Core::Event> events;
+        Bench::Clock::time_point t = Bench::Clock::now ();
+        {
+          auto f = store.find (c);
+          if (f != store.end ())
+          {
+            if (scan) epg_scan (f->second, start, end, &events);
+            else Core::EventsBetween (f->second, start, end, &events);
+          }
+        }
+        latencies.push_back (Bench::Ns (Bench::Clock::now () - t) / 1000);
+        found += events.size ();
+
+        // Same answer as the scan.
+        if (q % 97 == 0 && ! scan)
+        {
+          vector<Core::Event> reference;
+          epg_scan (store [c], start, end, &reference);
+          if (reference.size () != events.size () ||
+              (! events.empty () && (events.front ().uuid != reference.front ().uuid ||
+                                     events.back  ().uuid != reference.back  ().uuid)))
+            return 1;
+        }
+      }
+
+      Bench::Report ("epg_store", {{"channels", channels},
+                                   {"days",     days},
+                                   {"events",   total},
+                                   {"window",   window.first},
+                                   {"method",   scan ? "scan" : "lower_bound"},
+                                   {"queries",  n},
+                                   {"avg_hits", (double) found / n},
+                                   {"p50_us",   Bench::Percentile (latencies, 0.50)},
+                                   {"p99_us",   Bench::Percentile (latencies, 0.99)}});
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <cstdlib>
+
+#include "Bench.h"
+#include "MockServer.h"
+#include "Http.h"
+
+using namespace std;
+
+// HttpPool against the local stand-in: requests/sec, p50/p99 latency,
+// kept-alive connections versus one connection per request.
+//   bench_http [--quick] [requests per thread] [threads]
+int main (int argc, char ** argv)
+{
+  bool quick = Bench::Quick (argc, argv);
+  vector<int> args;
+  for (int i = 1; i < argc; ++i)
+    if (argv [i][0] != '-') args.push_back (atoi (argv [i]));
+
+  int requests = args.size () > 0 ? args [0] : (quick ? 50 : 5000);
+  int threads  = args.size () > 1 ? args [1] : 4;
+
+  for (bool keepalive : {true, false})
+  {
+    MockServer::Options options;
+    options.channels  = 50;
+    options.keepalive = keepalive;
+
+    MockServer server (options);
+    if (server.Start () < 0) return 1;
+
+    for (const string & path : {string ("/api/v6/login/"), string ("/api/v6/tv/channels")})
+    {
+      HttpPool pool (threads);
+      const string url = server.URL () + path;
+
+      vector<vector<double>> latencies (threads);
+      vector<thread> workers;
+      size_t failures = 0;
+      mutex m;
+
+      Bench::Clock::time_point start = Bench::Clock::now ();
+      for (int t = 0; t < threads; ++t)
+        workers.emplace_back ([&, t] ()
+        {
+          size_t failed = 0;
+          string body;
+          for (int i = 0; i < requests; ++i)
+          {
+            Bench::Clock::time_point s = Bench::Clock::now ();
+            body.clear ();
+            if (pool.Request ("GET", url, {}, "", &body) != 200) ++failed;
+            latencies [t].push_back (Bench::Ms (Bench::Clock::now () - s));
+          }
+          lock_guard<mutex> lock (m);
+          failures += failed;
+        });
+      for (auto & w : workers) w.join ();
+      double elapsed = Bench::Ms (Bench::Clock::now () - start);
+
+      vector<double> all;
+      for (auto & l : latencies) all.insert (all.end (), l.begin (), l.end ());
+
+      HttpPool::Stats stats = pool.GetStats ();
+      Bench::Report ("http", {{"path",        path},
+                              {"keepalive",   keepalive},
+                              {"threads",     threads},
+                              {"requests",    all.size ()},
+                              {"failures",    failures},
+                              {"connections", stats.connections},
+                              {"rps",         all.size () * 1000.0 / elapsed},
+                              {"p50_ms",      Bench::Percentile (all, 0.50)},
+                              {"p99_ms",      Bench::Percentile (all, 0.99)}});
+
+      if (failures > 0) return 1;
+    }
+  }
+
+  return 0;
+}
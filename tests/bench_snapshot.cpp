@@ -0,0 +1,148 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "Bench.h"
+#include "MockServer.h"
+#include "Core.h"
+
+using namespace std;
+
+typedef shared_ptr<const Core::Channels> Snapshot;
+
+// Kodi callbacks against a background refresh: zap latency and reads/sec,
+// immutable snapshots (atomic swap) versus a single recursive mutex also
+// held by the refresh and across the EPG thread's HTTP calls (as before).
+//   bench_snapshot [--quick] [readers]
+int main (int argc, char ** argv)
+{
+  bool quick    = Bench::Quick (argc, argv);
+  int  readers  = argc > 1 && argv [argc - 1][0] != '-' ? atoi (argv [argc - 1]) : 4;
+  int  channels = 1000;
+  auto duration = chrono::milliseconds (quick ? 200 : 3000);
+
+  const Core::Channels list = MockServer::ChannelList (channels);
+
+  for (bool locked : {false, true})
+  {
+    Snapshot             snapshot = make_shared<const Core::Channels> (list);
+    Core::Channels       shared   = list;
+    recursive_mutex      m;
+    atomic<bool>         stop (false);
+    atomic<size_t>       refreshes (0);
+    vector<vector<double>> latencies (readers);
+    vector<size_t>       listings (readers, 0);
+
+    // Channel refresh: a new list every 50 ms.
+    thread writer ([&] ()
+    {
+      while (! stop)
+      {
+        Core::Channels next = list;
+        next.begin ()->second.name += '*';
+        if (locked)
+        {
+          lock_guard<recursive_mutex> lock (m);
+          shared = move (next);
+        }
+        else
+          atomic_store (&snapshot, Snapshot (make_shared<const Core::Channels> (move (next))));
+        ++refreshes;
+        this_thread::sleep_for (chrono::milliseconds (50));
+      }
+    });
+
+    // EPG thread: a 20 ms HTTP call every 100 ms (under the lock, before).
+    thread epg ([&] ()
+    {
+      while (! stop)
+      {
+        if (locked)
+        {
+          lock_guard<recursive_mutex> lock (m);
+          this_thread::sleep_for (chrono::milliseconds (20));
+        }
+        else
+          this_thread::sleep_for (chrono::milliseconds (20));
+        this_thread::sleep_for (chrono::milliseconds (80));
+      }
+    });
+
+    // Kodi: zaps (lookup and stream selection), and a full listing now and then.
+    vector<thread> workers;
+    for (int r = 0; r < readers; ++r)
+      workers.emplace_back ([&, r] ()
+      {
+        mt19937 random (r);
+        for (size_t i = 0; ! stop; ++i)
+        {
+          unsigned int id = random () % channels + 1;
+          Bench::Clock::time_point start = Bench::Clock::now ();
+
+          if (locked)
+          {
+            lock_guard<recursive_mutex> lock (m);
+            auto f = shared.find (id);
+            if (f != shared.end ()) Bench::Use (f->second.GetStream (Core::Source::AUTO, Core::Quality::AUTO));
+            if (i % 100 == 0) {for (auto & c : shared) Bench::Use (c.second.name); ++listings [r];}
+          }
+          else
+          {
+            Snapshot s = atomic_load (&snapshot);
+            auto f = s->find (id);
+            if (f != s->end ()) Bench::Use (f->second.GetStream (Core::Source::AUTO, Core::Quality::AUTO));
+            if (i % 100 == 0) {for (auto & c : *s) Bench::Use (c.second.name); ++listings [r];}
+          }
+
+          latencies [r].push_back (Bench::Ns (Bench::Clock::now () - start) / 1000);
+        }
+      });
+
+    this_thread::sleep_for (duration);
+    stop = true;
+    for (auto & w : workers) w.join ();
+    writer.join ();
+    epg.join ();
+
+    vector<double> all;
+    for (auto & l : latencies) all.insert (all.end (), l.begin (), l.end ());
+    size_t stalls = count_if (all.begin (), all.end (), [] (double us) {return us > 1000;});
+
+    Bench::Report ("snapshot", {{"mode",      locked ? "mutex" : "snapshot"},
+                                {"readers",   readers},
+                                {"channels",  channels},
+                                {"refreshes", refreshes.load ()},
+                                {"reads_per_s", all.size () / chrono::duration<double> (duration).count ()},
+                                {"p50_us",    Bench::Percentile (all, 0.50)},
+                                {"p99_us",    Bench::Percentile (all, 0.99)},
+                                {"max_us",    Bench::Percentile (all, 1.00)},
+                                {"stalls_1ms", stalls}});
+  }
+
+  return 0;
+}
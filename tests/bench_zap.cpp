@@ -0,0 +1,179 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "Bench.h"
+#include "Core.h"
+
+using namespace std;
+
+typedef Core::Source   Source;
+typedef Core::Quality  Quality;
+typedef Core::Protocol Protocol;
+typedef vector<pair<string, string>> Properties;
+
+// Settings as the add-on keeps them.
+class Settings
+{
+  public:
+    mutable Core::SharedMutex        mutex;
+    Source                           source   = Source::IPTV;
+    Quality                          quality  = Quality::HD;
+    Protocol                         protocol = Protocol::RTSP;
+    map<unsigned int, Source>        sources;
+    map<unsigned int, Quality>       qualities;
+};
+
+// Former tune: a lock per setting, every stream scored, a debug line.
+static void zap_scan (const Settings & settings, const Core::Channels & channels, unsigned int id, Properties * properties)
+{
+  Source source;
+  {
+    Core::SharedMutex::Shared lock (settings.mutex);
+    auto f = settings.sources.find (id);
+    source = f != settings.sources.end () ? f->second : settings.source;
+  }
+  Quality quality;
+  {
+    Core::SharedMutex::Shared lock (settings.mutex);
+    auto f = settings.qualities.find (id);
+    quality = f != settings.qualities.end () ? f->second : settings.quality;
+  }
+  Protocol protocol;
+  {
+    Core::SharedMutex::Shared lock (settings.mutex);
+    protocol = settings.protocol;
+  }
+
+  auto f = channels.find (id);
+  if (f == channels.end ()) return;
+
+  int index = -1, score = -1;
+  for (size_t i = 0; i < f->second.streams.size (); ++i)
+  {
+    int s = f->second.streams [i].score (source, quality);
+    if (s > score) index = i, score = s;
+  }
+
+  if (index >= 0)
+  {
+    const Core::Stream & s = f->second.streams [index];
+    char line [512];
+    snprintf (line, sizeof (line), "GetStreamProperties: '%s' (index = %d, score = %d)", s.rtsp.c_str (), index, score);
+    Bench::Use (line);
+
+    properties->emplace_back ("streamurl", protocol == Protocol::HLS ? s.hls : s.rtsp);
+    properties->emplace_back ("isrealtimestream", "true");
+  }
+}
+
+// Current tune: one lock, precomputed best stream.
+static void zap_table (const Settings & settings, const Core::Channels & channels, unsigned int id, Properties * properties)
+{
+  auto f = channels.find (id);
+  if (f == channels.end ()) return;
+
+  int      index;
+  Protocol protocol;
+  {
+    Core::SharedMutex::Shared lock (settings.mutex);
+    auto s = settings.sources.find (id);
+    auto q = settings.qualities.find (id);
+    protocol = settings.protocol;
+    index = f->second.GetStream (s != settings.sources.end   () ? s->second : settings.source,
+                                 q != settings.qualities.end () ? q->second : settings.quality);
+  }
+
+  if (index >= 0)
+  {
+    const string * url = f->second.streams [index].GetURL (protocol);
+    if (url != nullptr) properties->emplace_back ("streamurl", *url);
+    properties->emplace_back ("isrealtimestream", "true");
+  }
+}
+
+// Channel switch overhead (stream selection and its locking, no network):
+// 1,000 channels of 6 streams, random zaps, some channels with preferences.
+//   bench_zap [--quick]
+int main (int argc, char ** argv)
+{
+  bool   quick = Bench::Quick (argc, argv);
+  size_t zaps  = quick ? 10000 : 2000000;
+  int    n     = 1000;
+
+  Core::Channels channels;
+  for (int c = 1; c <= n; ++c)
+  {
+    string base = "rtsp://mafreebox.freebox.fr/fbxtv_pub/stream?namespace=1&service=" + to_string (c);
+    string hls  = "http://mafreebox.freebox.fr/api/v6/tv/hls/" + to_string (c);
+    vector<Core::Stream> streams = {
+      {Source::IPTV, Quality::HD,     base + "&flavour=hd", hls + "/hd.m3u8"},
+      {Source::IPTV, Quality::SD,     base + "&flavour=sd", hls + "/sd.m3u8"},
+      {Source::IPTV, Quality::LD,     base + "&flavour=ld", hls + "/ld.m3u8"},
+      {Source::IPTV, Quality::STEREO, base + "&flavour=3d", hls + "/3d.m3u8"},
+      {Source::DVB,  Quality::HD,     "rtsp://mafreebox.freebox.fr/freeboxtv/" + to_string (c) + "?hd", ""},
+      {Source::DVB,  Quality::SD,     "rtsp://mafreebox.freebox.fr/freeboxtv/" + to_string (c) + "?sd", ""}};
+    channels.emplace (c, Core::Channel ("uuid-webtv-" + to_string (c), "Chaîne " + to_string (c), "", c, 0, streams));
+  }
+
+  Settings settings;
+  for (int c = 1; c <= n; c += 10)
+  {
+    settings.sources   [c] = Source::DVB;
+    settings.qualities [c] = Quality::AUTO;
+  }
+
+  mt19937 random (1);
+  vector<unsigned int> ids (zaps);
+  for (auto & id : ids) id = random () % n + 1;
+
+  for (auto zap : {make_pair ("scan", zap_scan), make_pair ("table", zap_table)})
+  {
+    Properties properties;
+    properties.reserve (2);
+
+    double ns = Bench::NsPerOp (zaps, [&] (size_t i)
+    {
+      properties.clear ();
+      zap.second (settings, channels, ids [i], &properties);
+      Bench::Use (properties);
+    });
+
+    Bench::Report ("zap", {{"method", zap.first}, {"channels", n}, {"streams", 6}, {"zaps", zaps}, {"ns_per_zap", ns}});
+  }
+
+  // Same stream either way.
+  for (unsigned int id = 1; id <= (unsigned int) n; ++id)
+  {
+    Properties a, b;
+    zap_scan  (settings, channels, id, &a);
+    zap_table (settings, channels, id, &b);
+    if (a != b) return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+#include "MockServer.h"
+
+using namespace std;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void mock_stop (int)
+{
+  g_stop = 1;
+}
+
+static void usage (const char * name)
+{
+  cerr << "Usage: " << name << " [--port N] [--channels N] [--conflicts N]"
+       << " [--recordings N] [--timers N] [--generators N] [--seed N]"
+       << " [--latency MS] [--jitter MS] [--errors P] [--drops P] [--close]" << endl;
+}
+
+// Freebox OS stand-in, until interrupted:
+// point the add-on (or the benchmarks) at http://127.0.0.1:<port>.
+int main (int argc, char ** argv)
+{
+  MockServer::Options options;
+  MockServer::Faults  faults;
+  int port = 8080;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    string a = argv [i];
+    if (a == "--close") {options.keepalive = false; continue;}
+    if (a == "--help")  {usage (argv [0]); return 0;}
+    if (i + 1 >= argc)  {usage (argv [0]); return 1;}
+
+    const char * v = argv [++i];
+    if      (a == "--port")       port               = atoi (v);
+    else if (a == "--channels")   options.channels   = atoi (v);
+    else if (a == "--conflicts")  options.conflicts  = atoi (v);
+    else if (a == "--recordings") options.recordings = atoi (v);
+    else if (a == "--timers")     options.timers     = atoi (v);
+    else if (a == "--generators") options.generators = atoi (v);
+    else if (a == "--seed")       options.seed       = strtoul (v, nullptr, 10);
+    else if (a == "--latency")    faults.latency     = atoi (v);
+    else if (a == "--jitter")     faults.jitter      = atoi (v);
+    else if (a == "--errors")     faults.errors      = atof (v);
+    else if (a == "--drops")      faults.drops       = atof (v);
+    else {usage (argv [0]); return 1;}
+  }
+
+  MockServer server (options);
+  server.SetFaults (faults);
+  if (server.Start (port) < 0)
+  {
+    cerr << "mock_freebox: can't listen on port " << port << ": " << strerror (errno) << endl;
+    return 1;
+  }
+
+  signal (SIGINT,  mock_stop);
+  signal (SIGTERM, mock_stop);
+
+  cout << "mock_freebox: " << server.URL () << " (" << options.channels << " channels)" << endl;
+  while (! g_stop)
+    this_thread::sleep_for (chrono::milliseconds (100));
+
+  server.Stop ();
+  cout << "mock_freebox: " << server.Requests () << " requests" << endl;
+  return 0;
+}
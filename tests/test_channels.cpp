@@ -0,0 +1,71 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string>
+#include <vector>
+
+#include "Check.h"
+#include "MockServer.h"
+#include "Core.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+typedef Core::Source  Source;
+typedef Core::Quality Quality;
+
+// Channel cache (channels.json): what is read back equals what was live,
+// so a warm start finds no change.
+static void check_round_trip (const Core::Channel & c)
+{
+  Core::Channel cached (json::parse (c.Json ().dump ()));
+  CHECK (cached == c);
+
+  for (int s = -1; s <= (int) Source::DVB; ++s)
+    for (int q = -1; q <= (int) Quality::STEREO; ++q)
+      CHECK (cached.GetStream ((Source) s, (Quality) q) == c.GetStream ((Source) s, (Quality) q));
+}
+
+int main ()
+{
+  for (auto & i : MockServer::ChannelList (100))
+    check_round_trip (i.second);
+
+  // Every source and quality, as parsed from the API
+  // (unknown or empty types and qualities included).
+  vector<Core::Stream> streams;
+  for (const char * type : {"iptv", "dvb", "", "satellite"})
+    for (const char * quality : {"auto", "hd", "sd", "ld", "3d", "", "4k"})
+      streams.emplace_back (json {{"type", type}, {"quality", quality}, {"rtsp", string ("rtsp://") + type + '/' + quality}, {"hls", ""}});
+
+  CHECK (streams [2 * 7].source == Source::AUTO);
+  CHECK (streams [3 * 7].source == Source::DEFAULT);
+
+  check_round_trip (Core::Channel ("uuid-webtv-1", "Chaîne", "", 1, 0, streams));
+
+  for (auto & s : streams)
+    check_round_trip (Core::Channel ("uuid-webtv-2", "Chaîne", "", 2, 1, {s}));
+
+  // Hidden (no stream).
+  check_round_trip (Core::Channel ("uuid-webtv-3", "", "", 3, 0, {}));
+
+  return Check::Result ();
+}
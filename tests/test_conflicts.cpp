@@ -0,0 +1,95 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <set>
+#include <random>
+#include <string>
+
+#include "Check.h"
+#include "ConflictsReference.h"
+#include "MockServer.h"
+#include "Core.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+static bool same_conflicts (const map<int, Core::Conflict> & a, const map<int, Core::Conflict> & b)
+{
+  if (a.size () != b.size ()) return false;
+  for (auto i = a.begin (), j = b.begin (); i != a.end (); ++i, ++j)
+    if (i->first != j->first ||
+        tie (i->second.uuid, i->second.major, i->second.minor, i->second.position) !=
+        tie (j->second.uuid, j->second.major, j->second.minor, j->second.position))
+      return false;
+  return true;
+}
+
+int main ()
+{
+  // Differential: random bouquets, within the reference's domain.
+  mt19937 random (42);
+  for (int t = 0; t < 3000; ++t)
+  {
+    int entries = 1 + random () % 200;
+    int uuids   = 1 + random () % 150;
+    int majors  = 1 + random () % 150;
+
+    json bouquet = json::array ();
+    set<pair<int, int>> numbers, pairs;
+    for (int i = 0; i < entries; ++i)
+    {
+      int u = random () % uuids, major = random () % majors, minor = random () % 4;
+      if (! numbers.insert ({major, minor}).second || ! pairs.insert ({u, major}).second) continue;
+      bouquet.push_back ({{"uuid", "uuid-webtv-" + to_string (u)}, {"number", major}, {"sub_number", minor}});
+    }
+
+    CHECK (same_conflicts (Core::ResolveConflicts (bouquet), reference_resolve_conflicts (bouquet)));
+  }
+
+  // Generated bouquet: every channel kept.
+  CHECK (Core::ResolveConflicts (MockServer::Bouquet (500, 0, 1)).size () == 500);
+
+  // Hand-made: lowest minor wins a major, a UUID keeps its lowest major.
+  json bouquet = json::array ({
+    {{"uuid", "uuid-webtv-1"}, {"number", 1}, {"sub_number", 1}},
+    {{"uuid", "uuid-webtv-2"}, {"number", 1}, {"sub_number", 0}},
+    {{"uuid", "uuid-webtv-2"}, {"number", 2}, {"sub_number", 0}},
+    {{"uuid", "uuid-webtv-1"}, {"number", 3}, {"sub_number", 0}}});
+  auto result = Core::ResolveConflicts (bouquet);
+  CHECK (result.size () == 2);
+  CHECK (result.count (1) && result.at (1).uuid == "uuid-webtv-2" && result.at (1).position == 1);
+  CHECK (result.count (3) && result.at (3).uuid == "uuid-webtv-1");
+
+  // Malformed entries are skipped, not undefined behaviour.
+  json malformed = json::array ({
+    {{"uuid", "uuid-webtv-1"}, {"number", 1}},
+    {{"number", 2}, {"sub_number", 0}},
+    {{"uuid", "uuid-webtv-3"}},
+    nullptr,
+    "uuid-webtv-4"});
+  result = Core::ResolveConflicts (malformed);
+  CHECK (result.size () == 1);
+  CHECK (result.count (1) && result.at (1).minor == 0);
+
+  CHECK (Core::ResolveConflicts (json::array ()).empty ());
+
+  return Check::Result ();
+}
@@ -0,0 +1,92 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+#include <vector>
+
+#include "Check.h"
+#include "Core.h"
+
+using namespace std;
+
+int main ()
+{
+  const time_t H   = 1700000000 - 1700000000 % 3600;
+  const time_t now = H + 1800;
+  const time_t ttl = 12 * 3600;
+
+  Core::Coverage c;
+
+  // Nothing fetched: every hour, begin rounded down, end excluded.
+  CHECK (c.Missing (H - 7200 + 600, H + 7200, now, ttl) == (vector<time_t> {H - 7200, H - 3600, H, H + 3600}));
+  CHECK (c.Missing (H, H + 7200 + 1, now, ttl) == (vector<time_t> {H, H + 3600, H + 7200}));
+  CHECK (c.Missing (H, H, now, ttl).empty ());
+
+  // Covered hours are skipped.
+  for (unsigned int channel : {1, 2, 3})
+  {
+    c.Fetch (H,        channel, now);
+    c.Fetch (H + 3600, channel, now);
+  }
+  CHECK (c.Missing (H - 3600, H + 7200, now, ttl) == (vector<time_t> {H - 3600}));
+  CHECK (c.Fetched (H) == now);
+  CHECK (c.Fetched (H, 2) == now);
+  CHECK (c.Fetched (H, 4) == 0);
+  CHECK (c.Fetched (H - 3600) == 0);
+
+  // TTL: an hour is as old as its oldest channel, stale from the TTL on.
+  c.Fetch (H, 2, now - ttl + 1);
+  CHECK (c.Fetched (H) == now - ttl + 1);
+  CHECK (c.Missing (H, H + 7200, now, ttl).empty ());
+  CHECK (c.Missing (H, H + 7200, now + 1, ttl) == (vector<time_t> {H}));
+  c.Fetch (H, 2, now);
+
+  // Queued hours are not asked for twice; a failed one (released, not
+  // fetched) is backfilled.
+  c.Request (H - 3600, now);
+  CHECK (c.IsRequested (H - 3600));
+  CHECK (c.Missing (H - 3600, H + 7200, now, ttl).empty ());
+  c.Release (H - 3600);
+  CHECK (! c.IsRequested (H - 3600));
+  CHECK (c.Missing (H - 3600, H + 7200, now, ttl) == (vector<time_t> {H - 3600}));
+
+  // A gap in an hour (new channel): backfilled, then covered again.
+  c.Invalidate (4);
+  CHECK (c.Fetched (H) == 0);
+  CHECK (c.Fetched (H, 1) == now);
+  CHECK (c.Missing (H, H + 7200, now, ttl) == (vector<time_t> {H, H + 3600}));
+  c.Fetch (H, 4, now);
+  CHECK (c.Missing (H, H + 7200, now, ttl) == (vector<time_t> {H + 3600}));
+
+  // A channel gone: no longer a gap.
+  c.Erase (4);
+  CHECK (c.Missing (H, H + 7200, now, ttl).empty ());
+
+  // Hours with a fetch date only.
+  CHECK (c.Hours () == (map<time_t, time_t> {{H, now}, {H + 3600, now}}));
+
+  // Drop: hours before the date, the boundary hour is kept.
+  c.Fetch (H - 3600, 1, now);
+  c.Drop (H);
+  CHECK (c.Fetched (H - 3600) == 0);
+  CHECK (c.Fetched (H) == now);
+  CHECK (c.Missing (H - 3600, H + 7200, now, ttl) == (vector<time_t> {H - 3600}));
+
+  return Check::Result ();
+}
@@ -0,0 +1,84 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+#include <string>
+
+#include "Check.h"
+#include "Core.h"
+
+using namespace std;
+
+int main ()
+{
+  Core::Digests d;
+
+  const string timers     = "/api/v6/pvr/programmed/";
+  const string recordings = "/api/v6/pvr/finished/";
+  const string epg        = "/api/v6/tv/epg/by_time/3600";
+
+  size_t a = Core::Digests::Hash ("[1, 2, 3]");
+  size_t b = Core::Digests::Hash ("[1, 2, 3, 4]");
+  CHECK (a == Core::Digests::Hash ("[1, 2, 3]"));
+  CHECK (a != b);
+
+  // Nothing recorded yet.
+  CHECK (! d.IsSame (timers, a));
+
+  // Same body after a record, not another one.
+  d.Record (timers, a, 10);
+  CHECK (d.IsSame (timers, a));
+  CHECK (! d.IsSame (timers, b));
+  CHECK (! d.IsSame (recordings, a));
+
+  // The last record wins.
+  d.Record (timers, b, 10);
+  CHECK (d.IsSame (timers, b));
+  CHECK (! d.IsSame (timers, a));
+
+  // Forget: by prefix, the other queries are kept.
+  d.Record (recordings, a, 20);
+  d.Record (epg,        a, 30);
+  d.Forget ("/api/v6/pvr/");
+  CHECK (! d.IsSame (timers,     b));
+  CHECK (! d.IsSame (recordings, a));
+  CHECK (d.IsSame (epg, a));
+
+  // Close neighbours are kept.
+  d.Record ("/api/v6/pvrx", a, 0);
+  d.Forget ("/api/v6/pvr/");
+  CHECK (d.IsSame ("/api/v6/pvrx", a));
+
+  // Forgotten queries are recorded again.
+  d.Record (timers, a, 10);
+  CHECK (d.IsSame (timers, a));
+
+  // Hits and misses (and the processing time saved by the hits).
+  Core::Digests s;
+  s.Record (epg, a, 12.5);
+  s.IsSame (epg, a);
+  s.IsSame (epg, a);
+  s.IsSame (epg, b);
+  s.IsSame (timers, a);
+  CHECK (s.str () == "2/4 unchanged (50.0%), 25.0 ms saved");
+
+  CHECK (Core::Digests ().str () == "0/0 unchanged (0.0%), 0.0 ms saved");
+
+  return Check::Result ();
+}
@@ -0,0 +1,63 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string>
+
+#include "Check.h"
+#include "MockServer.h"
+#include "Http.h"
+
+using namespace std;
+
+int main ()
+{
+  MockServer server;
+  int port = server.Start ();
+  CHECK (port > 0);
+
+  HttpPool pool (1);
+  const string url = server.URL () + "/api/v6/login/";
+  string body;
+
+  CHECK (pool.Request ("GET", url, {}, "", &body) == 200);
+  CHECK (pool.Request ("GET", url, {}, "", &body) == 200);
+  CHECK (pool.GetStats ().connections == 1);
+  CHECK (pool.GetStats ().reused == 1);
+
+  // The server restarts: the kept-alive connection is stale.
+  server.Stop ();
+  CHECK (server.Start (port) == port);
+
+  // GET: retried on a new connection, the stale attempt isn't a failure.
+  CHECK (pool.Request ("GET", url, {}, "", &body) == 200);
+  CHECK (pool.GetStats ().connections == 2);
+  CHECK (pool.GetStats ().failures == 0);
+
+  server.Stop ();
+  CHECK (server.Start (port) == port);
+
+  // POST: may have reached the server, not retried.
+  CHECK (pool.Request ("POST", server.URL () + "/api/v6/login/authorize", {}, "{}", &body) < 0);
+  CHECK (pool.GetStats ().failures == 1);
+  CHECK (pool.Request ("POST", server.URL () + "/api/v6/login/authorize", {}, "{}", &body) == 200);
+
+  return Check::Result ();
+}
@@ -0,0 +1,139 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string>
+
+#include "Check.h"
+#include "MockServer.h"
+#include "Core.h"
+#include "Http.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+// GET, with the session header if any: status and "result".
+static int mock_get (HttpPool & pool, const string & url, const string & session, json * result)
+{
+  HttpPool::Headers headers;
+  if (! session.empty ()) headers.emplace_back ("X-Fbx-App-Auth", session);
+
+  string body;
+  int status = pool.Request ("GET", url, headers, "", &body);
+  if (status > 0 && result)
+  {
+    json j = json::parse (body, nullptr, false);
+    *result = j.is_object () ? j.value ("result", json ()) : json ();
+  }
+  return status;
+}
+
+static int mock_post (HttpPool & pool, const string & url, const json & request, json * result)
+{
+  string body;
+  int status = pool.Request ("POST", url, {{"Content-Type", "application/json"}}, request.dump (), &body);
+  if (status > 0 && result)
+  {
+    json j = json::parse (body, nullptr, false);
+    *result = j.is_object () ? j.value ("result", json ()) : json ();
+  }
+  return status;
+}
+
+int main ()
+{
+  MockServer::Options options;
+  options.channels   = 50;
+  options.conflicts  = 10;
+  options.recordings = 7;
+  options.timers     = 3;
+  options.generators = 2;
+
+  MockServer server (options);
+  CHECK (server.Start () > 0);
+
+  HttpPool pool (4);
+  const string api = server.URL () + "/api/v6";
+  json result;
+
+  // Login flow.
+  CHECK (mock_get (pool, api + "/login/", "", &result) == 200);
+  CHECK (result.value ("logged_in", true) == false);
+
+  CHECK (mock_post (pool, api + "/login/authorize", {{"app_id", "pvr.freebox"}}, &result) == 200);
+  string token = result.value ("app_token", "");
+  CHECK (token == MockServer::APP_TOKEN);
+
+  CHECK (mock_get (pool, api + "/login/authorize/" + to_string (result.value ("track_id", 0)), "", &result) == 200);
+  CHECK (result.value ("status", "") == "granted");
+  string challenge = result.value ("challenge", "");
+
+  CHECK (mock_post (pool, api + "/login/session", {{"app_id", "pvr.freebox"}, {"password", "wrong"}}, &result) == 403);
+  CHECK (mock_post (pool, api + "/login/session", {{"app_id", "pvr.freebox"}, {"password", Core::Password (token, challenge)}}, &result) == 200);
+  string session = result.value ("session_token", "");
+  CHECK (! session.empty ());
+
+  // PVR, behind the session.
+  CHECK (mock_get (pool, api + "/pvr/finished/", "", nullptr) == 403);
+  CHECK (mock_get (pool, api + "/pvr/finished/",   session, &result) == 200 && result.size () == 7);
+  CHECK (mock_get (pool, api + "/pvr/programmed/", session, &result) == 200 && result.size () == 3);
+  CHECK (mock_get (pool, api + "/pvr/generator/",  session, &result) == 200 && result.size () == 2);
+  for (const json & g : result) Core::Generator generator (g);
+
+  // Channels and bouquet.
+  CHECK (mock_get (pool, api + "/tv/channels", session, &result) == 200 && result.size () == 50);
+  CHECK (mock_get (pool, api + "/tv/bouquets/freeboxtv/channels", session, &result) == 200 && result.size () == 60);
+  auto conflicts = Core::ResolveConflicts (result);
+  CHECK (conflicts.size () >= 40 && conflicts.size () <= 50);
+
+  // EPG, by time (SAX), by channel and extended.
+  time_t hour = time (NULL) / 3600 * 3600;
+  size_t events = 0;
+  Core::EpgParser parser ([&events] (const Core::Event & e) {if (e.channel > 0) ++events;});
+  string body;
+  CHECK (pool.Request ("GET", api + "/tv/epg/by_time/" + to_string (hour), {}, "", &body) == 200);
+  CHECK (json::sax_parse (body, &parser) && parser.IsSuccess ());
+  CHECK (events == 2 * 50);
+
+  CHECK (mock_get (pool, api + "/tv/epg/by_channel/" + MockServer::ChannelUUID (7) + '/' + to_string (hour), "", &result) == 200);
+  CHECK (result.size () == 12);
+
+  time_t slot = time (NULL) / 1800;
+  CHECK (mock_get (pool, api + "/tv/epg/programs/" + MockServer::EventUUID (7, slot), "", &result) == 200);
+  CHECK (result == MockServer::Event (7, slot, true));
+  CHECK (result ["cast"].size () == 5);
+
+  // Faults.
+  MockServer::Faults faults;
+  faults.errors = 1;
+  server.SetFaults (faults);
+  CHECK (mock_get (pool, api + "/tv/channels", "", nullptr) == 500);
+
+  faults.errors = 0;
+  faults.drops  = 1;
+  server.SetFaults (faults);
+  CHECK (mock_get (pool, api + "/tv/channels", "", nullptr) < 0);
+
+  server.SetFaults (MockServer::Faults ());
+  CHECK (mock_get (pool, api + "/tv/channels", "", nullptr) == 200);
+
+  server.Stop ();
+  return Check::Result ();
+}
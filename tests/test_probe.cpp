@@ -0,0 +1,279 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+#include <map>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "Check.h"
+#include "Http.h"
+
+using namespace std;
+
+// Local TCP responder: one connection at a time, handed to a handler.
+class Responder
+{
+  private:
+    int                        m_listen;
+    int                        m_port;
+    thread                     m_accept;
+    function<void (int)>       m_handler;
+
+  public:
+    Responder (const function<void (int)> & handler) :
+      m_listen (socket (AF_INET, SOCK_STREAM, 0)),
+      m_port (-1),
+      m_accept (),
+      m_handler (handler)
+    {
+      sockaddr_in address;
+      memset (&address, 0, sizeof (address));
+      address.sin_family      = AF_INET;
+      address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+      socklen_t length = sizeof (address);
+      if (::bind (m_listen, (sockaddr *) &address, sizeof (address)) != 0 ||
+          listen (m_listen, 16) != 0 ||
+          getsockname (m_listen, (sockaddr *) &address, &length) != 0)
+        return;
+
+      m_port   = ntohs (address.sin_port);
+      m_accept = thread ([this]
+      {
+        for (int s; (s = accept (m_listen, nullptr, nullptr)) >= 0;)
+        {
+          m_handler (s);
+          close (s);
+        }
+      });
+    }
+
+    ~Responder ()
+    {
+      shutdown (m_listen, SHUT_RDWR);
+      close (m_listen);
+      if (m_accept.joinable ()) m_accept.join ();
+    }
+
+    int Port () const {return m_port;}
+};
+
+// Request head ("" once the connection is closed).
+static string read_head (int s)
+{
+  string head;
+  char c;
+  while (head.find ("\r\n\r\n") == string::npos && recv (s, &c, 1, 0) == 1)
+    head += c;
+  return head.find ("\r\n\r\n") != string::npos ? head : "";
+}
+
+static string header (const string & head, const string & name)
+{
+  size_t k = head.find ("\r\n" + name + ": ");
+  if (k == string::npos) return "";
+  k += name.length () + 4;
+  return head.substr (k, head.find ("\r\n", k) - k);
+}
+
+static void write_all (int s, const string & data)
+{
+  for (size_t offset = 0; offset < data.size ();)
+  {
+    ssize_t n = send (s, data.data () + offset, data.size () - offset, MSG_NOSIGNAL);
+    if (n <= 0) return;
+    offset += n;
+  }
+}
+
+// Until the client hangs up.
+static void drain (int s)
+{
+  char buffer [1024];
+  while (recv (s, buffer, sizeof (buffer), 0) > 0);
+}
+
+// MPEG-TS packet, flagged as a random access point or not.
+static string ts_packet (bool keyframe)
+{
+  string p (188, '\xff');
+  p [0] = 0x47;
+  p [1] = 0x01;
+  p [2] = 0x00;
+  p [3] = keyframe ? 0x30 : 0x10;
+  if (keyframe)
+  {
+    p [4] = 7;
+    p [5] = 0x40;
+  }
+  return p;
+}
+
+// RTP over RTSP (interleaved, channel 0).
+static string rtp_frame (const string & payload, int channel = 0)
+{
+  string rtp = string ("\x80\x21\x00\x01" "\x00\x00\x00\x00" "\x12\x34\x56\x78", 12) + payload;
+  string frame = "$";
+  frame += (char) channel;
+  frame += (char) (rtp.size () >> 8);
+  frame += (char) rtp.size ();
+  return frame + rtp;
+}
+
+static string rtsp_answer (const string & cseq, const string & headers = "", const string & body = "")
+{
+  return "RTSP/1.0 200 OK\r\nCSeq: " + cseq + "\r\n" + headers +
+         "Content-Length: " + to_string (body.size ()) + "\r\n\r\n" + body;
+}
+
+static string http_answer (int status, const string & body, size_t length)
+{
+  return "HTTP/1.1 " + to_string (status) + (status == 200 ? " OK" : " Not Found") + "\r\n"
+         "Content-Length: " + to_string (length) + "\r\n"
+         "Connection: close\r\n\r\n" + body;
+}
+
+inline double elapsed (chrono::steady_clock::time_point start)
+{
+  return chrono::duration<double, milli> (chrono::steady_clock::now () - start).count ();
+}
+
+int main ()
+{
+  // RTSP: DESCRIBE, SETUP (first media), PLAY, then RTP with an RTSP message
+  // in between whose body looks like an interleaved frame.
+  string setup, session;
+  bool stall = false;
+  Responder rtsp ([&] (int s)
+  {
+    for (string head; ! (head = read_head (s)).empty ();)
+    {
+      string method = head.substr (0, head.find (' '));
+      string cseq   = header (head, "CSeq");
+
+      if (method == "DESCRIBE")
+      {
+        string sdp = "v=0\r\ns=probe\r\nt=0 0\r\na=control:*\r\n"
+                     "m=video 0 RTP/AVP 33\r\na=control:trackID=0\r\n";
+        write_all (s, rtsp_answer (cseq, "Content-Base: rtsp://127.0.0.1:" + to_string (rtsp.Port ()) + "/live/\r\n"
+                                         "Content-Type: application/sdp\r\n", sdp));
+      }
+      else if (method == "SETUP")
+      {
+        setup = head.substr (6, head.find (' ', 6) - 6);
+        write_all (s, rtsp_answer (cseq, "Session: 1234;timeout=60\r\nTransport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n"));
+      }
+      else if (method == "PLAY")
+      {
+        session = header (head, "Session");
+        write_all (s, rtsp_answer (cseq));
+
+        if (stall)
+        {
+          // A frame that never ends.
+          write_all (s, string ("$\x00\x01\x00", 4) + ts_packet (false).substr (0, 16));
+          drain (s);
+          return;
+        }
+
+        string body = string ("$\x00\xff\xff", 4) + "not a frame";
+        write_all (s, rtp_frame (ts_packet (false) + ts_packet (false)));
+        write_all (s, rtp_frame ("RTCP", 1));
+        write_all (s, "GET_PARAMETER rtsp://127.0.0.1/live/ RTSP/1.0\r\nCSeq: 1\r\n"
+                      "Content-Length: " + to_string (body.size ()) + "\r\n\r\n" + body);
+        write_all (s, rtp_frame (ts_packet (false) + ts_packet (true)));
+      }
+      else
+        write_all (s, rtsp_answer (cseq));
+    }
+  });
+  CHECK (rtsp.Port () > 0);
+
+  string live = "rtsp://127.0.0.1:" + to_string (rtsp.Port ()) + "/live/";
+  StreamProbe::Result r = StreamProbe::Probe (live, 5000);
+  CHECK (r.first_byte >= 0);
+  CHECK (r.first_frame >= r.first_byte);
+  CHECK (setup == live + "trackID=0");
+  CHECK (session == "1234");
+
+  // A stalled stream: the probe gives up at the deadline (not the I/O timeout).
+  stall = true;
+  auto start = chrono::steady_clock::now ();
+  r = StreamProbe::Probe (live, 500);
+  CHECK (r.first_byte >= 0);
+  CHECK (r.first_frame < 0);
+  CHECK (elapsed (start) < 2000);
+
+  // HLS: master playlist, variant (relative URIs), MPEG-TS segment.
+  string ts;
+  for (int i = 0; i < 20; ++i) ts += ts_packet (i == 15);
+  map<string, string> files =
+  {
+    {"/hls/master.m3u8", "#EXTM3U\n#EXT-X-STREAM-INF:BANDWIDTH=800000\nlow/index.m3u8\n"},
+    {"/hls/low/index.m3u8", "#EXTM3U\n#EXT-X-TARGETDURATION:2\n#EXTINF:2.0,\nsegment-0.ts\n"},
+    {"/hls/low/segment-0.ts", ts},
+    {"/stall/index.m3u8", "#EXTM3U\n#EXTINF:2.0,\nsegment-0.ts\n"}
+  };
+  Responder hls ([&files] (int s)
+  {
+    string head = read_head (s);
+    string path = head.substr (4, head.find (' ', 4) - 4);
+
+    if (path == "/stall/segment-0.ts")
+    {
+      // Promised, never sent.
+      write_all (s, http_answer (200, ts_packet (false), 100 * 188));
+      drain (s);
+      return;
+    }
+
+    auto f = files.find (path);
+    if (f == files.end ())
+      write_all (s, http_answer (404, "", 0));
+    else
+      write_all (s, http_answer (200, f->second, f->second.size ()));
+  });
+  CHECK (hls.Port () > 0);
+
+  string server = "http://127.0.0.1:" + to_string (hls.Port ());
+  r = StreamProbe::Probe (server + "/hls/master.m3u8", 5000);
+  CHECK (r.first_byte >= 0);
+  CHECK (r.first_frame >= r.first_byte);
+
+  r = StreamProbe::Probe (server + "/hls/missing.m3u8", 5000);
+  CHECK (r.first_byte < 0);
+  CHECK (r.first_frame < 0);
+
+  start = chrono::steady_clock::now ();
+  r = StreamProbe::Probe (server + "/stall/index.m3u8", 500);
+  CHECK (r.first_byte >= 0);
+  CHECK (r.first_frame < 0);
+  CHECK (elapsed (start) < 2000);
+
+  return Check::Result ();
+}
@@ -0,0 +1,154 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+#include <string>
+#include <vector>
+
+#include "Check.h"
+#include "Core.h"
+
+using namespace std;
+
+typedef Core::Queries Queries;
+typedef Core::Query   Query;
+
+// Paths, in popping order.
+static vector<string> drain (Queries & queries, time_t now)
+{
+  vector<string> paths;
+  Query q;
+  while (queries.Pop (&q, now))
+    paths.push_back (q.query);
+  return paths;
+}
+
+static Query hour_query (time_t hour)
+{
+  return Query (Core::FULL, "/api/v6/tv/epg/by_time/" + to_string (hour), 0, hour);
+}
+
+int main ()
+{
+  // Half past an hour.
+  const time_t now  = 1700000000 - 1700000000 % 3600 + 1800;
+  const time_t hour = now - 1800;
+
+  // Priority classes: urgent, current (closest first), soon, past (latest
+  // first), later (earliest first).
+  {
+    Queries queries;
+    queries.Push (hour_query (hour + 48 * 3600));
+    queries.Push (hour_query (hour - 10 * 3600));
+    queries.Push (hour_query (hour + 30 * 3600));
+    queries.Push (hour_query (hour + 10 * 3600));
+    queries.Push (hour_query (hour - 5 * 3600));
+    queries.Push (hour_query (hour + 3600));
+    queries.Push (hour_query (hour));
+    queries.Push (hour_query (hour + 5 * 3600));
+    queries.Push (Query (Core::CHANNEL, "/api/v6/tv/epg/by_channel/uuid-webtv-1/" + to_string (hour), 1, hour), true);
+
+    CHECK (queries.Size () == 9);
+    CHECK (queries.Size (Core::FULL) == 8);
+    CHECK (queries.Size (Core::CHANNEL) == 1);
+    CHECK (queries.Size (Queries::URGENT,  now) == 1);
+    CHECK (queries.Size (Queries::CURRENT, now) == 2);
+    CHECK (queries.Size (Queries::SOON,    now) == 2);
+    CHECK (queries.Size (Queries::PAST,    now) == 2);
+    CHECK (queries.Size (Queries::LATER,   now) == 2);
+
+    vector<string> expected =
+    {
+      "/api/v6/tv/epg/by_channel/uuid-webtv-1/" + to_string (hour),
+      hour_query (hour).query,
+      hour_query (hour + 3600).query,
+      hour_query (hour + 5 * 3600).query,
+      hour_query (hour + 10 * 3600).query,
+      hour_query (hour - 5 * 3600).query,
+      hour_query (hour - 10 * 3600).query,
+      hour_query (hour + 30 * 3600).query,
+      hour_query (hour + 48 * 3600).query
+    };
+    CHECK (drain (queries, now) == expected);
+    CHECK (queries.Empty ());
+    CHECK (queries.Size (Core::FULL) == 0);
+  }
+
+  // Same priority, same air time: first in, first out (urgent ones too).
+  {
+    Queries queries;
+    for (int i = 0; i < 5; ++i)
+      queries.Push (Query (Core::EVENT, "/api/v6/tv/epg/programs/pluri_" + to_string (i), i, hour));
+    for (int i = 0; i < 3; ++i)
+      queries.Push (Query (Core::CHANNEL, "/api/v6/tv/epg/by_channel/" + to_string (i), i, hour), true);
+
+    vector<string> expected;
+    for (int i = 0; i < 3; ++i) expected.push_back ("/api/v6/tv/epg/by_channel/" + to_string (i));
+    for (int i = 0; i < 5; ++i) expected.push_back ("/api/v6/tv/epg/programs/pluri_" + to_string (i));
+    CHECK (drain (queries, now) == expected);
+  }
+
+  // Event details interleaved by air time, not appended.
+  {
+    Queries queries;
+    queries.Push (hour_query (hour + 5 * 3600));
+    queries.Push (hour_query (hour - 5 * 3600));
+    queries.Push (Query (Core::EVENT, "/api/v6/tv/epg/programs/now", 1, now));
+
+    Query q;
+    CHECK (queries.Pop (&q, now) && q.type == Core::EVENT);
+  }
+
+  // Re-queued channel/date queries: once, until popped.
+  {
+    Queries queries;
+    Query channel (Core::CHANNEL, "/api/v6/tv/epg/by_channel/uuid-webtv-7/" + to_string (hour), 7, hour);
+    Query later (Core::CHANNEL, "/api/v6/tv/epg/by_channel/uuid-webtv-7/" + to_string (hour + 3600), 7, hour + 3600);
+
+    CHECK (queries.Push (hour_query (hour)));
+    CHECK (! queries.Push (hour_query (hour)));
+    CHECK (queries.Push (channel, true));
+    CHECK (! queries.Push (channel, true));
+    CHECK (! queries.Push (channel));
+    CHECK (queries.Push (later));
+    CHECK (queries.Size () == 3);
+    CHECK (queries.Size (Core::CHANNEL) == 2);
+
+    // Urgent now: moved ahead, not duplicated.
+    CHECK (! queries.Push (later, true));
+    CHECK (queries.Size () == 3);
+    CHECK (queries.Size (Queries::URGENT, now) == 2);
+
+    vector<string> expected = {channel.query, later.query, hour_query (hour).query};
+    CHECK (drain (queries, now) == expected);
+
+    // Popped: queued again.
+    CHECK (queries.Push (channel, true));
+    CHECK (queries.Push (hour_query (hour)));
+    CHECK (queries.Size () == 2);
+  }
+
+  // Nothing to pop.
+  Queries empty;
+  Query q;
+  CHECK (! empty.Pop (&q, now));
+  CHECK (empty.Empty ());
+
+  return Check::Result ();
+}
@@ -0,0 +1,122 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+#include <chrono>
+
+#include "Check.h"
+#include "Http.h"
+
+using namespace std;
+
+typedef HttpThrottle::Clock Clock;
+
+inline Clock::duration ms (int n)
+{
+  return chrono::milliseconds (n);
+}
+
+int main ()
+{
+  // Starts halfway between the floor and the ceiling.
+  HttpThrottle t (1, 9);
+  CHECK (t.GetRate () == 5);
+  CHECK (t.GetLatency () == 0);
+
+  // Bounds clamp the current rate.
+  t.SetBounds (1, 3);
+  CHECK (t.GetRate () == 3);
+  t.SetBounds (4, 8);
+  CHECK (t.GetRate () == 4);
+
+  // A ceiling below the floor is raised to the floor.
+  HttpThrottle flat (2, 1);
+  CHECK (flat.GetRate () == 2);
+
+  // Slots are spaced by 1/rate.
+  HttpThrottle s (10, 10);
+  Clock::time_point a = s.Reserve ();
+  Clock::time_point b = s.Reserve ();
+  Clock::time_point c = s.Reserve ();
+  CHECK (a <= Clock::now ());
+  CHECK (b - a == chrono::milliseconds (100));
+  CHECK (c - b == chrono::milliseconds (100));
+
+  // Additive increase while fast, by 1/20 of the range, up to the ceiling.
+  HttpThrottle up (1, 21);
+  CHECK (up.Feedback (200, ms (10)) == HttpThrottle::INCREASE);
+  CHECK (up.GetRate () == 12);
+  for (int i = 0; i < 8; ++i) up.Feedback (200, ms (10));
+  CHECK (up.GetRate () == 20);
+  CHECK (up.Feedback (200, ms (10)) == HttpThrottle::INCREASE);
+  CHECK (up.GetRate () == 21);
+  CHECK (up.Feedback (200, ms (10)) == HttpThrottle::HOLD);
+  CHECK (up.GetRate () == 21);
+
+  // Multiplicative decrease on failure, at most once per second.
+  for (int status : {-1, 429, 500, 503})
+  {
+    HttpThrottle down (1, 15);
+    CHECK (down.Feedback (status, ms (10)) == HttpThrottle::DECREASE);
+    CHECK (down.GetRate () == 4);
+    CHECK (down.Feedback (status, ms (10)) == HttpThrottle::HOLD);
+    CHECK (down.GetRate () == 4);
+  }
+
+  // Client errors are the server answering fast.
+  HttpThrottle client (1, 21);
+  CHECK (client.Feedback (404, ms (10)) == HttpThrottle::INCREASE);
+
+  // Never below the floor.
+  HttpThrottle floor (4, 6);
+  CHECK (floor.Feedback (500, ms (10)) == HttpThrottle::DECREASE);
+  CHECK (floor.GetRate () == 4);
+  HttpThrottle pinned (3, 3);
+  CHECK (pinned.Feedback (500, ms (10)) == HttpThrottle::HOLD);
+  CHECK (pinned.GetRate () == 3);
+
+  // Latency: EWMA (1/5 weight on the last sample), failures excluded.
+  HttpThrottle window (1, 21);
+  window.Feedback (200, ms (100));
+  CHECK (window.GetLatency () == 100);
+  window.Feedback (200, ms (200));
+  CHECK (window.GetLatency () == 120);
+  window.Feedback (-1, chrono::seconds (30));
+  CHECK (window.GetLatency () == 120);
+
+  // A single slow answer is smoothed out...
+  HttpThrottle spike (1, 21);
+  for (int i = 0; i < 10; ++i) spike.Feedback (200, ms (10));
+  CHECK (spike.Feedback (200, ms (500)) != HttpThrottle::DECREASE);
+  CHECK (spike.GetLatency () < 250);
+
+  // ...but not a sustained slowdown past twice the best latency.
+  HttpThrottle slow (1, 21);
+  for (int i = 0; i < 10; ++i) slow.Feedback (200, ms (10));
+  double before = slow.GetRate ();
+  CHECK (slow.Feedback (200, ms (2000)) == HttpThrottle::DECREASE);
+  CHECK (slow.GetRate () == before / 2);
+
+  // Below 250 ms, latency is never a reason to back off.
+  HttpThrottle fast (1, 21);
+  for (int i = 0; i < 10; ++i) fast.Feedback (200, ms (20));
+  CHECK (fast.Feedback (200, ms (200)) != HttpThrottle::DECREASE);
+
+  return Check::Result ();
+}
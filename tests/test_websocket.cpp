@@ -0,0 +1,245 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+#include <string>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "Check.h"
+#include "MockServer.h"
+#include "Core.h"
+#include "Http.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Polls a condition for up to a second.
+static bool eventually (const function<bool ()> & condition)
+{
+  for (int i = 0; i < 100; ++i)
+  {
+    if (condition ()) return true;
+    this_thread::sleep_for (chrono::milliseconds (10));
+  }
+  return condition ();
+}
+
+// Session token, through the login flow.
+static string login (HttpPool & pool, const string & api)
+{
+  string body;
+  pool.Request ("POST", api + "/login/session", {},
+                json {{"app_id", "pvr.freebox"}, {"password", Core::Password (MockServer::APP_TOKEN, MockServer::CHALLENGE)}}.dump (),
+                &body);
+  json j = json::parse (body, nullptr, false);
+  return j.is_object () ? j ["result"].value ("session_token", "") : "";
+}
+
+// Raw client: handshake sent, connection and response head returned.
+static int raw_open (int port, const string & key, const string & session, string * head)
+{
+  int s = socket (AF_INET, SOCK_STREAM, 0);
+
+  sockaddr_in address;
+  memset (&address, 0, sizeof (address));
+  address.sin_family      = AF_INET;
+  address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  address.sin_port        = htons (port);
+  if (connect (s, (sockaddr *) &address, sizeof (address)) != 0) {close (s); return -1;}
+
+  string request = "GET " + MockServer::WS_PATH + " HTTP/1.1\r\n"
+                   "Host: 127.0.0.1\r\n"
+                   "Upgrade: websocket\r\n"
+                   "Connection: Upgrade\r\n"
+                   "Sec-WebSocket-Key: " + key + "\r\n"
+                   "Sec-WebSocket-Version: 13\r\n"
+                   "X-Fbx-App-Auth: " + session + "\r\n"
+                   "\r\n";
+  send (s, request.data (), request.size (), MSG_NOSIGNAL);
+
+  // Byte by byte: nothing past the head is consumed.
+  head->clear ();
+  char c;
+  while (head->find ("\r\n\r\n") == string::npos && recv (s, &c, 1, 0) == 1)
+    *head += c;
+
+  return s;
+}
+
+// Client frame (masked, unless told otherwise).
+static string raw_frame (int opcode, const string & payload, bool fin = true, bool masked = true)
+{
+  string frame;
+  frame += (char) ((fin ? 0x80 : 0) | opcode);
+  frame += (char) ((masked ? 0x80 : 0) | payload.size ());
+  const char mask [4] = {0x12, 0x34, 0x56, 0x78};
+  if (masked) frame.append (mask, 4);
+  for (size_t i = 0; i < payload.size (); ++i)
+    frame += masked ? payload [i] ^ mask [i % 4] : payload [i];
+  return frame;
+}
+
+// Server frame (small, unmasked): opcode and payload, or -1.
+static int raw_read (int s, string * payload)
+{
+  unsigned char head [2];
+  if (recv (s, head, 2, MSG_WAITALL) != 2) return -1;
+  if ((head [1] & 0x80) != 0 || (head [1] & 0x7F) >= 126) return -1;
+
+  payload->assign (head [1] & 0x7F, '\0');
+  if (! payload->empty () && recv (s, &(*payload) [0], payload->size (), MSG_WAITALL) != (ssize_t) payload->size ())
+    return -1;
+
+  return head [0] & 0x0F;
+}
+
+static void raw_send (int s, const string & data)
+{
+  send (s, data.data (), data.size (), MSG_NOSIGNAL);
+}
+
+// Client connected and registered for the PVR events.
+static bool ws_register (WebSocket & ws, const string & url, const string & session)
+{
+  if (! ws.Open (url, {{"X-Fbx-App-Auth", session}})) return false;
+
+  json request = {{"action", "register"}, {"events", {"pvr_programmed_changed", "pvr_finished_changed"}}};
+  if (! ws.Send (request.dump ())) return false;
+
+  string message;
+  if (ws.Receive (&message, 1000) != WebSocket::MESSAGE) return false;
+
+  json m = json::parse (message, nullptr, false);
+  return m.is_object () && m.value ("action", "") == "register" && m.value ("success", false);
+}
+
+int main ()
+{
+  MockServer::Options options;
+  options.channels = 10;
+
+  MockServer server (options);
+  CHECK (server.Start () > 0);
+
+  HttpPool pool (2);
+  string session = login (pool, server.URL () + "/api/v6");
+  CHECK (! session.empty ());
+
+  const string url = "ws://127.0.0.1:" + to_string (server.Port ()) + MockServer::WS_PATH;
+  string head, payload;
+
+  // Handshake: accept key (RFC 6455 sample), session required.
+  {
+    int s = raw_open (server.Port (), "dGhlIHNhbXBsZSBub25jZQ==", session, &head);
+    CHECK (head.compare (0, 12, "HTTP/1.1 101") == 0);
+    CHECK (head.find ("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != string::npos);
+    close (s);
+
+    s = raw_open (server.Port (), "dGhlIHNhbXBsZSBub25jZQ==", "wrong", &head);
+    CHECK (head.compare (0, 12, "HTTP/1.1 403") == 0);
+    close (s);
+
+    WebSocket ws;
+    CHECK (! ws.Open (url, {}));
+    CHECK (! ws.IsOpen ());
+  }
+
+  // Register, then notifications for the registered events only.
+  WebSocket ws;
+  CHECK (ws_register (ws, url, session));
+  CHECK (server.WebSockets () == 1);
+
+  CHECK (server.Notify ("pvr", "programmed_changed") == 1);
+  CHECK (server.Notify ("pvr", "generator_changed") == 0);
+  string message;
+  CHECK (ws.Receive (&message, 1000) == WebSocket::MESSAGE);
+  json n = json::parse (message, nullptr, false);
+  CHECK (n.value ("action", "") == "notification");
+  CHECK (n.value ("source", "") + '_' + n.value ("event", "") == "pvr_programmed_changed");
+  CHECK (ws.Receive (&message, 100) == WebSocket::TIMEOUT);
+
+  // Fragmented and masked server frames are reassembled.
+  CHECK (server.Notify ("pvr", "finished_changed", 5) == 1);
+  CHECK (ws.Receive (&message, 1000) == WebSocket::MESSAGE);
+  CHECK (json::parse (message, nullptr, false).value ("event", "") == "finished_changed");
+
+  CHECK (server.Notify ("pvr", "finished_changed", 3, true) == 1);
+  CHECK (ws.Receive (&message, 1000) == WebSocket::MESSAGE);
+  CHECK (json::parse (message, nullptr, false).value ("event", "") == "finished_changed");
+
+  // Pings are answered during Receive (same payload).
+  CHECK (server.Ping ("are you there") == 1);
+  CHECK (ws.Receive (&message, 200) == WebSocket::TIMEOUT);
+  CHECK (eventually ([&server] {return server.Pong () == "are you there";}));
+
+  // Close from the server: echoed, then closed.
+  CHECK (server.CloseWebSockets (1001) == 1);
+  CHECK (ws.Receive (&message, 1000) == WebSocket::CLOSED);
+  CHECK (! ws.IsOpen ());
+  CHECK (eventually ([&server] {return server.WebSockets () == 0;}));
+
+  // Reconnect after a drop.
+  CHECK (ws_register (ws, url, session));
+  CHECK (server.DropWebSockets () == 1);
+  CHECK (ws.Receive (&message, 1000) == WebSocket::CLOSED);
+  CHECK (eventually ([&server] {return server.WebSockets () == 0;}));
+  CHECK (ws_register (ws, url, session));
+  CHECK (server.Notify ("pvr", "programmed_changed") == 1);
+  CHECK (ws.Receive (&message, 1000) == WebSocket::MESSAGE);
+  ws.Close ();
+
+  // Server side, with a raw client.
+  {
+    int s = raw_open (server.Port (), "dGhlIHNhbXBsZSBub25jZQ==", session, &head);
+
+    // Fragmented client message.
+    string request = json {{"action", "register"}, {"events", {"pvr_finished_changed"}}}.dump ();
+    raw_send (s, raw_frame (0x1, request.substr (0, 10), false));
+    raw_send (s, raw_frame (0x0, request.substr (10, 10), false));
+    raw_send (s, raw_frame (0x0, request.substr (20)));
+    CHECK (raw_read (s, &payload) == 0x1);
+    CHECK (json::parse (payload, nullptr, false).value ("success", false));
+
+    // Ping from the client.
+    raw_send (s, raw_frame (0x9, "ping"));
+    CHECK (raw_read (s, &payload) == 0xA && payload == "ping");
+
+    // Close from the client: status code echoed.
+    raw_send (s, raw_frame (0x8, string ("\x03\xe8", 2)));
+    CHECK (raw_read (s, &payload) == 0x8 && payload == string ("\x03\xe8", 2));
+    close (s);
+
+    // Unmasked client frame: protocol error (1002).
+    s = raw_open (server.Port (), "dGhlIHNhbXBsZSBub25jZQ==", session, &head);
+    raw_send (s, raw_frame (0x1, "{}", true, false));
+    CHECK (raw_read (s, &payload) == 0x8 && payload == string ("\x03\xea", 2));
+    close (s);
+  }
+
+  server.Stop ();
+  return Check::Result ();
+}
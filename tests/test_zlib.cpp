@@ -0,0 +1,123 @@
+/*
+ *      Copyright (C) 2018 Aassif Benassarou
+ *      http://github.com/aassif/pvr.freebox/
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string>
+#include <istream>
+#include <sstream>
+#include <iterator>
+#include <cstring>
+
+#include "Check.h"
+#include "Zlib.h"
+
+using namespace std;
+
+// Input handed out one byte at a time (like a slow socket).
+class Trickle : public streambuf
+{
+  private:
+    string m_data;
+    size_t m_offset;
+    char   m_byte;
+
+  protected:
+    int_type underflow () override
+    {
+      if (m_offset >= m_data.size ()) return traits_type::eof ();
+      m_byte = m_data [m_offset++];
+      setg (&m_byte, &m_byte, &m_byte + 1);
+      return traits_type::to_int_type (m_byte);
+    }
+
+    streamsize xsgetn (char * s, streamsize n) override
+    {
+      if (n <= 0 || underflow () == traits_type::eof ()) return 0;
+      *s = m_byte;
+      setg (&m_byte, &m_byte + 1, &m_byte + 1);
+      return 1;
+    }
+
+  public:
+    Trickle (const string & data) : m_data (data), m_offset (0), m_byte (0) {}
+};
+
+// windowBits: 15 (zlib), 15 + 16 (gzip), -15 (raw).
+static string deflate_with (const string & data, int bits)
+{
+  z_stream z;
+  memset (&z, 0, sizeof (z));
+  deflateInit2 (&z, 6, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY);
+
+  string out (deflateBound (&z, data.size ()), '\0');
+  z.next_in   = (Bytef *) data.data ();
+  z.avail_in  = (uInt) data.size ();
+  z.next_out  = (Bytef *) &out [0];
+  z.avail_out = (uInt) out.size ();
+  deflate (&z, Z_FINISH);
+  out.resize (z.total_out);
+  deflateEnd (&z);
+  return out;
+}
+
+static string inflate_from (streambuf * source, bool * error)
+{
+  ZlibInflate z (source);
+  istream is (&z);
+  string out ((istreambuf_iterator<char> (is)), istreambuf_iterator<char> ());
+  *error = z.IsError ();
+  return out;
+}
+
+int main ()
+{
+  string data;
+  for (int i = 0; i < 20000; ++i)
+    data += "{\"id\": \"pluri_" + to_string (i * 7919) + "\"}, ";
+
+  for (int bits : {15, 15 + 16, -15})
+  {
+    string compressed = deflate_with (data, bits);
+    bool error;
+
+    // In one piece.
+    stringbuf whole (compressed);
+    CHECK (inflate_from (&whole, &error) == data);
+    CHECK (! error);
+
+    // Byte by byte: the format is known before the first inflate.
+    Trickle trickle (compressed);
+    CHECK (inflate_from (&trickle, &error) == data);
+    CHECK (! error);
+
+    // Truncated.
+    stringbuf truncated (compressed.substr (0, compressed.size () / 2));
+    inflate_from (&truncated, &error);
+    CHECK (error);
+  }
+
+  // Empty.
+  stringbuf empty;
+  bool error;
+  CHECK (inflate_from (&empty, &error).empty ());
+  CHECK (error);
+
+  return Check::Result ();
+}